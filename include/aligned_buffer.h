@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+
+namespace stems {
+
+// Alignment for persistent sample/tensor buffers (cache line, covers AVX-512 and FFTW SIMD)
+constexpr auto buffer_alignment = 64uz;
+
+static_assert((buffer_alignment & (buffer_alignment - 1)) == 0, "Alignment must be power of 2");
+
+// Fixed-size, zero-initialised heap buffer with SIMD-friendly alignment
+// Allocated once and reused, so hot loops never touch the allocator
+template <typename T>
+class AlignedBuffer {
+    static_assert(std::is_trivially_destructible_v<T>, "Elements are released without destruction");
+
+public:
+    AlignedBuffer() = default;
+
+    explicit AlignedBuffer(std::size_t size) : size_(size) {
+        if (size == 0)
+            return;
+
+        // aligned_alloc requires the byte count to be a multiple of the alignment
+        auto const bytes = (size * sizeof(T) + buffer_alignment - 1) / buffer_alignment * buffer_alignment;
+        auto* memory = static_cast<T*>(std::aligned_alloc(buffer_alignment, bytes));
+        if (!memory)
+            throw std::bad_alloc{};
+
+        data_.reset(memory);
+        std::uninitialized_value_construct_n(memory, size);
+    }
+
+    T* data() { return data_.get(); }
+    T const* data() const { return data_.get(); }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    std::span<T> span() { return {data_.get(), size_}; }
+    std::span<T const> span() const { return {data_.get(), size_}; }
+
+private:
+    struct Free {
+        void operator()(T* memory) const { std::free(memory); }
+    };
+
+    std::unique_ptr<T[], Free> data_;
+    std::size_t size_ = 0;
+};
+
+} // namespace stems
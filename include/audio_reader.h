@@ -0,0 +1,52 @@
+#pragma once
+
+#include "audio_validator.h"
+#include "wav_file.h"
+#include <sndfile.h>
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace stems {
+
+// Sequential stereo reader that decodes fixed-size windows on demand
+// Keeps memory bounded by the window size rather than the track length
+// PCM and float WAV files are memory-mapped and decoded straight into the
+// caller's buffers; anything else is decoded through libsndfile
+class AudioReader {
+public:
+    // Open and validate a file for reading (stereo WAV, as accepted by validate_audio_file)
+    // The file is opened once, so there is no need to validate it separately
+    static std::expected<AudioReader, ValidationError> open(std::string_view);
+
+    // Read up to left.size() frames, de-interleaving into planar channels
+    // Returns frames read, 0 at end of file
+    std::expected<std::size_t, ValidationError> read(std::span<float> left, std::span<float> right);
+
+    AudioInfo const& info() const { return info_; }
+
+    // Encoding of a memory-mapped file, nullopt when reading through libsndfile
+    std::optional<WavEncoding> mapped_encoding() const;
+
+private:
+    struct FileCloser {
+        void operator()(SNDFILE* file) const { sf_close(file); }
+    };
+
+    AudioReader(std::unique_ptr<SNDFILE, FileCloser>, AudioInfo);
+    AudioReader(WavFile, AudioInfo);
+
+    // Exactly one backend is set
+    std::unique_ptr<SNDFILE, FileCloser> file_;
+    std::optional<WavFile> wav_;
+    std::size_t position_ = 0uz;  // Next frame of wav_
+
+    AudioInfo info_;
+    std::vector<float> block_;  // Interleaved libsndfile decode buffer
+};
+
+} // namespace stems
@@ -1,9 +1,15 @@
 #pragma once
 
-#include "stem_processor.h"
+#include "stem_audio.h"
+#include "thread_pool.h"
+#include <sndfile.h>
 #include <expected>
 #include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string_view>
+#include <vector>
 
 namespace stems {
 
@@ -35,13 +41,97 @@ static_assert(error_message(WriteError::FileCreationFailed) == "Failed to create
 static_assert(error_message(WriteError::WriteFailed) == "Failed to write audio data");
 static_assert(!error_message(WriteError::InvalidPath).empty());
 
-// Write separated stems to WAV files
-// Creates 4 files: {base}_vocals.wav, {base}_drums.wav, {base}_bass.wav, {base}_other.wav
+// Encoding of the stem files
+enum class OutputFormat {
+    Pcm16,    // 16-bit WAV
+    Pcm24,    // 24-bit WAV
+    Float32,  // 32-bit float WAV, no requantisation or clipping
+    Flac      // 24-bit FLAC
+};
+
+// Command line name of an output format
+constexpr std::string_view output_format_name(OutputFormat format) {
+    switch (format) {
+        case OutputFormat::Pcm16:
+            return "pcm16";
+        case OutputFormat::Pcm24:
+            return "pcm24";
+        case OutputFormat::Float32:
+            return "float";
+        case OutputFormat::Flac:
+            return "flac";
+    }
+    return "unknown";
+}
+
+constexpr std::optional<OutputFormat> parse_output_format(std::string_view name) {
+    for (auto const format : {OutputFormat::Pcm16, OutputFormat::Pcm24, OutputFormat::Float32, OutputFormat::Flac})
+        if (output_format_name(format) == name)
+            return format;
+    return std::nullopt;
+}
+
+// File extension for an output format
+constexpr std::string_view output_extension(OutputFormat format) {
+    return format == OutputFormat::Flac ? ".flac" : ".wav";
+}
+
+// Compile-time tests
+static_assert(parse_output_format("pcm24") == OutputFormat::Pcm24);
+static_assert(parse_output_format(output_format_name(OutputFormat::Float32)) == OutputFormat::Float32);
+static_assert(!parse_output_format("mp3").has_value());
+static_assert(output_extension(OutputFormat::Flac) == ".flac");
+static_assert(output_extension(OutputFormat::Pcm16) == ".wav");
+
+// Incremental stem writer: one open file per stem, appended block by block
+// Lets streaming separation flush finished audio without holding the whole track
+// Stems are interleaved, converted and written concurrently on the writer's own I/O
+// threads, so slow (e.g. network) storage never occupies the DSP pool
+class StemWriter {
+public:
+    // Create {base}_{name}.{wav,flac} for every output stem, named in output order
+    static std::expected<StemWriter, WriteError> open(
+        std::filesystem::path const&,
+        std::span<std::string_view const> stem_names,
+        int sample_rate,
+        int channels,
+        OutputFormat = OutputFormat::Pcm16
+    );
+
+    // Append the same range of samples to every stem file (one view stem per file)
+    std::expected<void, WriteError> write(StemAudioView);
+
+    // Flush and close every file
+    std::expected<void, WriteError> close();
+
+    std::size_t frames_written() const { return frames_written_; }
+
+private:
+    struct FileCloser {
+        void operator()(SNDFILE* file) const { sf_close(file); }
+    };
+
+    StemWriter(std::vector<std::unique_ptr<SNDFILE, FileCloser>>, std::size_t channels);
+
+    // Interleave and append one stem, false on a short write
+    bool write_stem(std::size_t stem, StemAudioView);
+
+    std::vector<std::unique_ptr<SNDFILE, FileCloser>> files_;
+    std::size_t channels_;
+    std::vector<std::vector<float>> blocks_;  // Interleave scratch buffer per stem
+    std::unique_ptr<ThreadPool> io_pool_;     // One thread per stem beyond the caller
+    std::size_t frames_written_ = 0uz;
+};
+
+// Write separated stems to WAV or FLAC files
+// Creates one file per stem, e.g. {base}_vocals.wav, {base}_drums.wav, ...
+// Channel count comes from the planar stem buffer
 std::expected<void, WriteError> write_stems(
     std::filesystem::path const&,
-    SeparatedStems const&,
+    StemAudio const&,
+    std::span<std::string_view const> stem_names,
     int sample_rate,
-    int channels
+    OutputFormat = OutputFormat::Pcm16
 );
 
 } // namespace stems
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "audio_reader.h"
+#include "audio_writer.h"
+#include "onnx_model.h"
+#include "stem_processor.h"
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace stems {
+
+// Outcome of separating one input file
+struct JobReport {
+    std::filesystem::path input;
+    double audio_seconds = 0.0;
+    double wall_seconds = 0.0;
+    std::size_t chunks = 0uz;
+    std::size_t silent_chunks = 0uz;  // Skipped by the silence gate
+    std::size_t cached_chunks = 0uz;  // Read from the result cache
+    std::string_view error{};  // Empty on success (points at a static error message)
+
+    bool ok() const { return error.empty(); }
+
+    // Audio-seconds processed per wall-second
+    double throughput() const { return wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0; }
+};
+
+// Per-file reports in input order plus aggregate timing
+struct BatchReport {
+    std::vector<JobReport> jobs;
+    double wall_seconds = 0.0;
+
+    double audio_seconds() const;
+    std::size_t failures() const;
+    double throughput() const { return wall_seconds > 0.0 ? audio_seconds() / wall_seconds : 0.0; }
+};
+
+// Intra-op threads for a session shared by `jobs` concurrent Session::Run calls
+// ONNX Runtime counts the calling thread as one intra-op thread, and every job
+// contributes its own caller, so the pool gets what is left after the callers
+constexpr std::size_t intra_op_threads_for(std::size_t hardware_threads, std::size_t jobs) {
+    if (hardware_threads == 0 or jobs == 0)
+        return 0uz;  // Unknown, let ONNX Runtime decide
+    return hardware_threads > jobs ? hardware_threads - jobs + 1uz : 1uz;
+}
+
+// Compile-time tests
+static_assert(intra_op_threads_for(16uz, 1uz) == 16uz);
+static_assert(intra_op_threads_for(16uz, 4uz) == 13uz);
+static_assert(intra_op_threads_for(4uz, 8uz) == 1uz);
+static_assert(intra_op_threads_for(0uz, 4uz) == 0uz);
+
+// Validate and separate one file with streaming I/O, writing {base}/{base}_{stem}.{wav,flac}
+JobReport separate_file(StemProcessor&, std::filesystem::path const&, OutputFormat = OutputFormat::Pcm16);
+
+// Separate from an already opened reader, naming the stems after `input`
+JobReport separate_file(
+    StemProcessor&,
+    AudioReader&,
+    std::filesystem::path const& input,
+    OutputFormat = OutputFormat::Pcm16
+);
+
+// Separate many files over `jobs` workers sharing one loaded model
+// Every worker owns a copy of the processor (tensors, pipeline) but the session,
+// STFT plans and DSP thread pool are shared
+BatchReport run_batch(
+    StemProcessor const&,
+    std::span<std::filesystem::path const>,
+    std::size_t jobs,
+    OutputFormat = OutputFormat::Pcm16
+);
+
+} // namespace stems
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace stems {
+
+// Cross-fade between consecutive chunks over their shared overlap
+enum class FadeShape {
+    Triangular,  // Linear fades summing to one (Demucs-style): exact when neighbouring
+                 // chunks agree, as separations of the same audio largely do
+    EqualPower   // Sine/cosine fades with constant summed power: keeps the level where
+                 // the chunks disagree, up to 3 dB loud mid-fade where they agree
+};
+
+// Command line name of a fade shape
+constexpr std::string_view fade_shape_name(FadeShape shape) {
+    switch (shape) {
+        case FadeShape::Triangular:
+            return "triangular";
+        case FadeShape::EqualPower:
+            return "equal-power";
+    }
+    return "unknown";
+}
+
+constexpr std::optional<FadeShape> parse_fade_shape(std::string_view name) {
+    for (auto const shape : {FadeShape::Triangular, FadeShape::EqualPower})
+        if (fade_shape_name(shape) == name)
+            return shape;
+    return std::nullopt;
+}
+
+// Compile-time tests
+static_assert(parse_fade_shape("triangular") == FadeShape::Triangular);
+static_assert(parse_fade_shape(fade_shape_name(FadeShape::EqualPower)) == FadeShape::EqualPower);
+static_assert(!parse_fade_shape("hann").has_value());
+
+// Overlap-add of fixed-size chunks whose first and last `overlap` samples are shared
+// with their neighbours. Fade tables are computed once; only the overlap regions are
+// weighted (vectorised) and the interior, which no other chunk touches, is copied
+// Each output sample is written by the chunks covering it in chunk order:
+//   head  [0, overlap):          out += chunk * fade_in   (adds to the previous tail)
+//   body  [overlap, n - overlap): out = chunk
+//   tail  [n - overlap, n):      out = chunk * fade_out  (the next head adds to it)
+// The first chunk has no fade-in and the last no fade-out
+class CrossFade {
+public:
+    CrossFade(std::size_t overlap, FadeShape);
+
+    // Blend chunk samples [begin, end) into `output`, which is aligned with the chunk
+    // start and may be shorter than it at the end of the track
+    // Chunks must be at least twice the overlap
+    // Disjoint ranges of one chunk can be blended concurrently
+    void blend(
+        std::span<float> output,
+        std::span<float const> chunk,
+        std::size_t begin,
+        std::size_t end,
+        bool is_first_chunk,
+        bool is_last_chunk
+    ) const;
+
+    std::size_t overlap() const { return fade_in_.size(); }
+
+private:
+    std::vector<float> fade_in_;
+    std::vector<float> fade_out_;  // fade_in_ reversed
+};
+
+} // namespace stems
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "onnx_model.h"
+#include "stem_processor.h"
+#include "stem_selection.h"
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string_view>
+
+namespace stems {
+
+// Strictly positive integer option value, e.g. a thread or chunk count
+constexpr std::optional<std::size_t> parse_count(std::string_view value) {
+    if (value.empty())
+        return std::nullopt;
+
+    auto count = 0uz;
+    for (auto const c : value) {
+        if (c < '0' or c > '9' or count > (std::numeric_limits<std::size_t>::max() - 9uz) / 10uz)
+            return std::nullopt;
+        count = count * 10uz + static_cast<std::size_t>(c - '0');
+    }
+    return count > 0uz ? std::optional{count} : std::nullopt;
+}
+
+// Level in dBFS below full scale, e.g. -70 or -12.5
+constexpr std::optional<float> parse_decibels(std::string_view value) {
+    if (!value.starts_with('-'))
+        return std::nullopt;
+
+    auto const magnitude = parse_weight(value.substr(1uz));
+    return magnitude and *magnitude > 0.0f ? std::optional{-*magnitude} : std::nullopt;
+}
+
+// Compile-time tests
+static_assert(parse_count("16") == 16uz);
+static_assert(!parse_count("0").has_value());
+static_assert(!parse_count("").has_value());
+static_assert(!parse_count("-1").has_value());
+static_assert(!parse_count("4k").has_value());
+static_assert(!parse_count("99999999999999999999999").has_value());
+static_assert(parse_decibels("-70") == -70.0f);
+static_assert(parse_decibels("-12.5") == -12.5f);
+static_assert(!parse_decibels("70").has_value());
+static_assert(!parse_decibels("-0").has_value());
+static_assert(!parse_decibels("-").has_value());
+
+// How parse_common_option handled an argument
+enum class OptionMatch {
+    NotCommon,  // Not one of the shared options, left for the caller
+    Parsed,
+    Invalid     // A shared option with a missing or malformed value
+};
+
+// Parse args[i] if it is a model or processing option both stems and stems-server
+// take (provider, threads, chunking, stems, gate, fade, shifts, result cache),
+// consuming its value and advancing i past it
+OptionMatch parse_common_option(
+    std::span<char* const> args,
+    std::size_t& i,
+    ModelOptions& model,
+    ProcessingOptions& processing,
+    std::optional<std::size_t>& intra_op_threads
+);
+
+} // namespace stems
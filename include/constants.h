@@ -44,6 +44,27 @@ constexpr auto model_chunk_size = 343980uz;  // ~7.8 seconds at 44.1kHz
 // Overlap between chunks for smooth blending (5% of chunk size)
 constexpr auto chunk_overlap = model_chunk_size / 20uz;  // 17,199 samples (~0.39s)
 
+// Chunks per inference run (batching needs a model exported with a dynamic batch axis)
+constexpr auto default_batch_size = 1uz;
+
+// Batches in flight between pipeline stages (prepare, infer, blend)
+constexpr auto pipeline_depth = 2uz;
+
+// Chunks peaking below this level skip inference and separate to silence
+// (-80 dBFS is well under 16-bit dither, so no audible content is gated)
+constexpr auto silence_threshold_db = -80.0f;
+
+// Longest delay among shifted copies of a chunk (Demucs' shift trick): 0.5 seconds at
+// 44.1kHz, as upstream
+constexpr auto max_shift = 22050uz;
+
+// Chunk for incremental (live) separation with a dynamic time axis: ~2 seconds at
+// 44.1kHz bounds the delay, at some quality cost against the 7.8s training segment
+constexpr auto live_chunk_size = 88200uz;
+
+// Frames per push when a file is separated as though it were a live input
+constexpr auto live_block_size = 4096uz;
+
 // Stem names for different model variants
 // htdemucs (4 stems): drums, bass, other, vocals
 constexpr std::array<std::string_view, 4uz> stem_names_4 = {
@@ -87,8 +108,19 @@ constexpr std::size_t stem_index(std::string_view name) {
     return num_stems; // Invalid index
 }
 
+// Find stem index by name with dynamic stem count (total_stems if the model has no such stem)
+constexpr std::size_t stem_index(std::string_view name, std::size_t total_stems) {
+    for (auto i = 0uz; i < total_stems; ++i)
+        if (stem_name(i, total_stems) == name)
+            return i;
+    return total_stems; // Invalid index
+}
+
 // Compile-time tests
 static_assert(num_stems == 4);
+static_assert(default_batch_size > 0);
+static_assert(pipeline_depth >= 2, "Need one batch preparing while another is inferring");
+static_assert(silence_threshold_db < 0.0f);
 static_assert(stem_names.size() == num_stems);
 static_assert(stem_name(0) == "drums");
 static_assert(stem_name(1) == "bass");
@@ -98,6 +130,9 @@ static_assert(stem_name(999) == "unknown");
 static_assert(stem_index("drums") == 0);
 static_assert(stem_index("vocals") == 3);
 static_assert(stem_index("invalid") == num_stems);
+static_assert(stem_index("piano", 6uz) == 5uz);
+static_assert(stem_index("piano", 4uz) == 4uz);
+static_assert(stem_index("vocals", 6uz) == stem_index("vocals"));
 
 } // namespace separation
 
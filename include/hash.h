@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace stems {
+
+// 64-bit FNV-1a: fast, non-cryptographic, stable across runs and platforms
+// Used for cache keys; 64 bits make collisions unlikely, not impossible, so a cache
+// that mustn't serve a wrong entry also checks what it stored (see ResultCache)
+namespace fnv1a {
+
+constexpr auto offset_basis = 0xcbf29ce484222325ull;
+constexpr auto prime = 0x100000001b3ull;
+
+constexpr std::uint64_t hash(std::string_view text, std::uint64_t seed = offset_basis) {
+    for (auto const c : text)
+        seed = (seed ^ static_cast<unsigned char>(c)) * prime;
+    return seed;
+}
+
+inline std::uint64_t hash(std::span<std::byte const> bytes, std::uint64_t seed = offset_basis) {
+    for (auto const b : bytes)
+        seed = (seed ^ static_cast<std::uint64_t>(b)) * prime;
+    return seed;
+}
+
+// Compile-time tests (reference vectors)
+static_assert(hash("") == 0xcbf29ce484222325ull);
+static_assert(hash("a") == 0xaf63dc4c8601ec8cull);
+static_assert(hash("foobar") == 0x85944171f73967e8ull);
+static_assert(hash("bar", hash("foo")) == hash("foobar"));
+
+} // namespace fnv1a
+
+} // namespace stems
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace stems {
+
+// Pipeline stages timed per chunk (per batch for inference)
+enum class Stage {
+    Prepare,    // Chunk audio decoded or copied into the waveform tensor, silence gate
+    Stft,       // Forward transform of one channel into the spectrogram tensor
+    Inference,  // OnnxModel::infer over a batch: boundary conversion and Session::Run
+    Blend,      // Overlap-add of one separated chunk into the output
+    Write,      // Finished region handed to the stem sink (encoding and file writes)
+    NumStages
+};
+
+constexpr std::string_view stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::Prepare:
+            return "prepare";
+        case Stage::Stft:
+            return "stft";
+        case Stage::Inference:
+            return "session_run";
+        case Stage::Blend:
+            return "blend";
+        case Stage::Write:
+            return "write";
+        case Stage::NumStages:
+            break;
+    }
+    return "unknown";
+}
+
+// Compile-time tests
+static_assert(stage_name(Stage::Inference) == "session_run");
+static_assert(stage_name(Stage::NumStages) == "unknown");
+
+// Process-wide memory counters
+struct MemoryStats {
+    std::size_t peak_rss_bytes = 0uz;     // High-water resident set size of the process
+    std::uint64_t allocations = 0u;       // C++ heap allocations (operator new) while a Trace exists
+    std::uint64_t allocated_bytes = 0u;
+};
+
+MemoryStats memory_stats();
+
+// Operator profile written by ONNX Runtime (see OnnxModel::end_profiling)
+struct OrtProfile {
+    std::filesystem::path path;  // Chrome-trace event array
+    std::uint64_t start_ns;      // Profiling start, nanoseconds since the system clock epoch
+};
+
+// Thread-safe collector of timed stage spans, shared by every processor and pipeline
+// thread of a run. Recording takes a lock once per span, which is negligible next to
+// the per-chunk work; console output only happens when the summary is printed
+class Trace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Counts allocations for as long as any Trace exists
+    Trace();
+    ~Trace();
+
+    // Non-copyable
+    Trace(Trace const&) = delete;
+    Trace& operator=(Trace const&) = delete;
+
+    // Add one completed span on the calling thread
+    void record(Stage, std::optional<std::size_t> chunk, Clock::time_point start, Clock::time_point end);
+
+    // Per-stage count, total, mean and max, then peak RSS and allocations since construction
+    void print_summary() const;
+
+    // Chrome trace JSON (chrome://tracing, Perfetto) with one track per thread and an
+    // allocation counter; ONNX Runtime's operator events are merged in when given
+    bool write_chrome_trace(std::filesystem::path const&, std::optional<OrtProfile> const& = std::nullopt) const;
+
+private:
+    struct Event {
+        Stage stage;
+        std::optional<std::size_t> chunk;
+        std::uint32_t thread;
+        Clock::time_point start;
+        Clock::time_point end;
+        std::uint64_t allocations;  // Process allocation count when the span ended
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+    std::unordered_map<std::thread::id, std::uint32_t> threads_;  // Small ids in first-seen order
+
+    // Trace time zero on both clocks, so ONNX Runtime's system-clock profile lines up
+    Clock::time_point origin_;
+    std::chrono::system_clock::time_point origin_system_;
+    MemoryStats origin_memory_;
+};
+
+// Times its scope as one span of `stage`; does nothing (not even read the clock)
+// when there is no trace
+class TraceSpan {
+public:
+    TraceSpan(Trace* trace, Stage stage, std::optional<std::size_t> chunk = std::nullopt)
+        : trace_(trace), stage_(stage), chunk_(chunk), start_(trace ? Trace::Clock::now() : Trace::Clock::time_point{}) {}
+
+    ~TraceSpan() {
+        if (trace_)
+            trace_->record(stage_, chunk_, start_, Trace::Clock::now());
+    }
+
+    // Non-copyable
+    TraceSpan(TraceSpan const&) = delete;
+    TraceSpan& operator=(TraceSpan const&) = delete;
+
+private:
+    Trace* trace_;
+    Stage stage_;
+    std::optional<std::size_t> chunk_;
+    Trace::Clock::time_point start_;
+};
+
+} // namespace stems
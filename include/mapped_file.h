@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <span>
+
+namespace stems {
+
+// Read-only memory mapping of a whole file
+// Pages are loaded by the kernel on first touch and shared with the page cache,
+// so large files (models, audio) are usable without reading them up front
+class MappedFile {
+public:
+    // Map an existing, non-empty file
+    static std::optional<MappedFile> open(std::filesystem::path const&);
+
+    ~MappedFile();
+
+    // Non-copyable
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    // Movable
+    MappedFile(MappedFile&&) noexcept;
+    MappedFile& operator=(MappedFile&&) noexcept;
+
+    std::span<std::byte const> bytes() const { return {data_, size_}; }
+
+    // Hint that the mapping will be read front to back, so the kernel reads ahead
+    // aggressively and drops pages behind the reader
+    void advise_sequential() const;
+
+private:
+    MappedFile(std::byte const*, std::size_t);
+
+    std::byte const* data_ = nullptr;
+    std::size_t size_ = 0uz;
+};
+
+} // namespace stems
@@ -1,9 +1,18 @@
 #pragma once
 
+#include "aligned_buffer.h"
+#include "instrumentation.h"
+#include "mapped_file.h"
+#include "stem_audio.h"
 #include "stft.h"
 #include <onnxruntime_cxx_api.h>
+#include <cstddef>
+#include <cstdint>
 #include <expected>
+#include <filesystem>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -18,35 +27,345 @@ enum class ModelError {
     InferenceFailed
 };
 
+// Weight precision a model was exported with (the quality/speed tiers)
+enum class ModelPrecision {
+    Fp32,  // Reference quality
+    Fp16,  // Half the weight and tensor memory traffic, for GPU providers
+    Int8   // Dynamically quantised weights with float activations, for the CPU provider
+};
+
+// Name used on the command line and in the converter's "precision" metadata
+constexpr std::string_view precision_name(ModelPrecision precision) {
+    switch (precision) {
+        case ModelPrecision::Fp32:
+            return "fp32";
+        case ModelPrecision::Fp16:
+            return "fp16";
+        case ModelPrecision::Int8:
+            return "int8";
+    }
+    return "unknown";
+}
+
+constexpr std::optional<ModelPrecision> parse_precision(std::string_view name) {
+    for (auto const precision : {ModelPrecision::Fp32, ModelPrecision::Fp16, ModelPrecision::Int8})
+        if (precision_name(precision) == name)
+            return precision;
+    return std::nullopt;
+}
+
+// Compile-time tests
+static_assert(parse_precision("int8") == ModelPrecision::Int8);
+static_assert(parse_precision(precision_name(ModelPrecision::Fp16)) == ModelPrecision::Fp16);
+static_assert(!parse_precision("bf16").has_value());
+
+// Tensor layout discovered from the session at load time
+struct ModelIo {
+    std::string waveform_output;       // Time-domain stems [batch, stems, channels, time]
+    std::size_t max_batch_size;        // 1 for models exported with a fixed batch axis
+    std::optional<std::size_t> chunk_size;  // Fixed time axis, or nullopt for dynamic-shape exports
+    std::size_t num_stems;             // 4 (htdemucs) or 6 (htdemucs_6s)
+    bool has_spectrogram_output;       // Frequency-branch output, never fetched
+    bool half_io;                      // Inputs and output are FP16 rather than FP32
+    ModelPrecision precision;          // From the model metadata, else inferred from the I/O types
+};
+
+// Hardware backends, tried with automatic fallback to CPU
+enum class ExecutionProvider {
+    Auto,       // Best available: TensorRT, CUDA, CoreML, then CPU
+    Cpu,
+    Cuda,
+    TensorRt,
+    CoreMl
+};
+
+// Command line name of an execution provider
+constexpr std::string_view provider_name(ExecutionProvider provider) {
+    switch (provider) {
+        case ExecutionProvider::Auto:
+            return "auto";
+        case ExecutionProvider::Cpu:
+            return "cpu";
+        case ExecutionProvider::Cuda:
+            return "cuda";
+        case ExecutionProvider::TensorRt:
+            return "tensorrt";
+        case ExecutionProvider::CoreMl:
+            return "coreml";
+    }
+    return "unknown";
+}
+
+constexpr std::optional<ExecutionProvider> parse_provider(std::string_view name) {
+    for (auto const provider : {ExecutionProvider::Auto, ExecutionProvider::Cpu, ExecutionProvider::Cuda,
+                                ExecutionProvider::TensorRt, ExecutionProvider::CoreMl})
+        if (provider_name(provider) == name)
+            return provider;
+    return std::nullopt;
+}
+
+// Compile-time tests
+static_assert(parse_provider("cuda") == ExecutionProvider::Cuda);
+static_assert(parse_provider(provider_name(ExecutionProvider::CoreMl)) == ExecutionProvider::CoreMl);
+static_assert(!parse_provider("metal").has_value());
+
+// Parse a CPU list such as "0-7,16-23" (taskset / cpuset syntax), in the order given
+// Empty entries, reversed ranges and non-numeric text are rejected
+constexpr std::optional<std::vector<std::size_t>> parse_cpu_list(std::string_view list) {
+    auto cpus = std::vector<std::size_t>{};
+
+    auto const parse_number = [](std::string_view text) -> std::optional<std::size_t> {
+        if (text.empty())
+            return std::nullopt;
+        auto value = 0uz;
+        for (auto const c : text) {
+            if (c < '0' or c > '9')
+                return std::nullopt;
+            value = value * 10uz + static_cast<std::size_t>(c - '0');
+        }
+        return value;
+    };
+
+    while (!list.empty()) {
+        auto const comma = list.find(',');
+        auto const entry = list.substr(0uz, comma);
+        list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1uz);
+
+        auto const dash = entry.find('-');
+        auto const first = parse_number(entry.substr(0uz, dash));
+        auto const last = dash == std::string_view::npos ? first : parse_number(entry.substr(dash + 1uz));
+        if (!first or !last or *last < *first)
+            return std::nullopt;
+
+        for (auto cpu = *first; cpu <= *last; ++cpu)
+            cpus.push_back(cpu);
+
+        if (comma != std::string_view::npos and list.empty())
+            return std::nullopt;  // Trailing comma
+    }
+
+    if (cpus.empty())
+        return std::nullopt;
+    return cpus;
+}
+
+// Compile-time tests
+static_assert(parse_cpu_list("0-3,8")->size() == 5uz);
+static_assert(parse_cpu_list("8,0-1")->front() == 8uz);
+static_assert(parse_cpu_list("3")->back() == 3uz);
+static_assert(!parse_cpu_list("").has_value());
+static_assert(!parse_cpu_list("4-2").has_value());
+static_assert(!parse_cpu_list("0,,1").has_value());
+static_assert(!parse_cpu_list("0,").has_value());
+static_assert(!parse_cpu_list("a-b").has_value());
+
+// Session configuration chosen at load time
+struct ModelOptions {
+    // Preferred backend; CPU is used if it is unavailable or fails to initialise
+    ExecutionProvider provider = ExecutionProvider::Cpu;
+
+    // Threads per Session::Run (0 lets ONNX Runtime use every core, or one per pinned CPU)
+    std::size_t intra_op_threads = 0uz;
+
+    // Threads for independent graph branches in parallel execution (0 = ONNX Runtime default)
+    std::size_t inter_op_threads = 0uz;
+
+    // Run independent nodes concurrently on the inter-op pool rather than in sequence
+    bool parallel_execution = false;
+
+    // Idle pool threads spin before sleeping: lower wake-up latency, but the spinning
+    // burns cores other processes on the host could use
+    bool spin_wait = true;
+
+    // Pin intra-op threads one per CPU, e.g. to keep a job on one NUMA node
+    // Sets the intra-op thread count to the number of CPUs
+    std::vector<std::size_t> cpu_affinity{};
+
+    // Create the intra/inter-op pools once in the ONNX Runtime environment and share
+    // them between every session in the process instead of one set per session
+    // The first model loaded fixes the pool configuration
+    bool shared_thread_pool = false;
+
+    // Directory for optimised ORT-format copies of loaded models (empty disables caching)
+    std::filesystem::path cache_dir{};
+
+    // Record ONNX Runtime's per-operator profile to {prefix}_{date}.json (empty disables)
+    // Copies of the model share the session, so share one profile; see end_profiling
+    std::filesystem::path profile_prefix{};
+};
+
+// Per-user cache location: $XDG_CACHE_HOME/stems, else ~/.cache/stems (empty if neither is set)
+std::filesystem::path default_cache_dir();
+
+// Storage for one bound tensor: aligned host memory, or page-locked host memory
+// from the CUDA allocator so host/device copies are direct DMA without staging
+template <typename T>
+class TensorBuffer {
+public:
+    TensorBuffer() = default;
+    explicit TensorBuffer(std::size_t size) : host_(size), data_(host_.data()), size_(size) {}
+
+    TensorBuffer(std::shared_ptr<Ort::Allocator> allocator, std::size_t size) : size_(size) {
+        auto* memory = static_cast<T*>(allocator->Alloc(size * sizeof(T)));
+        std::uninitialized_value_construct_n(memory, size);
+        pinned_ = std::unique_ptr<T, PinnedFree>{memory, PinnedFree{std::move(allocator)}};
+        data_ = memory;
+    }
+
+    T* data() { return data_; }
+    T const* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    std::span<T> span() { return {data_, size_}; }
+    std::span<T const> span() const { return {data_, size_}; }
+
+private:
+    struct PinnedFree {
+        std::shared_ptr<Ort::Allocator> allocator;
+        void operator()(T* memory) const { allocator->Free(memory); }
+    };
+
+    AlignedBuffer<T> host_;
+    std::unique_ptr<T, PinnedFree> pinned_;
+    T* data_ = nullptr;
+    std::size_t size_ = 0uz;
+};
+
+// Persistent, aligned input and output tensors for one batch of chunks
+// Callers write audio and STFT results straight into the input planes and read
+// the separated stems in place, so steady-state inference never allocates
+// For FP16 models the float planes are staging: half-precision copies are bound
+// instead and converted around each run, so callers always see float
+class ModelTensors {
+public:
+    // Spectrogram planes per chunk (complex-as-channels)
+    enum Plane : std::size_t { RealLeft, ImagLeft, RealRight, ImagRight, NumPlanes };
+
+    // Time-domain input for one batch entry and channel: [time]
+    std::span<float> waveform(std::size_t batch_idx, std::size_t channel);
+
+    // Spectrogram input for one batch entry: [bins, frames]
+    std::span<float> spectrogram(std::size_t batch_idx, Plane);
+
+    // All spectrogram planes for one batch entry: [4, bins, frames]
+    std::span<float> spectrogram(std::size_t batch_idx);
+
+    // Separated stereo output for one batch entry: [stems, 2, time]
+    StemAudioView output(std::size_t batch_idx) const;
+
+    // Take the inputs of the first `batch_size` entries from tensors of the same shape
+    // prepared for another model, so an ensemble member skips the STFT; each member
+    // keeps its own bound buffers (FP16 or page-locked as its session needs)
+    void copy_inputs(ModelTensors const&, std::size_t batch_size);
+
+    std::size_t capacity() const { return capacity_; }
+    std::size_t num_samples() const { return num_samples_; }
+    std::size_t num_frames() const { return num_frames_; }
+    std::size_t num_stems() const { return num_stems_; }
+
+private:
+    friend class OnnxModel;
+
+    ModelTensors(
+        std::size_t capacity,
+        std::size_t num_samples,
+        std::size_t num_frames,
+        std::size_t num_stems,
+        bool half_io,
+        std::shared_ptr<Ort::Allocator> pinned
+    );
+
+    std::size_t capacity_;
+    std::size_t num_samples_;
+    std::size_t num_frames_;
+    std::size_t num_stems_;
+
+    bool half_io_;                       // The half_* buffers are bound, not the float ones
+    bool pinned_;                        // Bound buffers are CUDA page-locked host memory
+
+    TensorBuffer<float> waveform_;       // [capacity, 2, time]
+    TensorBuffer<float> spectrogram_;    // [capacity, 4, bins, frames]
+    TensorBuffer<float> output_;         // [capacity, stems, 2, time]
+
+    // IEEE half bit patterns of the tensors above, FP16 models only
+    TensorBuffer<std::uint16_t> half_waveform_;
+    TensorBuffer<std::uint16_t> half_spectrogram_;
+    TensorBuffer<std::uint16_t> half_output_;
+
+    // Tensors and binding over the buffers above, rebuilt only when the
+    // active batch size changes (normally just for the final partial batch)
+    std::unique_ptr<Ort::IoBinding> binding_;
+    std::size_t bound_batch_size_ = 0uz;
+};
+
 // ONNX model wrapper for Demucs htdemucs
+// Copies share one session: Session::Run is thread-safe, so each copy can run
+// concurrently on its own thread as long as it uses its own ModelTensors
 class OnnxModel {
 public:
     // Load model from file path
-    static std::expected<OnnxModel, ModelError> load(std::string_view);
-
-    // Run inference on audio data
-    // Input: time-domain audio and frequency-domain spectrograms (left and right channels)
-    // Output: 4 spectrograms (vocals, drums, bass, other) for each channel
-    std::expected<std::vector<Spectrogram>, ModelError> infer(
-        std::vector<float> const& audio_left,
-        std::vector<float> const& audio_right,
-        Spectrogram const& spec_left,
-        Spectrogram const& spec_right
-    );
+    static std::expected<OnnxModel, ModelError> load(std::string_view, ModelOptions = {});
+
+    // Allocate persistent tensors for batches of up to `capacity` chunks
+    std::expected<ModelTensors, ModelError> allocate_tensors(
+        std::size_t capacity,
+        std::size_t num_samples
+    ) const;
+
+    // Run inference on the first `batch_size` entries of the tensors
+    // Inputs are [N, 2, time] and [N, 4, bins, frames]; output [N, stems, 2, time]
+    // is written into the tensors' persistent output buffer via IoBinding
+    std::expected<void, ModelError> infer(ModelTensors&, std::size_t batch_size) const;
+
+    // Largest batch the model accepts (1 for models exported with a fixed batch axis)
+    std::size_t max_batch_size() const { return io_.max_batch_size; }
+
+    // Number of separated stems the model produces
+    std::size_t num_stems() const { return io_.num_stems; }
+
+    // Samples per chunk the model was exported with, nullopt if its time axis is dynamic
+    std::optional<std::size_t> fixed_chunk_size() const { return io_.chunk_size; }
+
+    // Backend the session actually runs on, after any fallback
+    ExecutionProvider execution_provider() const { return provider_; }
+
+    // Weight precision of the loaded model
+    ModelPrecision precision() const { return io_.precision; }
+
+    // Hash of the model files, execution provider and precision: what decides its
+    // output for a given input
+    std::uint64_t identity() const { return identity_; }
+
+    // Stop the session's profiler and flush its file, nullopt unless profiling was enabled
+    // Call once, after every copy of the model has finished inference
+    std::optional<OrtProfile> end_profiling() const;
 
     // Get model info
     std::string_view model_path() const { return model_path_; }
 
 private:
     OnnxModel(
-        std::unique_ptr<Ort::Env>,
-        std::unique_ptr<Ort::Session>,
-        std::string
+        std::shared_ptr<Ort::Env>,
+        std::shared_ptr<MappedFile const>,
+        std::shared_ptr<Ort::Session>,
+        std::string,
+        ModelIo,
+        ExecutionProvider
     );
 
-    std::unique_ptr<Ort::Env> env_;
-    std::unique_ptr<Ort::Session> session_;
+    // Bind the tensors' buffers for a batch of the given size
+    void bind(ModelTensors&, std::size_t batch_size) const;
+
+    std::shared_ptr<Ort::Env> env_;
+    std::shared_ptr<MappedFile const> model_bytes_;  // Cached model the session reads in place, outlives it
+    std::shared_ptr<Ort::Session> session_;
     std::string model_path_;
+    ModelIo io_;
+    ExecutionProvider provider_;
+    bool profiling_ = false;
+    std::uint64_t identity_ = 0u;
+
+    // Page-locked host allocator for tensors when running on a CUDA device
+    std::shared_ptr<Ort::Allocator> pinned_allocator_;
 };
 
 // Convert ModelError to human-readable string
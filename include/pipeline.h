@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace stems {
+
+// Fixed-capacity blocking queue connecting pipeline stages
+// Closing wakes every waiter; pop drains queued items before reporting closure
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : capacity_(capacity) {}
+
+    // Blocks while full, returns false if the queue has been closed
+    bool push(T item) {
+        auto lock = std::unique_lock{mutex_};
+        not_full_.wait(lock, [this] { return closed_ or items_.size() < capacity_; });
+        if (closed_)
+            return false;
+
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Blocks while empty, returns nullopt once closed and drained
+    std::optional<T> pop() {
+        auto lock = std::unique_lock{mutex_};
+        not_empty_.wait(lock, [this] { return closed_ or !items_.empty(); });
+        if (items_.empty())
+            return std::nullopt;
+
+        auto item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return item;
+    }
+
+    // No further pushes are accepted after closing
+    void close() {
+        auto const lock = std::lock_guard{mutex_};
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    std::size_t capacity_;
+    bool closed_ = false;
+};
+
+} // namespace stems
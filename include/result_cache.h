@@ -0,0 +1,70 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "stem_audio.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+
+namespace stems {
+
+// One stored chunk output, read in place from its mapping
+class CachedResult {
+public:
+    CachedResult(MappedFile, std::size_t num_stems, std::size_t num_samples);
+
+    // [stems][2][samples], as the model wrote it
+    StemAudioView view() const;
+
+private:
+    MappedFile file_;
+    std::size_t num_stems_;
+    std::size_t num_samples_;
+};
+
+// Model outputs stored per chunk under a key over the chunk's input samples, the
+// model's identity and the chunk shape. Repeat submissions skip inference for
+// every chunk, and an edited track only re-runs the chunks whose audio changed.
+// Blending parameters (overlap, fade, stem selection) act after the model so are
+// not part of the key, and changing them still hits
+// The key is a 64-bit hash, so two inputs can share it. Each entry also holds the
+// input it was separated from, compared on load, so a collision is a miss rather
+// than another chunk's stems
+// Entries are written under a temporary name and renamed into place, so concurrent
+// jobs and processes sharing the directory never read a partial entry
+// Nothing is evicted; the directory is safe to delete at any time
+class ResultCache {
+public:
+    // nullopt if the directory can't be created
+    static std::optional<ResultCache> open(
+        std::filesystem::path const& dir,
+        std::uint64_t model_identity,
+        std::size_t num_stems,
+        std::size_t num_samples
+    );
+
+    // Key of one chunk's planar [2][samples] model input
+    std::uint64_t key(std::span<float const> waveform) const;
+
+    // Stored output for a chunk's key and input, nullopt on a miss, an entry of another
+    // shape or one stored for other input under the same key
+    std::optional<CachedResult> load(std::uint64_t key, std::span<float const> waveform) const;
+
+    // Store one chunk's input and [stems][2][samples] output, false if it couldn't be
+    // written (separation carries on, the chunk just isn't cached)
+    bool store(std::uint64_t key, std::span<float const> waveform, StemAudioView output) const;
+
+private:
+    ResultCache(std::filesystem::path, std::uint64_t seed, std::size_t num_stems, std::size_t num_samples);
+
+    std::filesystem::path entry_path(std::uint64_t key) const;
+
+    std::filesystem::path dir_;
+    std::uint64_t seed_;  // Model identity and chunk shape, hashed into every key
+    std::size_t num_stems_;
+    std::size_t num_samples_;
+};
+
+} // namespace stems
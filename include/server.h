@@ -0,0 +1,118 @@
+#pragma once
+
+#include "audio_writer.h"
+#include "onnx_model.h"
+#include "stem_processor.h"
+#include <atomic>
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <string_view>
+
+namespace stems {
+
+// Daemon errors
+enum class ServerError {
+    SocketFailed,
+    BindFailed,
+    ListenFailed,
+    InvalidRequest
+};
+
+// Convert ServerError to human-readable string
+constexpr std::string_view error_message(ServerError error) {
+    switch (error) {
+        case ServerError::SocketFailed:
+            return "Failed to create socket";
+        case ServerError::BindFailed:
+            return "Failed to bind socket path";
+        case ServerError::ListenFailed:
+            return "Failed to listen on socket";
+        case ServerError::InvalidRequest:
+            return "Invalid request";
+    }
+    return "Unknown error";
+}
+
+// Compile-time tests
+static_assert(error_message(ServerError::SocketFailed) == "Failed to create socket");
+static_assert(error_message(ServerError::InvalidRequest) == "Invalid request");
+static_assert(!error_message(ServerError::BindFailed).empty());
+
+// One request per connection, a single newline-terminated line:
+//   SEPARATE <priority> <path>   queue a file, higher priority runs first
+//   PING                         liveness check
+// Replies are a single line: "OK <audio_seconds> <wall_seconds>", "PONG" or "ERROR <message>"
+namespace protocol {
+
+enum class Command { Separate, Ping };
+
+struct Request {
+    Command command;
+    int priority;
+    std::string_view path;
+};
+
+// Longest request line accepted (the path dominates)
+constexpr auto max_request_size = 4096uz;
+
+constexpr std::expected<Request, ServerError> parse_request(std::string_view line) {
+    if (line.ends_with('\n'))
+        line.remove_suffix(1);
+    if (line.ends_with('\r'))
+        line.remove_suffix(1);
+
+    if (line == "PING")
+        return Request{.command = Command::Ping, .priority = 0, .path = {}};
+
+    constexpr auto separate = std::string_view{"SEPARATE "};
+    if (!line.starts_with(separate))
+        return std::unexpected(ServerError::InvalidRequest);
+    line.remove_prefix(separate.size());
+
+    // Signed decimal priority
+    auto const negative = line.starts_with('-');
+    if (negative)
+        line.remove_prefix(1);
+
+    auto priority = 0;
+    auto digits = 0uz;
+    for (; digits < line.size() and line[digits] >= '0' and line[digits] <= '9'; ++digits) {
+        if (digits == 6uz)
+            return std::unexpected(ServerError::InvalidRequest);
+        priority = priority * 10 + (line[digits] - '0');
+    }
+
+    if (digits == 0uz or digits + 1uz >= line.size() or line[digits] != ' ')
+        return std::unexpected(ServerError::InvalidRequest);
+
+    return Request{
+        .command = Command::Separate,
+        .priority = negative ? -priority : priority,
+        .path = line.substr(digits + 1uz)
+    };
+}
+
+// Compile-time tests
+static_assert(parse_request("PING\n")->command == Command::Ping);
+static_assert(parse_request("SEPARATE 5 /music/a.wav\n")->priority == 5);
+static_assert(parse_request("SEPARATE -2 a b.wav\r\n")->path == "a b.wav");
+static_assert(!parse_request("SEPARATE 5\n").has_value());
+static_assert(!parse_request("SEPARATE x a.wav").has_value());
+static_assert(!parse_request("STATUS").has_value());
+
+} // namespace protocol
+
+// Daemon configuration
+struct ServerOptions {
+    std::filesystem::path socket_path;
+    std::size_t jobs = 1uz;           // Warm processors, i.e. files separated concurrently
+    OutputFormat output_format = OutputFormat::Pcm16;
+};
+
+// Serve separation requests on a Unix domain socket until `stop` is set
+// Every worker gets a copy of the warm processor (session, STFT plans) made up front,
+// so requests skip process start, model validation, session creation and planning
+std::expected<void, ServerError> run_server(StemProcessor const&, ServerOptions const&, std::atomic<bool> const& stop);
+
+} // namespace stems
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Vector kernels for the hot sample loops
+// AVX/AVX2 needs -march=native (STEMS_NATIVE) or -mavx2; NEON is always on for arm64
+namespace stems::simd {
+
+// Floats processed per vector instruction in this build
+#if defined(__AVX__)
+constexpr auto width = 8uz;
+#elif defined(__ARM_NEON)
+constexpr auto width = 4uz;
+#else
+constexpr auto width = 1uz;
+#endif
+
+static_assert((width & (width - 1uz)) == 0uz, "Vector width must be power of 2");
+
+// out[i] = a[i] * b[i] over out.size() elements (unaligned loads, out may alias a)
+inline void multiply(std::span<float> out, std::span<float const> a, std::span<float const> b) {
+    auto const count = out.size();
+    auto i = 0uz;
+
+#if defined(__AVX__)
+    for (; i + width <= count; i += width)
+        _mm256_storeu_ps(out.data() + i, _mm256_mul_ps(_mm256_loadu_ps(a.data() + i), _mm256_loadu_ps(b.data() + i)));
+#elif defined(__ARM_NEON)
+    for (; i + width <= count; i += width)
+        vst1q_f32(out.data() + i, vmulq_f32(vld1q_f32(a.data() + i), vld1q_f32(b.data() + i)));
+#endif
+
+    // Remainder (and the whole loop on scalar builds)
+    for (; i < count; ++i)
+        out[i] = a[i] * b[i];
+}
+
+// out[i] += a[i] * b[i] over out.size() elements (overlap-add accumulation)
+inline void multiply_add(std::span<float> out, std::span<float const> a, std::span<float const> b) {
+    auto const count = out.size();
+    auto i = 0uz;
+
+#if defined(__AVX__)
+    for (; i + width <= count; i += width) {
+        auto const product = _mm256_mul_ps(_mm256_loadu_ps(a.data() + i), _mm256_loadu_ps(b.data() + i));
+        _mm256_storeu_ps(out.data() + i, _mm256_add_ps(_mm256_loadu_ps(out.data() + i), product));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + width <= count; i += width)
+        vst1q_f32(out.data() + i, vmlaq_f32(vld1q_f32(out.data() + i), vld1q_f32(a.data() + i), vld1q_f32(b.data() + i)));
+#endif
+
+    for (; i < count; ++i)
+        out[i] += a[i] * b[i];
+}
+
+// max |x[i]|, 0 for empty input (silence detection)
+inline float peak(std::span<float const> x) {
+    auto const count = x.size();
+    auto i = 0uz;
+    auto result = 0.0f;
+
+#if defined(__AVX__)
+    auto const sign = _mm256_set1_ps(-0.0f);
+    auto maximum = _mm256_setzero_ps();
+    for (; i + width <= count; i += width)
+        maximum = _mm256_max_ps(maximum, _mm256_andnot_ps(sign, _mm256_loadu_ps(x.data() + i)));
+
+    alignas(32) float lanes[width];
+    _mm256_store_ps(lanes, maximum);
+    for (auto const lane : lanes)
+        result = std::max(result, lane);
+#elif defined(__ARM_NEON)
+    auto maximum = vdupq_n_f32(0.0f);
+    for (; i + width <= count; i += width)
+        maximum = vmaxq_f32(maximum, vabsq_f32(vld1q_f32(x.data() + i)));
+    result = vmaxvq_f32(maximum);
+#endif
+
+    for (; i < count; ++i)
+        result = std::max(result, std::abs(x[i]));
+    return result;
+}
+
+// left[i] = in[2i], right[i] = in[2i + 1] over left.size() frames (stereo de-interleave)
+inline void deinterleave(std::span<float> left, std::span<float> right, std::span<float const> in) {
+    auto const count = left.size();
+    auto i = 0uz;
+
+#if defined(__AVX2__)
+    // Even/odd lanes of two vectors, then restore frame order across the 128-bit halves
+    for (; i + 8uz <= count; i += 8uz) {
+        auto const a = _mm256_loadu_ps(in.data() + i * 2uz);
+        auto const b = _mm256_loadu_ps(in.data() + i * 2uz + 8uz);
+        auto const even = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        auto const odd = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm256_storeu_ps(left.data() + i,
+                         _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even), _MM_SHUFFLE(3, 1, 2, 0))));
+        _mm256_storeu_ps(right.data() + i,
+                         _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(odd), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4uz <= count; i += 4uz) {
+        auto const frames = vld2q_f32(in.data() + i * 2uz);
+        vst1q_f32(left.data() + i, frames.val[0]);
+        vst1q_f32(right.data() + i, frames.val[1]);
+    }
+#endif
+
+    for (; i < count; ++i) {
+        left[i] = in[i * 2uz];
+        right[i] = in[i * 2uz + 1uz];
+    }
+}
+
+// out[2i] = left[i], out[2i + 1] = right[i] over left.size() frames (stereo interleave)
+inline void interleave(std::span<float> out, std::span<float const> left, std::span<float const> right) {
+    auto const count = left.size();
+    auto i = 0uz;
+
+#if defined(__AVX__)
+    for (; i + 8uz <= count; i += 8uz) {
+        auto const l = _mm256_loadu_ps(left.data() + i);
+        auto const r = _mm256_loadu_ps(right.data() + i);
+        auto const low = _mm256_unpacklo_ps(l, r);   // frames 0, 1 | 4, 5
+        auto const high = _mm256_unpackhi_ps(l, r);  // frames 2, 3 | 6, 7
+        _mm256_storeu_ps(out.data() + i * 2uz, _mm256_permute2f128_ps(low, high, 0x20));
+        _mm256_storeu_ps(out.data() + i * 2uz + 8uz, _mm256_permute2f128_ps(low, high, 0x31));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4uz <= count; i += 4uz)
+        vst2q_f32(out.data() + i * 2uz, float32x4x2_t{{vld1q_f32(left.data() + i), vld1q_f32(right.data() + i)}});
+#endif
+
+    for (; i < count; ++i) {
+        out[i * 2uz] = left[i];
+        out[i * 2uz + 1uz] = right[i];
+    }
+}
+
+// IEEE half-precision bits of a float, rounded to nearest even
+// Out-of-range values become infinity and tiny ones flush through subnormals to zero
+constexpr std::uint16_t float_to_half(float value) {
+    auto const bits = std::bit_cast<std::uint32_t>(value);
+    auto const sign = (bits >> 16u) & 0x8000u;
+    auto const exponent = static_cast<int>((bits >> 23u) & 0xffu);
+    auto mantissa = bits & 0x7fffffu;
+
+    // Infinity and NaN (NaNs stay quiet)
+    if (exponent == 0xff)
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (mantissa != 0u ? 0x200u : 0u));
+
+    auto const half_exponent = exponent - 127 + 15;
+    if (half_exponent >= 0x1f)
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+
+    // Subnormal half: shift the mantissa, implicit bit included, into 2^-24 units
+    if (half_exponent <= 0) {
+        if (half_exponent < -10)
+            return static_cast<std::uint16_t>(sign);
+
+        mantissa |= 0x800000u;
+        auto const shift = static_cast<unsigned>(14 - half_exponent);
+        auto half_mantissa = mantissa >> shift;
+        auto const remainder = mantissa & ((1u << shift) - 1u);
+        auto const halfway = 1u << (shift - 1u);
+        if (remainder > halfway or (remainder == halfway and (half_mantissa & 1u) != 0u))
+            ++half_mantissa;
+        return static_cast<std::uint16_t>(sign | half_mantissa);
+    }
+
+    // A rounding carry out of the mantissa correctly bumps the exponent (up to infinity)
+    auto half = (static_cast<std::uint32_t>(half_exponent) << 10u) | (mantissa >> 13u);
+    auto const remainder = mantissa & 0x1fffu;
+    if (remainder > 0x1000u or (remainder == 0x1000u and (half & 1u) != 0u))
+        ++half;
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+// Float value of IEEE half-precision bits (exact)
+constexpr float half_to_float(std::uint16_t half) {
+    auto const sign = static_cast<std::uint32_t>(half & 0x8000u) << 16u;
+    auto const exponent = static_cast<std::uint32_t>(half >> 10u) & 0x1fu;
+    auto const mantissa = static_cast<std::uint32_t>(half & 0x3ffu);
+
+    if (exponent == 0x1fu)
+        return std::bit_cast<float>(sign | 0x7f800000u | (mantissa << 13u));
+
+    if (exponent == 0u) {
+        auto const magnitude = static_cast<float>(mantissa) / 16777216.0f;  // mantissa * 2^-24
+        return sign != 0u ? -magnitude : magnitude;
+    }
+
+    return std::bit_cast<float>(sign | ((exponent + 112u) << 23u) | (mantissa << 13u));
+}
+
+// Compile-time tests
+static_assert(float_to_half(1.0f) == 0x3c00u);
+static_assert(float_to_half(-2.0f) == 0xc000u);
+static_assert(float_to_half(65504.0f) == 0x7bffu);
+static_assert(float_to_half(65520.0f) == 0x7c00u);  // Rounds up to infinity
+static_assert(float_to_half(0.1f) == 0x2e66u);
+static_assert(float_to_half(0x1p-24f) == 0x0001u);
+static_assert(float_to_half(0x1p-26f) == 0x0000u);
+static_assert(half_to_float(0x3555u) == 0x1.554p-2f);
+static_assert(half_to_float(0x8001u) == -0x1p-24f);
+static_assert(half_to_float(float_to_half(-0.75f)) == -0.75f);
+
+// out[i] = half(in[i]) over out.size() elements (F16C or NEON conversion when available)
+inline void to_half(std::span<std::uint16_t> out, std::span<float const> in) {
+    auto const count = out.size();
+    auto i = 0uz;
+
+#if defined(__F16C__)
+    for (; i + 8uz <= count; i += 8uz)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out.data() + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(in.data() + i), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(__ARM_NEON)
+    for (; i + 4uz <= count; i += 4uz)
+        vst1_u16(out.data() + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in.data() + i))));
+#endif
+
+    for (; i < count; ++i)
+        out[i] = float_to_half(in[i]);
+}
+
+// out[i] = float(in[i]) over out.size() elements
+inline void from_half(std::span<float> out, std::span<std::uint16_t const> in) {
+    auto const count = out.size();
+    auto i = 0uz;
+
+#if defined(__F16C__)
+    for (; i + 8uz <= count; i += 8uz)
+        _mm256_storeu_ps(out.data() + i,
+                         _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in.data() + i))));
+#elif defined(__ARM_NEON)
+    for (; i + 4uz <= count; i += 4uz)
+        vst1q_f32(out.data() + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in.data() + i))));
+#endif
+
+    for (; i < count; ++i)
+        out[i] = half_to_float(in[i]);
+}
+
+} // namespace stems::simd
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "aligned_buffer.h"
+#include <cstddef>
+#include <span>
+
+namespace stems {
+
+// Read-only view of planar, stem-major audio: [stems][channels][samples]
+// Used for model output so stems are read in place without copying
+// The channel stride may exceed num_samples when viewing a sub-range
+class StemAudioView {
+public:
+    StemAudioView(float const* data, std::size_t num_stems, std::size_t num_channels, std::size_t num_samples)
+        : StemAudioView(data, num_stems, num_channels, num_samples, num_samples) {}
+
+    StemAudioView(float const* data, std::size_t num_stems, std::size_t num_channels,
+                  std::size_t num_samples, std::size_t channel_stride)
+        : data_(data), num_stems_(num_stems), num_channels_(num_channels),
+          num_samples_(num_samples), channel_stride_(channel_stride) {}
+
+    // Samples for one stem and channel
+    std::span<float const> channel(std::size_t stem, std::size_t channel) const {
+        return {data_ + (stem * num_channels_ + channel) * channel_stride_, num_samples_};
+    }
+
+    // Sub-range of samples in every stem and channel
+    StemAudioView samples(std::size_t offset, std::size_t count) const {
+        return {data_ + offset, num_stems_, num_channels_, count, channel_stride_};
+    }
+
+    std::size_t num_stems() const { return num_stems_; }
+    std::size_t num_channels() const { return num_channels_; }
+    std::size_t num_samples() const { return num_samples_; }
+
+private:
+    float const* data_;
+    std::size_t num_stems_;
+    std::size_t num_channels_;
+    std::size_t num_samples_;
+    std::size_t channel_stride_;
+};
+
+// Separated time-domain audio for every stem in one contiguous allocation
+// Layout is planar and stem-major: [stems][channels][samples]
+class StemAudio {
+public:
+    StemAudio() = default;
+
+    // Zero-filled buffer of the given dimensions
+    StemAudio(std::size_t num_stems, std::size_t num_channels, std::size_t num_samples)
+        : data_(num_stems * num_channels * num_samples),
+          num_stems_(num_stems), num_channels_(num_channels), num_samples_(num_samples) {}
+
+    // Samples for one stem and channel
+    std::span<float> channel(std::size_t stem, std::size_t channel) {
+        return data_.span().subspan((stem * num_channels_ + channel) * num_samples_, num_samples_);
+    }
+
+    std::span<float const> channel(std::size_t stem, std::size_t channel) const {
+        return data_.span().subspan((stem * num_channels_ + channel) * num_samples_, num_samples_);
+    }
+
+    StemAudioView view() const {
+        return {data_.data(), num_stems_, num_channels_, num_samples_};
+    }
+
+    std::size_t num_stems() const { return num_stems_; }
+    std::size_t num_channels() const { return num_channels_; }
+    std::size_t num_samples() const { return num_samples_; }
+    bool empty() const { return data_.empty(); }
+
+private:
+    AlignedBuffer<float> data_;
+    std::size_t num_stems_ = 0uz;
+    std::size_t num_channels_ = 0uz;
+    std::size_t num_samples_ = 0uz;
+};
+
+} // namespace stems
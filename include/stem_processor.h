@@ -1,8 +1,24 @@
 #pragma once
 
+#include "audio_reader.h"
+#include "blend.h"
+#include "constants.h"
+#include "instrumentation.h"
 #include "onnx_model.h"
+#include "result_cache.h"
+#include "stem_audio.h"
+#include "stem_selection.h"
 #include "stft.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <expected>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
 #include <vector>
 
 namespace stems {
@@ -12,7 +28,12 @@ enum class ProcessingError {
     StftFailed,
     InferenceFailed,
     InvalidAudio,
-    OutputGenerationFailed
+    OutputGenerationFailed,
+    InvalidChunking,
+    InvalidStemSelection,
+    InvalidShifts,
+    InvalidEnsemble,
+    CorruptedFile
 };
 
 // Convert ProcessingError to human-readable string
@@ -26,6 +47,16 @@ constexpr std::string_view error_message(ProcessingError error) {
             return "Invalid audio format or data";
         case ProcessingError::OutputGenerationFailed:
             return "Failed to generate output stems";
+        case ProcessingError::InvalidChunking:
+            return "Chunk size or overlap not supported by the model";
+        case ProcessingError::InvalidStemSelection:
+            return "Requested stems not produced by the model";
+        case ProcessingError::InvalidShifts:
+            return "Shift count not supported by the model or chunking";
+        case ProcessingError::InvalidEnsemble:
+            return "Ensemble models or weights don't fit together";
+        case ProcessingError::CorruptedFile:
+            return "Audio file is corrupted or truncated";
     }
     return "Unknown error";
 }
@@ -34,47 +65,412 @@ constexpr std::string_view error_message(ProcessingError error) {
 static_assert(error_message(ProcessingError::StftFailed) == "STFT processing failed");
 static_assert(error_message(ProcessingError::InferenceFailed) == "ONNX inference failed");
 static_assert(!error_message(ProcessingError::OutputGenerationFailed).empty());
+static_assert(!error_message(ProcessingError::InvalidChunking).empty());
+static_assert(!error_message(ProcessingError::InvalidStemSelection).empty());
+static_assert(!error_message(ProcessingError::InvalidShifts).empty());
+static_assert(!error_message(ProcessingError::InvalidEnsemble).empty());
+static_assert(!error_message(ProcessingError::CorruptedFile).empty());
 
-// Separated audio stems (supports both 4 and 6 stem models)
-struct SeparatedStems {
-    std::vector<float> drums;
-    std::vector<float> bass;
-    std::vector<float> other;
-    std::vector<float> vocals;
-    std::vector<float> guitar;  // Only used for 6-stem model
-    std::vector<float> piano;   // Only used for 6-stem model
-
-    // Get stem by index (0=drums, 1=bass, 2=other, 3=vocals, 4=guitar, 5=piano)
-    std::vector<float>* get_stem(std::size_t index) {
-        switch (index) {
-            case 0: return &drums;
-            case 1: return &bass;
-            case 2: return &other;
-            case 3: return &vocals;
-            case 4: return &guitar;
-            case 5: return &piano;
-            default: return nullptr;
+// How the track is cut into model-sized segments
+struct Chunking {
+    std::size_t size;     // Samples per model input
+    std::size_t overlap;  // Samples shared with each neighbour, cross-faded
+
+    constexpr std::size_t step() const { return size - overlap; }
+
+    // Chunks covering a track of the given length
+    constexpr std::size_t num_chunks(std::size_t num_samples) const {
+        return (num_samples + step() - 1uz) / step();
+    }
+};
+
+// Shortest chunk accepted: one full STFT window
+constexpr auto min_chunk_size = stft_params::window_size;
+
+// Resolve requested chunking against the model's time axis
+// A fixed-shape model only accepts its export length; dynamic models default to
+// the htdemucs training segment. Overlap defaults to 5% and may be at most half the
+// chunk, so a chunk's fade-in and fade-out never meet
+constexpr std::expected<Chunking, ProcessingError> resolve_chunking(
+    std::optional<std::size_t> model_chunk_size,
+    std::optional<std::size_t> chunk_size,
+    std::optional<std::size_t> overlap
+) {
+    auto const size = chunk_size.value_or(model_chunk_size.value_or(separation::model_chunk_size));
+    if (model_chunk_size and size != *model_chunk_size)
+        return std::unexpected(ProcessingError::InvalidChunking);
+
+    if (size < min_chunk_size)
+        return std::unexpected(ProcessingError::InvalidChunking);
+
+    auto const shared = overlap.value_or(size / 20uz);
+    if (shared > size / 2uz)
+        return std::unexpected(ProcessingError::InvalidChunking);
+
+    return Chunking{.size = size, .overlap = shared};
+}
+
+// Compile-time tests
+static_assert(resolve_chunking(std::nullopt, std::nullopt, std::nullopt)->size == separation::model_chunk_size);
+static_assert(resolve_chunking(std::nullopt, std::nullopt, std::nullopt)->overlap == separation::chunk_overlap);
+static_assert(resolve_chunking(343980uz, std::nullopt, 0uz)->step() == 343980uz);
+static_assert(resolve_chunking(std::nullopt, 441000uz, 44100uz)->step() == 396900uz);
+static_assert(!resolve_chunking(343980uz, 441000uz, std::nullopt).has_value());
+static_assert(!resolve_chunking(std::nullopt, 1024uz, std::nullopt).has_value());
+static_assert(!resolve_chunking(std::nullopt, 8192uz, 4097uz).has_value());
+static_assert(Chunking{.size = 10uz, .overlap = 2uz}.num_chunks(17uz) == 3uz);
+
+// Delay of shifted copy `copy` of `shifts`: whole STFT hops spread evenly below
+// `max_delay`, so each copy's spectrogram is mostly the undelayed one moved along
+// Copy 0 is the undelayed input
+constexpr std::size_t shift_delay(std::size_t copy, std::size_t shifts, std::size_t max_delay) {
+    return copy * (max_delay / stft_params::hop_size) / shifts * stft_params::hop_size;
+}
+
+// Most shifts with distinct delays below `max_delay`
+constexpr std::size_t max_shifts(std::size_t max_delay) {
+    return std::max(1uz, max_delay / stft_params::hop_size);
+}
+
+// Compile-time tests
+static_assert(shift_delay(0uz, 4uz, separation::max_shift) == 0uz);
+static_assert(shift_delay(1uz, 2uz, separation::max_shift) == 10uz * stft_params::hop_size);
+static_assert(shift_delay(3uz, 4uz, separation::max_shift) == 15uz * stft_params::hop_size);
+static_assert(shift_delay(2uz, 3uz, separation::chunk_overlap) == 10uz * stft_params::hop_size);
+static_assert(max_shifts(separation::chunk_overlap) == 16uz);
+static_assert(max_shifts(0uz) == 1uz);
+
+// An ensemble's weights, [members][stems] with each stem's summing to 1 where any
+// member has weight for it (0 where none does). Members without weights count 1 for
+// every stem of the model; nullopt if a member weights a stem the model doesn't separate
+constexpr std::optional<std::vector<float>> ensemble_weights(
+    std::span<std::optional<StemWeights> const> members,
+    std::size_t num_stems
+) {
+    auto weights = std::vector<float>{};
+    auto totals = StemWeights{};
+    for (auto const& member : members)
+        for (auto stem = 0uz; stem < totals.size(); ++stem) {
+            auto const weight = member ? (*member)[stem] : (stem < num_stems ? 1.0f : 0.0f);
+            if (stem >= num_stems and weight > 0.0f)
+                return std::nullopt;
+            if (stem < num_stems) {
+                weights.push_back(weight);
+                totals[stem] += weight;
+            }
         }
+
+    for (auto i = 0uz; i < weights.size(); ++i)
+        if (totals[i % num_stems] > 0.0f)
+            weights[i] /= totals[i % num_stems];
+    return weights;
+}
+
+// Compile-time tests
+static_assert(ensemble_weights(std::array<std::optional<StemWeights>, 2>{}, 4uz)->size() == 8uz);
+static_assert(ensemble_weights(std::array<std::optional<StemWeights>, 2>{}, 4uz)->at(3) == 0.5f);
+static_assert(ensemble_weights(std::array<std::optional<StemWeights>, 2>{}, 4uz)->at(7) == 0.5f);
+static_assert(ensemble_weights(std::array{std::optional<StemWeights>{}, parse_stem_weights("vocals")}, 4uz)->at(0) == 1.0f);
+static_assert(ensemble_weights(std::array{std::optional<StemWeights>{}, parse_stem_weights("vocals")}, 4uz)->at(7) == 0.5f);
+static_assert(ensemble_weights(std::array{parse_stem_weights("piano"), parse_stem_weights("piano")}, 6uz)->at(11) == 0.5f);
+static_assert(!ensemble_weights(std::array{std::optional<StemWeights>{}, parse_stem_weights("piano")}, 4uz));
+
+// Whether blending combines several copies of some stem, so needs a scratch plane:
+// more than one shift, or more than one ensemble member with weight for a stem
+// `weights` is [members][stems], empty for a single model
+constexpr bool combines_copies(std::size_t shifts, std::span<float const> weights, std::size_t num_stems) {
+    if (shifts > 1uz)
+        return true;
+    for (auto stem = 0uz; stem < num_stems; ++stem) {
+        auto weighted = 0uz;
+        for (auto i = stem; i < weights.size(); i += num_stems)
+            weighted += weights[i] > 0.0f ? 1uz : 0uz;
+        if (weighted > 1uz)
+            return true;
     }
+    return false;
+}
+
+// Compile-time tests
+static_assert(!combines_copies(1uz, {}, 4uz));
+static_assert(combines_copies(2uz, {}, 4uz));
+static_assert(combines_copies(1uz, std::array{0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f, 0.5f}, 4uz));  // Default weights
+static_assert(!combines_copies(1uz, std::array{1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f}, 4uz));  // Specialist
+
+// Separated audio stems (supports both 4 and 6 stem models)
+// Planar stereo per output: the selected stems in model order (drums, bass, other,
+// vocals [, guitar, piano]), then the instrumental if requested
+using SeparatedStems = StemAudio;
+
+// Receives fully blended output regions, in order, during streaming separation
+// Returning false aborts processing
+using StemSink = std::function<bool(StemAudioView)>;
+
+// Tunable processing parameters
+struct ProcessingOptions {
+    // Chunks stacked into each Session::Run (clamped to what the model accepts)
+    std::size_t batch_size = separation::default_batch_size;
+
+    // Samples per chunk and overlap between chunks (default: the model's export length, 5%)
+    // Longer chunks recompute fewer overlapping samples; shorter ones need less memory
+    // Anything but the export length needs a model with a dynamic time axis
+    std::optional<std::size_t> chunk_size{};
+    std::optional<std::size_t> chunk_overlap{};
+
+    // Helper threads for STFT, deinterleave and blending (default: dsp_threads_for the machine)
+    std::optional<std::size_t> dsp_threads{};
+
+    // Cross-fade between overlapping chunks
+    FadeShape fade = FadeShape::Triangular;
+
+    // Separations averaged per chunk, each of the input delayed by a different number
+    // of STFT hops up to the overlap (at most max_shift): Demucs' shift trick, which
+    // trades compute for SDR. The copies of a chunk run in the same Session::Run, so
+    // more than one needs a model with a dynamic batch axis
+    std::size_t shifts = 1uz;
+
+    // Outputs to blend and write (default: every stem the model produces)
+    std::optional<StemSelection> stems{};
+
+    // Directory of per-chunk model outputs keyed by their input (empty disables)
+    // Chunks separated before, in this or any earlier track, skip inference
+    std::filesystem::path result_cache_dir{};
+
+    // Peak level in dBFS below which a chunk skips inference (nullopt disables the gate)
+    std::optional<float> silence_threshold_db = separation::silence_threshold_db;
+
+    // Leave out the per-chunk progress lines (per-file summaries are still printed)
+    bool quiet = false;
+
+    // Collects per-stage spans when set; shared by copies of the options, so batch
+    // workers and the daemon's warm processors all record into one trace
+    std::shared_ptr<Trace> trace{};
 };
 
+// Chunk counts from the most recent separation
+struct SeparationStats {
+    std::size_t chunks = 0uz;
+    std::size_t silent_chunks = 0uz;  // Below the silence gate, not inferred
+    std::size_t cached_chunks = 0uz;  // Read from the result cache, not inferred
+};
+
+// Timing of an incremental separation
+struct LatencyStats {
+    std::size_t chunks = 0uz;
+    double window_seconds = 0.0;        // Input a chunk waits for: a sample is emitted at most this long after it arrives
+    double mean_compute_seconds = 0.0;  // Per chunk, from its last input sample to its output
+    double max_compute_seconds = 0.0;
+    double real_time_factor = 0.0;      // Compute seconds per second of audio; below 1 keeps up
+
+    // Longest delay from pushing a sample to its stems being emitted
+    double max_latency_seconds() const { return window_seconds + max_compute_seconds; }
+};
+
+// One model of an ensemble and its weight for each stem (nullopt: 1 for every stem)
+struct EnsembleMember {
+    OnnxModel model;
+    std::optional<StemWeights> weights{};
+};
+
+class IncrementalSeparation;
+
 // Main stem separation processor
 class StemProcessor {
 public:
-    explicit StemProcessor(OnnxModel);
+    // Fails with InvalidChunking if the model can't take the requested chunking,
+    // InvalidStemSelection if it doesn't produce a requested stem, InvalidShifts if
+    // its batch axis or the overlap can't hold the requested shifts
+    static std::expected<StemProcessor, ProcessingError> create(OnnxModel, ProcessingOptions = {});
+
+    // Ensemble of models taking the same inputs, e.g. a bag of per-stem specialists
+    // (htdemucs_ft) or htdemucs plus another vocal model. Each chunk's waveform and
+    // STFT inputs are prepared once and run through every member concurrently; each
+    // stem is the weighted mean of the members weighted for it
+    // Members without weight for any kept stem are dropped. The rest still compute all
+    // their stems, since a model's output is one tensor of every stem; a specialist's
+    // other stems are inferred and discarded.
+    // Exporting specialists with only their own stem is deferred: their outputs would
+    // then have to be mapped onto the primary's stems
+    // Also fails with InvalidEnsemble if the members differ in stems or chunk size, or
+    // a kept stem has no weight in any of them
+    static std::expected<StemProcessor, ProcessingError> create(std::vector<EnsembleMember>, ProcessingOptions = {});
 
-    // Separate stereo audio into 4 stems
+    // Separate stereo audio into stems
     // Input: interleaved stereo audio samples
-    // Output: 4 separated stems (each stereo)
+    // Output: the selected stems (by default all 4 or 6), each planar stereo
     std::expected<SeparatedStems, ProcessingError> process(
         std::vector<float> const&,
         int sample_rate,
         int channels
     );
 
+    // Separate a whole track into memory, decoding it chunk by chunk straight into
+    // the model input rather than loading and de-interleaving it first
+    std::expected<SeparatedStems, ProcessingError> process(AudioReader&);
+
+    // Streaming separation with memory bounded by the chunk size:
+    // reads chunk-sized windows and hands each region to the sink as soon as
+    // no later chunk can overlap it
+    std::expected<void, ProcessingError> process_stream(AudioReader&, StemSink const&);
+
+    // Separation of audio pushed as it arrives (see IncrementalSeparation), emitting
+    // finished output through the sink; chunks run one per inference call
+    std::expected<IncrementalSeparation, ProcessingError> start_incremental(int sample_rate, StemSink);
+
+    // Stems the model separates, before selection
+    std::size_t num_model_stems() const { return model_.num_stems(); }
+
+    // Outputs each separation produces, and their stem file names in output order
+    StemSelection const& selection() const { return selection_; }
+    std::vector<std::string_view> output_names() const;
+
+    Chunking const& chunking() const { return chunking_; }
+
+    // Delay of each shifted copy of a chunk, ascending from 0
+    std::span<std::size_t const> shift_delays() const { return shift_delays_; }
+
+    // Counts from the last process() or process_stream() call
+    SeparationStats const& last_stats() const { return stats_; }
+
+    // DSP thread pool, shared by copies of this processor
+    ThreadPool& thread_pool() const { return *pool_; }
+
 private:
-    OnnxModel model_;
+    friend class IncrementalSeparation;
+
+    StemProcessor(
+        std::vector<OnnxModel>,
+        std::vector<float> weights,
+        ProcessingOptions,
+        Chunking,
+        StemSelection,
+        std::shared_ptr<ResultCache const>
+    );
+
+    // Largest batch every member accepts
+    std::size_t max_batch_size() const;
+
+    // Tensors of the members after the first, for batches of up to `capacity` entries
+    std::expected<std::vector<ModelTensors>, ModelError> allocate_member_tensors(std::size_t capacity) const;
+
+    // Run the first `batch_size` entries through every member concurrently: the first
+    // over `tensors`, each other over a copy of the inputs in its `member_tensors`
+    std::expected<void, ModelError> infer_members(
+        ModelTensors& tensors,
+        std::span<ModelTensors> member_tensors,
+        std::size_t batch_size
+    ) const;
+
+    // Outputs of one inferred chunk: every member's copies, member-major, primary first
+    void member_outputs(
+        ModelTensors const& tensors,
+        std::span<ModelTensors const> member_tensors,
+        std::size_t first_entry,
+        std::vector<StemAudioView>& copies
+    ) const;
+
+    // Scratch planes blending needs: the instrumental, and a stem combined over copies
+    StemAudio blend_scratch() const;
+
+    // Forward STFT of one channel of tensor entry `entry`
+    bool transform(ModelTensors&, std::size_t entry, std::size_t channel) const;
+
+    // Shifted copy `copy` of the chunk in entry `base`: its delayed channel written to
+    // entry base + copy and transformed, mostly by moving the base's frames along
+    bool transform_shifted(ModelTensors&, std::size_t base, std::size_t copy, std::size_t channel) const;
+
+    // Fills one chunk's left/right model input, called in chunk order by the prepare stage
+    using ChunkSource = std::function<std::expected<void, ProcessingError>(
+        std::size_t chunk_idx, std::span<float> left, std::span<float> right)>;
+
+    // Source reading consecutive chunks from the reader; the `overlap` input samples
+    // consecutive chunks share are carried over rather than re-read
+    // Fails with CorruptedFile if the file ends before the frame count in its header
+    ChunkSource read_chunks(AudioReader&) const;
+
+    // Consumes one separated chunk, as the output of each of its shifted copies (one
+    // for silent and cached chunks), and the input mix it was separated from; called
+    // in chunk order by the blend stage
+    using ChunkSink = std::function<bool(std::size_t chunk_idx, std::span<StemAudioView const> copies, StemAudioView mix)>;
+
+    // Prepare / infer / blend pipeline shared by in-memory and streaming processing
+    std::expected<void, ProcessingError> run_pipeline(
+        std::size_t num_chunks,
+        ChunkSource const&,
+        ChunkSink const&
+    );
+
+    OnnxModel model_;                     // The ensemble's first member, which sets the shapes
+    std::vector<OnnxModel> members_;      // Every other member, in order
+    std::vector<float> weights_;          // [members][stems] normalised per stem, empty for one model
+    Chunking chunking_;
     StftProcessor stft_;
+    CrossFade cross_fade_;
+    ProcessingOptions options_;
+    StemSelection selection_;
+    std::shared_ptr<ResultCache const> result_cache_;  // Shared by copies, null when disabled
+    std::vector<std::size_t> shift_delays_;
+    std::shared_ptr<ThreadPool> pool_;
+    std::shared_ptr<ThreadPool> member_pool_;  // A thread per member after the first, null for one model
+    SeparationStats stats_{};
+};
+
+// Near-real-time separation for live monitoring: audio is pushed in blocks of any
+// size, and each chunk is separated as soon as its input is complete. The first
+// `step` samples of its output can no longer change (the next chunk starts there),
+// so they are emitted straight away and only the overlap waits for the next chunk.
+// Latency is one chunk of input plus the time to separate it, so a short chunk on a
+// model with a dynamic time axis keeps it to a few seconds
+// Chunks run one at a time on the pushing thread, unpipelined, since queueing batches
+// would only add latency. The processor must outlive the separation and not run
+// another separation meanwhile
+class IncrementalSeparation {
+public:
+    // Append interleaved stereo samples, separating every chunk they complete
+    std::expected<void, ProcessingError> push(std::span<float const> interleaved);
+
+    // Append planar stereo samples
+    std::expected<void, ProcessingError> push(std::span<float const> left, std::span<float const> right);
+
+    // End of input: separate the partly filled last chunk and emit the rest of the output
+    std::expected<void, ProcessingError> finish();
+
+    // Latency and real-time factor of the chunks separated so far
+    LatencyStats latency() const;
+
+private:
+    friend class StemProcessor;
+
+    using Clock = std::chrono::steady_clock;
+
+    IncrementalSeparation(StemProcessor&, ModelTensors, std::vector<ModelTensors> member_tensors, int sample_rate,
+                          StemSink);
+
+    // Account for `frames` samples just copied in at the fill position, separating the
+    // chunk once it is full
+    std::expected<void, ProcessingError> commit(std::size_t frames);
+
+    // Separate the chunk in the waveform entry and emit its finished samples
+    std::expected<void, ProcessingError> run_chunk(bool is_last);
+
+    StemProcessor* processor_;
+    ModelTensors tensors_;  // One entry per shift; waveform entry 0 accumulates the current chunk
+    std::vector<ModelTensors> member_tensors_;
+    int sample_rate_;
+    StemSink sink_;
+    StemAudio window_;   // Output covering the current chunk, as in process_stream
+    StemAudio scratch_;  // Blending scratch
+    std::vector<StemAudioView> copies_;  // Output of each member's shifted copies
+    std::vector<float> silence_;  // Output of a gated chunk
+    float gate_;
+    std::size_t filled_ = 0uz;  // Input samples in the current chunk
+    std::size_t chunk_idx_ = 0uz;
+    std::size_t pushed_ = 0uz;
+    std::size_t emitted_ = 0uz;
+    std::size_t silent_chunks_ = 0uz;
+    bool finished_ = false;
+    Clock::duration total_compute_{};
+    Clock::duration max_compute_{};
 };
 
 } // namespace stems
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "constants.h"
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace stems {
+
+// Derived accompaniment output: the input mix minus the separated vocals
+constexpr std::string_view instrumental_name = "instrumental";
+
+// Which outputs a separation keeps, so unwanted stems are never blended or written
+// Outputs are the selected model stems in model order, then the instrumental
+struct StemSelection {
+    std::uint32_t stems = 0u;   // Bit per model stem index
+    bool instrumental = false;
+
+    // Every stem of a model, the default
+    static constexpr StemSelection all(std::size_t num_stems) {
+        return {.stems = (1u << num_stems) - 1u, .instrumental = false};
+    }
+
+    constexpr bool contains(std::size_t stem) const { return stem < 32uz and (stems >> stem & 1u) != 0u; }
+
+    constexpr std::size_t num_model_outputs() const { return static_cast<std::size_t>(std::popcount(stems)); }
+    constexpr std::size_t num_outputs() const { return num_model_outputs() + (instrumental ? 1uz : 0uz); }
+
+    // Model stem blended into model output `output` (< num_model_outputs)
+    constexpr std::size_t model_stem(std::size_t output) const {
+        auto remaining = stems;
+        for (auto i = 0uz; i < output; ++i)
+            remaining &= remaining - 1u;  // Clear the lowest selected stem
+        return static_cast<std::size_t>(std::countr_zero(remaining));
+    }
+
+    // File name suffix of an output
+    constexpr std::string_view output_name(std::size_t output, std::size_t num_stems) const {
+        return output < num_model_outputs() ? separation::stem_name(model_stem(output), num_stems)
+                                            : instrumental_name;
+    }
+
+    // Only stems the model produces, non-empty, and vocals available for the instrumental
+    constexpr bool valid_for(std::size_t num_stems) const {
+        return num_outputs() > 0uz and (stems >> num_stems) == 0u
+            and (!instrumental or separation::stem_index("vocals", num_stems) < num_stems);
+    }
+
+    constexpr bool operator==(StemSelection const&) const = default;
+};
+
+// Parse a comma-separated list such as "vocals,drums" or "instrumental"
+// Names are those of the 6-stem model (the 4-stem names are its first four); whether
+// the loaded model has them is checked by valid_for
+constexpr std::optional<StemSelection> parse_stem_selection(std::string_view list) {
+    auto selection = StemSelection{};
+    while (true) {
+        auto const comma = list.find(',');
+        auto const name = list.substr(0uz, comma);
+
+        if (name == instrumental_name) {
+            selection.instrumental = true;
+        } else {
+            auto const stem = separation::stem_index(name, separation::stem_names_6.size());
+            if (stem == separation::stem_names_6.size())
+                return std::nullopt;
+            selection.stems |= 1u << stem;
+        }
+
+        if (comma == std::string_view::npos)
+            return selection;
+        list.remove_prefix(comma + 1uz);
+    }
+}
+
+// Weight of each stem, indexed by the 6-stem names (a 4-stem model uses the first four)
+using StemWeights = std::array<float, separation::stem_names_6.size()>;
+
+// Non-negative decimal such as "1", "0.25" or ".5"
+constexpr std::optional<float> parse_weight(std::string_view text) {
+    auto value = 0.0f;
+    auto scale = 1.0f;
+    auto digits = 0uz;
+    auto fraction = false;
+    for (auto const c : text) {
+        if (c == '.' and !fraction) {
+            fraction = true;
+        } else if (c >= '0' and c <= '9') {
+            if (fraction) {
+                scale /= 10.0f;
+                value += static_cast<float>(c - '0') * scale;
+            } else {
+                value = value * 10.0f + static_cast<float>(c - '0');
+            }
+            ++digits;
+        } else {
+            return std::nullopt;
+        }
+    }
+    return digits > 0uz ? std::optional{value} : std::nullopt;
+}
+
+// Parse an ensemble member's comma-separated weights, e.g. "vocals" (a specialist:
+// 1 for vocals, 0 for every other stem) or "vocals=0.7,other=0.3"
+constexpr std::optional<StemWeights> parse_stem_weights(std::string_view list) {
+    auto weights = StemWeights{};
+    while (true) {
+        auto const comma = list.find(',');
+        auto const item = list.substr(0uz, comma);
+        auto const equals = item.find('=');
+
+        auto const stem = separation::stem_index(item.substr(0uz, equals), weights.size());
+        auto const weight = equals == std::string_view::npos ? std::optional{1.0f} : parse_weight(item.substr(equals + 1uz));
+        if (stem == weights.size() or !weight)
+            return std::nullopt;
+        weights[stem] = *weight;
+
+        if (comma == std::string_view::npos)
+            return weights;
+        list.remove_prefix(comma + 1uz);
+    }
+}
+
+// Compile-time tests
+static_assert(StemSelection::all(4uz).num_outputs() == 4uz);
+static_assert(StemSelection::all(6uz).output_name(5uz, 6uz) == "piano");
+static_assert(parse_stem_selection("vocals")->num_outputs() == 1uz);
+static_assert(parse_stem_selection("vocals")->output_name(0uz, 4uz) == "vocals");
+static_assert(parse_stem_selection("vocals,drums")->model_stem(0uz) == 0uz);
+static_assert(parse_stem_selection("vocals,drums")->model_stem(1uz) == 3uz);
+static_assert(parse_stem_selection("vocals,instrumental")->output_name(1uz, 4uz) == "instrumental");
+static_assert(parse_stem_selection("instrumental")->num_model_outputs() == 0uz);
+static_assert(parse_stem_selection("drums,bass,other,vocals") == StemSelection::all(4uz));
+static_assert(parse_stem_selection("guitar")->valid_for(6uz));
+static_assert(!parse_stem_selection("guitar")->valid_for(4uz));
+static_assert(!parse_stem_selection("kazoo").has_value());
+static_assert(!parse_stem_selection("vocals,").has_value());
+static_assert(!StemSelection{}.valid_for(4uz));
+static_assert(parse_stem_selection("instrumental")->valid_for(4uz));
+static_assert(!parse_stem_selection("instrumental")->valid_for(2uz));
+static_assert(parse_weight("0.25") == 0.25f);
+static_assert(parse_weight("2") == 2.0f);
+static_assert(!parse_weight(".").has_value());
+static_assert(!parse_weight("1e3").has_value());
+static_assert((*parse_stem_weights("vocals"))[3] == 1.0f);
+static_assert((*parse_stem_weights("vocals"))[0] == 0.0f);
+static_assert((*parse_stem_weights("drums=0.5,piano"))[0] == 0.5f);
+static_assert((*parse_stem_weights("drums=0.5,piano"))[5] == 1.0f);
+static_assert(!parse_stem_weights("vocals=").has_value());
+static_assert(!parse_stem_weights("kazoo=1").has_value());
+
+} // namespace stems
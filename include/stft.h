@@ -2,8 +2,10 @@
 
 #include <fftw3.h>
 #include <expected>
+#include <filesystem>
 #include <memory>
 #include <span>
+#include <string>
 #include <vector>
 
 namespace stems {
@@ -44,6 +46,7 @@ namespace stft_params {
     constexpr auto fft_size = window_size;
     constexpr auto num_bins = fft_size / 2;   // Model expects 2048 bins (not 2049)
                                                // Demucs uses freqs = nfft // 2
+    constexpr auto fft_bins = fft_size / 2 + 1;  // Real FFT output including Nyquist
 
     // Verify parameters at compile time
     static_assert(window_size > 0);
@@ -51,10 +54,43 @@ namespace stft_params {
     static_assert(hop_size <= window_size);
     static_assert((window_size & (window_size - 1)) == 0, "Window size must be power of 2");
     static_assert(num_bins == 2048, "Model expects exactly 2048 frequency bins");
+    static_assert(fft_bins == num_bins + 1);
+
+    // Planning rigor for every transform; with wisdom from a PATIENT tuning run
+    // these plans are looked up rather than measured
+    constexpr auto planner_flags = FFTW_MEASURE;
 }
 
+// FFTW wisdom cache: loads accumulated plans from a file and writes them back on
+// destruction if planning added any, so measuring happens once per machine rather
+// than in every process and every processor instance
+// FFTW's planner is process-global and not thread-safe: create this on the main
+// thread before any StftProcessor
+class FftwWisdomFile {
+public:
+    explicit FftwWisdomFile(std::filesystem::path);
+    ~FftwWisdomFile();
+
+    // Non-copyable
+    FftwWisdomFile(FftwWisdomFile const&) = delete;
+    FftwWisdomFile& operator=(FftwWisdomFile const&) = delete;
+
+    // Whether existing wisdom was imported
+    bool loaded() const { return loaded_; }
+
+    // Write the current wisdom if it changed since it was loaded or last saved
+    bool save();
+
+    std::filesystem::path const& path() const { return path_; }
+
+private:
+    std::filesystem::path path_;
+    std::string saved_;  // Wisdom as last read or written
+    bool loaded_ = false;
+};
+
 // Complex spectrogram representation
-// Each frame contains real and imaginary components
+// Real and imaginary planes are bin-major [bins, frames], matching the model tensor
 struct Spectrogram {
     std::vector<float> real;  // Real components
     std::vector<float> imag;  // Imaginary components
@@ -83,32 +119,120 @@ private:
     fftwf_plan plan_;
 };
 
+// Frees memory from fftwf_alloc_*
+struct FftwFree {
+    void operator()(void* memory) const { fftwf_free(memory); }
+};
+
+using FftwRealBuffer = std::unique_ptr<float[], FftwFree>;
+using FftwComplexBuffer = std::unique_ptr<fftwf_complex[], FftwFree>;
+
 // Short-Time Fourier Transform processor
+// Plans and window tables are immutable after construction and shared by copies,
+// so copying a processor never re-plans. Every transform is const and thread-safe:
+// plans run through FFTW's new-array execute API on per-thread scratch buffers,
+// so left/right channels and separate chunks can be transformed concurrently
 class StftProcessor {
 public:
     StftProcessor();
-    ~StftProcessor();
+
+    // Also plan a batched transform over every frame of a `chunk_samples` signal
+    // (planning is not thread-safe, so it happens here rather than on first use)
+    // FFTW_PATIENT flags are for offline tuning runs that fill in wisdom
+    explicit StftProcessor(std::size_t chunk_samples, unsigned planner_flags = stft_params::planner_flags);
 
     // Forward transform: time domain -> frequency domain
-    std::expected<Spectrogram, StftError> forward(std::span<float const>);
+    std::expected<Spectrogram, StftError> forward(std::span<float const>) const;
+
+    // Forward transform into an existing spectrogram, reusing its storage
+    std::expected<void, StftError> forward(std::span<float const>, Spectrogram&) const;
+
+    // Forward transform straight into caller-owned [bins, frames] planes
+    // (e.g. the real/imaginary channels of the model's spectrogram tensor)
+    // Signals of the planned chunk length use one batched transform over every frame
+    std::expected<void, StftError> forward(
+        std::span<float const>,
+        std::span<float> real,
+        std::span<float> imag
+    ) const;
+
+    // Forward transform of `delayed`: a signal whose transform `base_real`/`base_imag`
+    // is known, delayed by `delay_frames` hops (zero-filled in front, cut to the same
+    // length). Frames clear of the cut end are the base frames moved along, so only
+    // the frames over the delay and the end are transformed
+    std::expected<void, StftError> forward_delayed(
+        std::span<float const> delayed,
+        std::size_t delay_frames,
+        std::span<float const> base_real,
+        std::span<float const> base_imag,
+        std::span<float> real,
+        std::span<float> imag
+    ) const;
+
+    // Forward transform of both channels on the calling thread, writing the model's
+    // complex-as-channels planes [4, bins, frames]: real_left, imag_left, real_right, imag_right
+    // Callers with threads to spare can instead run forward() per channel concurrently
+    std::expected<void, StftError> forward_stereo(
+        std::span<float const> left,
+        std::span<float const> right,
+        std::span<float> planes
+    ) const;
 
     // Inverse transform: frequency domain -> time domain
-    std::expected<std::vector<float>, StftError> inverse(Spectrogram const&);
+    std::expected<std::vector<float>, StftError> inverse(Spectrogram const&) const;
 
-private:
-    // Hann window for smooth transitions
-    std::vector<float> window_;
-
-    // Cached FFTW plan and buffers for forward transform
-    fftwf_plan forward_plan_ = nullptr;
-    float* fftw_input_ = nullptr;
-    fftwf_complex* fftw_output_ = nullptr;
+    // Frames produced for a signal of the given length (center padded)
+    static std::size_t num_frames(std::size_t signal_length);
 
-    // Pre-compute window coefficients
-    void compute_hann_window();
-
-    // Initialize FFTW resources
-    bool initialize_fftw();
+private:
+    struct Plans {
+        // Hann window for smooth transitions
+        std::vector<float> window;
+
+        // Synthesis window with the 1/N inverse FFT scale folded in
+        std::vector<float> synthesis_window;
+
+        // Squared-window overlap sums for inverse normalisation (constant for 4096/1024 Hann):
+        // interior samples see every overlapping frame and repeat with the hop period,
+        // the first and last window_size - hop_size samples see fewer frames
+        std::vector<float> window_sum_period;  // [hop_size]
+        std::vector<float> window_sum_head;    // [window_size - hop_size]
+        std::vector<float> window_sum_tail;    // [window_size - hop_size]
+
+        // Single-frame r2c and c2r plans
+        FftwPlan forward{nullptr};
+        FftwPlan inverse{nullptr};
+
+        // Batched chunk plan: windowed frames [frames, fft_size] of one channel transformed
+        // into split real/imaginary planes [fft_bins, frames] (the Nyquist row is dropped on copy-out)
+        FftwPlan chunk{nullptr};
+        std::size_t chunk_samples = 0uz;
+        std::size_t chunk_frames = 0uz;
+    };
+
+    // Pre-compute window coefficients and normalisation tables
+    static void compute_windows(Plans&);
+
+    // Initialize FFTW plans (planned on temporary buffers, executed on scratch)
+    static bool plan_transforms(Plans&, unsigned planner_flags);
+    static bool plan_chunk(Plans&, std::size_t chunk_samples, unsigned planner_flags);
+
+    // Transform one frame into column `frame_idx` of [bins, frames] planes
+    void forward_frame(
+        std::span<float const>,
+        std::size_t frame_idx,
+        std::span<float> real,
+        std::span<float> imag
+    ) const;
+
+    // Batched forward transform of a signal of the planned chunk length
+    std::expected<void, StftError> forward_chunk(
+        std::span<float const>,
+        std::span<float> real,
+        std::span<float> imag
+    ) const;
+
+    std::shared_ptr<Plans const> plans_;
 };
 
 } // namespace stems
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace stems {
+
+// Helper threads for the DSP stages (STFT, deinterleave, blend, interleave)
+// These run alongside Session::Run, which keeps the ONNX Runtime intra-op pool busy,
+// so DSP takes a quarter of the machine rather than competing for every core
+// The pool is shared by every job in the process, so it doesn't scale with jobs
+constexpr std::size_t dsp_threads_for(std::size_t hardware_threads) {
+    auto const parallelism = hardware_threads / 4uz;
+    return parallelism > 1uz ? parallelism - 1uz : 0uz;  // The caller is one of them
+}
+
+// Compile-time tests
+static_assert(dsp_threads_for(32uz) == 7uz);
+static_assert(dsp_threads_for(8uz) == 1uz);
+static_assert(dsp_threads_for(4uz) == 0uz);
+static_assert(dsp_threads_for(0uz) == 0uz);
+
+// Fixed set of worker threads for data-parallel loops
+// parallel_for may be called from several threads at once (e.g. batch jobs sharing
+// one pool); the caller always takes part, so a busy or empty pool never deadlocks
+class ThreadPool {
+public:
+    explicit ThreadPool(std::size_t num_threads);
+
+    // Non-copyable
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    // Threads that can run a loop body concurrently, including the caller
+    std::size_t concurrency() const { return workers_.size() + 1uz; }
+
+    // Run body(i) for every i in [0, count), returning once all have finished
+    // Indices are claimed dynamically so uneven bodies balance across threads
+    void parallel_for(std::size_t count, std::function<void(std::size_t)> const&);
+
+private:
+    void run_worker(std::stop_token);
+
+    std::mutex mutex_;
+    std::condition_variable_any wake_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::jthread> workers_;  // Last, so workers stop before the queue goes
+};
+
+} // namespace stems
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "mapped_file.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+
+namespace stems {
+
+// Sample encodings decoded straight from a mapped WAV data chunk
+enum class WavEncoding {
+    Pcm16,
+    Pcm24,
+    Pcm32,
+    Float32
+};
+
+constexpr std::string_view wav_encoding_name(WavEncoding encoding) {
+    switch (encoding) {
+        case WavEncoding::Pcm16:
+            return "pcm16";
+        case WavEncoding::Pcm24:
+            return "pcm24";
+        case WavEncoding::Pcm32:
+            return "pcm32";
+        case WavEncoding::Float32:
+            return "float";
+    }
+    return "unknown";
+}
+
+constexpr std::size_t bytes_per_sample(WavEncoding encoding) {
+    switch (encoding) {
+        case WavEncoding::Pcm16:
+            return 2uz;
+        case WavEncoding::Pcm24:
+            return 3uz;
+        case WavEncoding::Pcm32:
+        case WavEncoding::Float32:
+            return 4uz;
+    }
+    return 0uz;
+}
+
+// Compile-time tests
+static_assert(wav_encoding_name(WavEncoding::Pcm24) == "pcm24");
+static_assert(bytes_per_sample(WavEncoding::Pcm24) == 3uz);
+static_assert(bytes_per_sample(WavEncoding::Float32) == 4uz);
+
+// Little-endian unsigned integer of `width` bytes
+constexpr std::uint32_t read_le(std::byte const* bytes, std::size_t width) {
+    auto value = std::uint32_t{0};
+    for (auto i = 0uz; i < width; ++i)
+        value |= std::to_integer<std::uint32_t>(bytes[i]) << (8uz * i);
+    return value;
+}
+
+// Convert one little-endian sample to float, integers scaled to [-1, 1)
+// (the same scaling libsndfile applies when reading PCM as float)
+constexpr float decode_sample(WavEncoding encoding, std::byte const* bytes) {
+    switch (encoding) {
+        case WavEncoding::Pcm16:
+            return static_cast<float>(static_cast<std::int16_t>(read_le(bytes, 2uz))) / 32768.0f;
+        case WavEncoding::Pcm24:
+            // Shift into the top of an int32 so the sign bit lands in place
+            return static_cast<float>(static_cast<std::int32_t>(read_le(bytes, 3uz) << 8u)) / 2147483648.0f;
+        case WavEncoding::Pcm32:
+            return static_cast<float>(static_cast<std::int32_t>(read_le(bytes, 4uz))) / 2147483648.0f;
+        case WavEncoding::Float32:
+            return std::bit_cast<float>(read_le(bytes, 4uz));
+    }
+    return 0.0f;
+}
+
+// Compile-time tests
+static_assert(decode_sample(WavEncoding::Pcm16, std::array{std::byte{0x00}, std::byte{0x80}}.data()) == -1.0f);
+static_assert(decode_sample(WavEncoding::Pcm16, std::array{std::byte{0x00}, std::byte{0x40}}.data()) == 0.5f);
+static_assert(decode_sample(WavEncoding::Pcm24,
+                            std::array{std::byte{0x00}, std::byte{0x00}, std::byte{0xc0}}.data()) == -0.5f);
+static_assert(decode_sample(WavEncoding::Float32,
+                            std::array{std::byte{0x00}, std::byte{0x00}, std::byte{0x80}, std::byte{0x3f}}.data()) == 1.0f);
+
+// Where the samples of a RIFF/WAVE file live and how they are encoded
+struct WavLayout {
+    WavEncoding encoding;
+    int channels;
+    int sample_rate;
+    std::size_t data_offset;  // Byte offset of the first frame
+    std::size_t frames;
+
+    constexpr std::size_t frame_bytes() const {
+        return bytes_per_sample(encoding) * static_cast<std::size_t>(channels);
+    }
+};
+
+// Walk the RIFF chunks of a whole file for its `fmt ` and `data` chunks
+// nullopt for anything the mapped reader doesn't decode (RIFX/RF64, 8-bit or
+// 64-bit samples, compressed encodings), which is left to libsndfile
+constexpr std::optional<WavLayout> parse_wav_header(std::span<std::byte const> file) {
+    auto const tag = [&](std::size_t offset, std::string_view expected) {
+        for (auto i = 0uz; i < expected.size(); ++i)
+            if (file[offset + i] != static_cast<std::byte>(expected[i]))
+                return false;
+        return true;
+    };
+
+    if (file.size() < 12uz or !tag(0uz, "RIFF") or !tag(8uz, "WAVE"))
+        return std::nullopt;
+
+    auto layout = std::optional<WavLayout>{};
+    auto block_align = 0uz;
+
+    // Chunks are `id size payload`, payloads padded to an even length
+    for (auto offset = 12uz; offset + 8uz <= file.size();) {
+        auto const size = static_cast<std::size_t>(read_le(file.data() + offset + 4uz, 4uz));
+        auto const payload = offset + 8uz;
+
+        if (tag(offset, "fmt ")) {
+            if (size < 16uz or payload + size > file.size())
+                return std::nullopt;
+
+            auto format = read_le(file.data() + payload, 2uz);
+            auto const channels = read_le(file.data() + payload + 2uz, 2uz);
+            auto const sample_rate = read_le(file.data() + payload + 4uz, 4uz);
+            block_align = read_le(file.data() + payload + 12uz, 2uz);
+            auto const bits = read_le(file.data() + payload + 14uz, 2uz);
+
+            // WAVE_FORMAT_EXTENSIBLE carries the real format in its sub-format GUID
+            if (format == 0xfffeu) {
+                if (size < 40uz)
+                    return std::nullopt;
+                format = read_le(file.data() + payload + 24uz, 2uz);
+            }
+
+            auto encoding = std::optional<WavEncoding>{};
+            if (format == 1u and bits == 16u)
+                encoding = WavEncoding::Pcm16;
+            else if (format == 1u and bits == 24u)
+                encoding = WavEncoding::Pcm24;
+            else if (format == 1u and bits == 32u)
+                encoding = WavEncoding::Pcm32;
+            else if (format == 3u and bits == 32u)
+                encoding = WavEncoding::Float32;
+
+            if (!encoding or channels == 0u or sample_rate == 0u)
+                return std::nullopt;
+
+            layout = WavLayout{.encoding = *encoding,
+                               .channels = static_cast<int>(channels),
+                               .sample_rate = static_cast<int>(sample_rate),
+                               .data_offset = 0uz,
+                               .frames = 0uz};
+        } else if (tag(offset, "data")) {
+            if (!layout or block_align != layout->frame_bytes())
+                return std::nullopt;
+
+            // Writers that never patched the size (streamed output) leave it too large
+            auto const available = file.size() - payload;
+            layout->data_offset = payload;
+            layout->frames = std::min(size, available) / block_align;
+            return layout;
+        }
+
+        offset = payload + size + (size & 1uz);
+    }
+
+    return std::nullopt;
+}
+
+// Memory-mapped WAV file decoded without an intermediate copy
+// The header is parsed once at open; read() converts and de-interleaves frames
+// from the mapping straight into the caller's planar buffers. Reads are const
+// and thread-safe, so separate ranges can be decoded concurrently
+class WavFile {
+public:
+    // Map a file whose encoding parse_wav_header accepts, nullopt otherwise
+    static std::optional<WavFile> open(std::filesystem::path const&);
+
+    WavLayout const& layout() const { return layout_; }
+    std::size_t frames() const { return layout_.frames; }
+
+    // Interleaved sample bytes of the data chunk
+    std::span<std::byte const> samples() const {
+        return file_.bytes().subspan(layout_.data_offset, layout_.frames * layout_.frame_bytes());
+    }
+
+    // Decode up to left.size() frames of a stereo layout starting at `frame`
+    // Returns frames decoded, 0 past the end
+    std::size_t read(std::size_t frame, std::span<float> left, std::span<float> right) const;
+
+private:
+    WavFile(MappedFile, WavLayout);
+
+    MappedFile file_;
+    WavLayout layout_;
+};
+
+} // namespace stems
@@ -2,6 +2,8 @@
 """
 Modified Demucs to ONNX converter with dynamic input shapes.
 Based on sevagh/demucs.onnx conversion script but adds dynamic_axes support.
+The batch axis is dynamic too, so several chunks can share one inference run.
+FP16 (GPU) and dynamically quantised INT8 (CPU) variants can be derived from the FP32 export.
 """
 
 import sys
@@ -15,7 +17,57 @@ sys.path.insert(0, str(Path(__file__).parent.parent / "vendor" / "demucs"))
 from demucs.pretrained import get_model
 from demucs.htdemucs import HTDemucs, standalone_spec, standalone_magnitude
 
-def convert_demucs_with_dynamic_shapes(output_dir: Path, model_name: str = "htdemucs"):
+class WaveformOnly(torch.nn.Module):
+    """Expose only the time-domain output so the exporter can drop the spectrogram head."""
+
+    def __init__(self, model):
+        super().__init__()
+        self.model = model
+
+    def forward(self, waveform, magspec):
+        _, waveform_out = self.model(waveform, magspec)
+        return waveform_out
+
+
+PRECISIONS = ['fp32', 'fp16', 'int8']
+
+
+def record_precision(model, precision: str):
+    """Store the weight precision in the model metadata, where stems reads it at load time."""
+    import onnx
+
+    onnx.helper.set_model_props(model, {'precision': precision})
+
+
+def derive_precision(fp32_file: Path, precision: str) -> Path:
+    """Write an FP16 or INT8 variant of an FP32 export next to it."""
+    import onnx
+
+    output_file = fp32_file.with_name(f"{fp32_file.stem}_{precision}.onnx")
+    print(f"Deriving {precision} model...")
+
+    if precision == 'fp16':
+        # Half-precision I/O too, so host/device copies move half the bytes;
+        # stems converts at the tensor boundary
+        from onnxconverter_common import float16
+
+        model = float16.convert_float_to_float16(onnx.load(fp32_file), keep_io_types=False)
+    else:
+        # Weights quantised offline, activations per run; I/O stays float
+        from onnxruntime.quantization import QuantType, quantize_dynamic
+
+        quantize_dynamic(fp32_file, output_file, weight_type=QuantType.QInt8)
+        model = onnx.load(output_file)
+
+    record_precision(model, precision)
+    onnx.save(model, output_file)
+    print(f"✓ {precision} model written to {output_file}")
+    print(f"  File size: {output_file.stat().st_size / 1024 / 1024:.1f} MB")
+    return output_file
+
+
+def convert_demucs_with_dynamic_shapes(output_dir: Path, model_name: str = "htdemucs",
+                                       waveform_only: bool = False, precision: str = 'fp32'):
     """Convert Demucs model to ONNX with dynamic input dimensions."""
 
     output_dir.mkdir(parents=True, exist_ok=True)
@@ -48,30 +100,40 @@ def convert_demucs_with_dynamic_shapes(output_dir: Path, model_name: str = "htde
 
     dummy_input = (dummy_waveform, magspec)
 
+    # Only the waveform output is read by stems, so the spectrogram output
+    # (and any nodes feeding nothing else) can be pruned from the graph
+    export_model = WaveformOnly(core_model) if waveform_only else core_model
+    output_names = ['add_67'] if waveform_only else ['output', 'add_67']
+    dynamic_axes = {
+        'input': {0: 'batch', 2: 'time'},       # Batch and time dimensions are dynamic
+        'x': {0: 'batch', 3: 'time_freq'},      # Frequency time dimension is dynamic
+        'output': {0: 'batch', 4: 'time_freq'}, # Output time dimension
+        'add_67': {0: 'batch', 3: 'time'}       # Output waveform time dimension
+    }
+    dynamic_axes = {name: axes for name, axes in dynamic_axes.items()
+                    if name in ['input', 'x'] + output_names}
+
     # Define output path
-    onnx_file = output_dir / f"{model_name}.onnx"
+    suffix = "_waveform" if waveform_only else ""
+    onnx_file = output_dir / f"{model_name}{suffix}.onnx"
 
     print(f"Exporting to ONNX with dynamic shapes...")
     print(f"  Waveform shape: {dummy_waveform.shape}")
     print(f"  Spectrogram shape: {magspec.shape}")
+    print(f"  Outputs: {', '.join(output_names)}")
 
     # Export with dynamic axes for variable-length audio
     try:
         torch.onnx.export(
-            core_model,
+            export_model,
             dummy_input,
             onnx_file,
             export_params=True,
             opset_version=17,
             do_constant_folding=True,
             input_names=['input', 'x'],
-            output_names=['output', 'add_67'],
-            dynamic_axes={
-                'input': {2: 'time'},       # Time dimension is dynamic
-                'x': {3: 'time_freq'},      # Frequency time dimension is dynamic
-                'output': {4: 'time_freq'}, # Output time dimension
-                'add_67': {3: 'time'}       # Output waveform time dimension
-            }
+            output_names=output_names,
+            dynamic_axes=dynamic_axes
         )
         print(f"✓ Model successfully exported to {onnx_file}")
         print(f"  File size: {onnx_file.stat().st_size / 1024 / 1024:.1f} MB")
@@ -81,6 +143,9 @@ def convert_demucs_with_dynamic_shapes(output_dir: Path, model_name: str = "htde
         if data_file.exists():
             print(f"  External data: {data_file.stat().st_size / 1024 / 1024:.1f} MB")
 
+        if precision != 'fp32':
+            derive_precision(onnx_file, precision)
+
         return True
     except Exception as e:
         print(f"✗ Error during ONNX export: {e}")
@@ -105,8 +170,22 @@ if __name__ == '__main__':
         default='htdemucs',
         help='model name (default: htdemucs)'
     )
+    parser.add_argument(
+        '--waveform-only',
+        action='store_true',
+        help='export only the time-domain output (drops the unused spectrogram output)'
+    )
+
+    parser.add_argument(
+        '--precision',
+        choices=PRECISIONS,
+        default='fp32',
+        help='also write an fp16 (GPU) or dynamically quantised int8 (CPU) variant '
+             '(needs onnxconverter-common or onnxruntime respectively)'
+    )
 
     args = parser.parse_args()
 
-    success = convert_demucs_with_dynamic_shapes(args.dest_dir, args.model)
+    success = convert_demucs_with_dynamic_shapes(args.dest_dir, args.model, args.waveform_only,
+                                                 args.precision)
     sys.exit(0 if success else 1)
@@ -0,0 +1,98 @@
+#include "audio_reader.h"
+#include <algorithm>
+
+namespace stems {
+
+namespace {
+
+// Frames decoded per sf_readf_float call
+constexpr auto read_block_frames = 16384uz;
+
+} // anonymous namespace
+
+AudioReader::AudioReader(std::unique_ptr<SNDFILE, FileCloser> file, AudioInfo info)
+    : file_(std::move(file)),
+      info_(std::move(info)),
+      block_(read_block_frames * static_cast<std::size_t>(info_.channels)) {}
+
+AudioReader::AudioReader(WavFile wav, AudioInfo info) : wav_(std::move(wav)), info_(std::move(info)) {}
+
+std::expected<AudioReader, ValidationError> AudioReader::open(std::string_view path) {
+    // Only stereo is supported for now (mono/multichannel support is future work)
+    constexpr auto supported_channels = 2;
+
+    if (auto wav = WavFile::open(path)) {
+        auto const& layout = wav->layout();
+        if (layout.channels != supported_channels)
+            return std::unexpected(ValidationError::UnsupportedFormat);
+
+        auto info = AudioInfo{.sample_rate = layout.sample_rate,
+                              .channels = layout.channels,
+                              .frames = static_cast<long>(layout.frames),
+                              .format_name = "WAV"};
+        return AudioReader{std::move(*wav), std::move(info)};
+    }
+
+    auto sf_info = SF_INFO{};
+    auto file = std::unique_ptr<SNDFILE, FileCloser>{sf_open(path.data(), SFM_READ, &sf_info)};
+    if (!file)
+        return std::unexpected(ValidationError::FileNotFound);
+
+    // WAV only for now, matching validate_audio_file
+    if ((sf_info.format & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV or sf_info.channels != supported_channels)
+        return std::unexpected(ValidationError::UnsupportedFormat);
+
+    return AudioReader{
+        std::move(file),
+        AudioInfo{.sample_rate = sf_info.samplerate,
+                  .channels = sf_info.channels,
+                  .frames = sf_info.frames,
+                  .format_name = "WAV"}
+    };
+}
+
+std::expected<std::size_t, ValidationError> AudioReader::read(
+    std::span<float> left,
+    std::span<float> right
+) {
+    auto const requested = std::min(left.size(), right.size());
+
+    // Mapped files decode straight from the page cache into the caller's planes
+    if (wav_) {
+        auto const decoded = wav_->read(position_, left.first(requested), right.first(requested));
+        position_ += decoded;
+        return decoded;
+    }
+
+    auto frames_read = 0uz;
+
+    while (frames_read < requested) {
+        auto const block_frames = std::min(read_block_frames, requested - frames_read);
+        auto const decoded = sf_readf_float(file_.get(), block_.data(), static_cast<sf_count_t>(block_frames));
+        if (decoded < 0)
+            return std::unexpected(ValidationError::CorruptedFile);
+        if (decoded == 0)
+            break;
+
+        // De-interleave stereo block into separate left/right channels
+        auto const count = static_cast<std::size_t>(decoded);
+        for (auto i = 0uz; i < count; ++i) {
+            left[frames_read + i] = block_[i * 2uz];
+            right[frames_read + i] = block_[i * 2uz + 1uz];
+        }
+
+        frames_read += count;
+        if (count < block_frames)
+            break;
+    }
+
+    return frames_read;
+}
+
+std::optional<WavEncoding> AudioReader::mapped_encoding() const {
+    if (!wav_)
+        return std::nullopt;
+    return wav_->layout().encoding;
+}
+
+} // namespace stems
@@ -1,25 +1,43 @@
 #include "audio_writer.h"
-#include "constants.h"
-#include <sndfile.h>
+#include "simd.h"
+#include <algorithm>
+#include <atomic>
 #include <print>
 
 namespace stems {
 
 namespace {
 
-// Write single WAV file
-std::expected<void, WriteError> write_wav_file(
+// Frames interleaved per sf_writef_float call (keeps the scratch buffer in cache)
+constexpr auto write_block_frames = 16384uz;
+
+// libsndfile container and sample encoding
+constexpr int sndfile_format(OutputFormat format) {
+    switch (format) {
+        case OutputFormat::Pcm16:
+            return SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+        case OutputFormat::Pcm24:
+            return SF_FORMAT_WAV | SF_FORMAT_PCM_24;
+        case OutputFormat::Float32:
+            return SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+        case OutputFormat::Flac:
+            return SF_FORMAT_FLAC | SF_FORMAT_PCM_24;
+    }
+    return 0;
+}
+
+// Open a single output file for writing
+SNDFILE* open_output_file(
     std::filesystem::path const& path,
-    std::vector<float> const& data,
     int sample_rate,
-    int channels
+    int channels,
+    OutputFormat format
 ) {
-    // Configure WAV format
     auto sf_info = SF_INFO{
         .frames = 0,  // Must be 0 for output files (libsndfile requirement)
         .samplerate = sample_rate,
         .channels = channels,
-        .format = SF_FORMAT_WAV | SF_FORMAT_PCM_16,
+        .format = sndfile_format(format),
         .sections = 0,
         .seekable = 0
     };
@@ -29,33 +47,21 @@ std::expected<void, WriteError> write_wav_file(
     if (!file) {
         std::println(stderr, "Failed to create file: {}", path.string());
         std::println(stderr, "libsndfile error: {}", sf_strerror(nullptr));
-        return std::unexpected(WriteError::FileCreationFailed);
+        return nullptr;
     }
 
-    // Write audio data
-    auto const expected_frames = static_cast<sf_count_t>(data.size() / static_cast<std::size_t>(channels));
-    auto const frames_written = sf_writef_float(
-        file,
-        data.data(),
-        expected_frames
-    );
-
-    sf_close(file);
+    // Stems can overshoot full scale; clip them rather than let integer conversion wrap
+    if (format != OutputFormat::Float32)
+        sf_command(file, SFC_SET_CLIPPING, nullptr, SF_TRUE);
 
-    if (frames_written != expected_frames) {
-        std::println(stderr, "Write failed: expected {} frames, wrote {}",
-                     expected_frames, frames_written);
-        return std::unexpected(WriteError::WriteFailed);
-    }
-
-    std::println("Wrote {} samples to {}", data.size(), path.filename().string());
-    return {};
+    return file;
 }
 
 // Generate output filename for a stem in a dedicated subdirectory
 std::filesystem::path make_stem_path(
     std::filesystem::path const& base_path,
-    std::string_view stem_name
+    std::string_view stem_name,
+    std::string_view extension
 ) {
     // Create output directory named after the input file (without extension)
     auto output_dir = base_path.parent_path() / base_path.stem();
@@ -63,58 +69,144 @@ std::filesystem::path make_stem_path(
     // Create the directory if it doesn't exist
     std::filesystem::create_directories(output_dir);
 
-    // Generate stem filename: inputname_stemname.wav
-    auto const filename = base_path.stem().string() + "_" + std::string{stem_name} + base_path.extension().string();
+    // Generate stem filename: inputname_stemname.wav (or .flac)
+    auto const filename = base_path.stem().string() + "_" + std::string{stem_name} + std::string{extension};
 
     return output_dir / filename;
 }
 
 } // anonymous namespace
 
-std::expected<void, WriteError> write_stems(
+StemWriter::StemWriter(std::vector<std::unique_ptr<SNDFILE, FileCloser>> files, std::size_t channels)
+    : files_(std::move(files)),
+      channels_(channels),
+      blocks_(files_.size(), std::vector<float>(write_block_frames * channels)),
+      io_pool_(std::make_unique<ThreadPool>(files_.size() - 1uz)) {}
+
+std::expected<StemWriter, WriteError> StemWriter::open(
     std::filesystem::path const& base_path,
-    SeparatedStems const& stems,
+    std::span<std::string_view const> stem_names,
     int sample_rate,
-    int channels
+    int channels,
+    OutputFormat format
 ) {
     if (!base_path.has_filename())
         return std::unexpected(WriteError::InvalidPath);
 
+    if (stem_names.empty() or channels <= 0)
+        return std::unexpected(WriteError::InvalidFormat);
+
     auto const output_dir = base_path.parent_path() / base_path.stem();
     std::println("Writing stems to {}...", output_dir.string());
 
-    // Detect number of stems based on non-empty guitar stem
-    auto const num_stems = stems.guitar.empty() ? 4uz : 6uz;
-
-    // Write each stem to its own file
-    // Order: drums, bass, other, vocals [, guitar, piano]
-    auto const stem_files = std::vector<std::pair<std::string_view, std::vector<float> const*>>{
-        {separation::stem_name(0, num_stems), &stems.drums},
-        {separation::stem_name(1, num_stems), &stems.bass},
-        {separation::stem_name(2, num_stems), &stems.other},
-        {separation::stem_name(3, num_stems), &stems.vocals},
-        {separation::stem_name(4, num_stems), &stems.guitar},
-        {separation::stem_name(5, num_stems), &stems.piano}
-    };
+    // One file per output stem, in the order of the views written
+    auto files = std::vector<std::unique_ptr<SNDFILE, FileCloser>>{};
+    files.reserve(stem_names.size());
 
-    auto stems_written = 0uz;
-    for (auto i = 0uz; i < num_stems; ++i) {
-        auto const& [name, data] = stem_files[i];
+    for (auto const name : stem_names) {
+        auto const path = make_stem_path(base_path, name, output_extension(format));
+        auto* file = open_output_file(path, sample_rate, channels, format);
+        if (!file)
+            return std::unexpected(WriteError::FileCreationFailed);
 
-        // Skip empty stems (only guitar/piano can be empty for 4-stem model)
-        if (data->empty())
-            continue;
-
-        auto const path = make_stem_path(base_path, name);
-        auto const result = write_wav_file(path, *data, sample_rate, channels);
+        files.emplace_back(file);
+    }
 
-        if (!result)
-            return result;
+    return StemWriter{std::move(files), static_cast<std::size_t>(channels)};
+}
 
-        ++stems_written;
+bool StemWriter::write_stem(std::size_t stem, StemAudioView audio) {
+    auto const num_frames = audio.num_samples();
+    auto& block = blocks_[stem];
+
+    // Interleave planar channels one block at a time
+    for (auto done = 0uz; done < num_frames; ) {
+        auto const block_frames = std::min(write_block_frames, num_frames - done);
+
+        if (channels_ == 2uz) {
+            simd::interleave(std::span{block}.first(block_frames * 2uz),
+                             audio.channel(stem, 0uz).subspan(done, block_frames),
+                             audio.channel(stem, 1uz).subspan(done, block_frames));
+        } else {
+            for (auto channel = 0uz; channel < channels_; ++channel) {
+                auto const samples = audio.channel(stem, channel).subspan(done, block_frames);
+                for (auto i = 0uz; i < block_frames; ++i)
+                    block[i * channels_ + channel] = samples[i];
+            }
+        }
+
+        auto const written = sf_writef_float(files_[stem].get(), block.data(), static_cast<sf_count_t>(block_frames));
+        if (written != static_cast<sf_count_t>(block_frames)) {
+            std::println(stderr, "Write failed after {} of {} frames",
+                         frames_written_ + done, frames_written_ + num_frames);
+            return false;
+        }
+
+        done += block_frames;
     }
 
-    std::println("Successfully wrote {} stems", stems_written);
+    return true;
+}
+
+std::expected<void, WriteError> StemWriter::write(StemAudioView audio) {
+    if (audio.num_stems() != files_.size() or audio.num_channels() != channels_)
+        return std::unexpected(WriteError::InvalidFormat);
+
+    // Each stem has its own file and scratch block, so stems write independently
+    auto failed = std::atomic<bool>{false};
+    io_pool_->parallel_for(files_.size(), [&](std::size_t stem) {
+        if (!write_stem(stem, audio))
+            failed = true;
+    });
+
+    if (failed)
+        return std::unexpected(WriteError::WriteFailed);
+
+    frames_written_ += audio.num_samples();
+    return {};
+}
+
+std::expected<void, WriteError> StemWriter::close() {
+    // sf_close flushes buffered data and patches the header sizes
+    auto failed = false;
+    for (auto& file : files_)
+        failed = sf_close(file.release()) != 0 or failed;
+    files_.clear();
+
+    if (failed)
+        return std::unexpected(WriteError::WriteFailed);
+
+    std::println("Wrote {} frames per stem", frames_written_);
+    return {};
+}
+
+std::expected<void, WriteError> write_stems(
+    std::filesystem::path const& base_path,
+    StemAudio const& stems,
+    std::span<std::string_view const> stem_names,
+    int sample_rate,
+    OutputFormat format
+) {
+    if (stem_names.size() != stems.num_stems())
+        return std::unexpected(WriteError::InvalidFormat);
+
+    auto writer = StemWriter::open(
+        base_path,
+        stem_names,
+        sample_rate,
+        static_cast<int>(stems.num_channels()),
+        format
+    );
+    if (!writer)
+        return std::unexpected(writer.error());
+
+    if (auto const result = writer->write(stems.view()); !result)
+        return result;
+
+    if (auto const result = writer->close(); !result)
+        return result;
+
+    std::println("Successfully wrote {} stems", stems.num_stems());
     return {};
 }
 
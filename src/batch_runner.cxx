@@ -0,0 +1,135 @@
+#include "batch_runner.h"
+#include "audio_reader.h"
+#include "audio_writer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <print>
+#include <thread>
+
+namespace stems {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // anonymous namespace
+
+double BatchReport::audio_seconds() const {
+    auto total = 0.0;
+    for (auto const& job : jobs)
+        if (job.ok())
+            total += job.audio_seconds;
+    return total;
+}
+
+std::size_t BatchReport::failures() const {
+    return static_cast<std::size_t>(std::ranges::count_if(jobs, [](auto const& job) { return !job.ok(); }));
+}
+
+JobReport separate_file(StemProcessor& processor, std::filesystem::path const& input, OutputFormat format) {
+    auto const start = Clock::now();
+
+    // Opening validates the file, so it is only opened once
+    auto reader = AudioReader::open(input.string());
+    if (!reader)
+        return JobReport{.input = input, .wall_seconds = seconds_since(start), .error = error_message(reader.error())};
+
+    auto report = separate_file(processor, *reader, input, format);
+    report.wall_seconds = seconds_since(start);
+    return report;
+}
+
+JobReport separate_file(
+    StemProcessor& processor,
+    AudioReader& reader,
+    std::filesystem::path const& input,
+    OutputFormat format
+) {
+    auto const start = Clock::now();
+    auto report = JobReport{.input = input};
+    auto const finish = [&](std::string_view error) {
+        report.error = error;
+        report.wall_seconds = seconds_since(start);
+        return report;
+    };
+
+    auto const& info = reader.info();
+    auto writer = StemWriter::open(input, processor.output_names(), info.sample_rate, info.channels, format);
+    if (!writer)
+        return finish(error_message(writer.error()));
+
+    // A failed write aborts processing; report it rather than the generic sink error
+    auto write_failure = std::optional<WriteError>{};
+    auto const result = processor.process_stream(reader, [&](StemAudioView region) {
+        auto const written = writer->write(region);
+        if (!written)
+            write_failure = written.error();
+        return written.has_value();
+    });
+
+    if (write_failure)
+        return finish(error_message(*write_failure));
+    if (!result)
+        return finish(error_message(result.error()));
+    if (auto const closed = writer->close(); !closed)
+        return finish(error_message(closed.error()));
+
+    report.audio_seconds = static_cast<double>(info.frames) / info.sample_rate;
+    report.chunks = processor.last_stats().chunks;
+    report.silent_chunks = processor.last_stats().silent_chunks;
+    report.cached_chunks = processor.last_stats().cached_chunks;
+    return finish({});
+}
+
+BatchReport run_batch(
+    StemProcessor const& prototype,
+    std::span<std::filesystem::path const> inputs,
+    std::size_t jobs,
+    OutputFormat format
+) {
+    auto const start = Clock::now();
+    auto report = BatchReport{.jobs = std::vector<JobReport>(inputs.size())};
+    auto const num_workers = std::clamp(jobs, 1uz, std::max(inputs.size(), 1uz));
+
+    // Copies share the prototype's session and immutable STFT plans, so nothing is
+    // re-planned here (FFTW planning is not thread-safe)
+    auto processors = std::vector<std::unique_ptr<StemProcessor>>{};
+    for (auto i = 0uz; i < num_workers; ++i)
+        processors.push_back(std::make_unique<StemProcessor>(prototype));
+
+    // Workers pull the next unclaimed file, so long tracks don't stall a fixed split
+    auto next_input = std::atomic<std::size_t>{0uz};
+    auto completed = std::atomic<std::size_t>{0uz};
+
+    {
+        auto workers = std::vector<std::jthread>{};
+        for (auto& processor : processors) {
+            workers.emplace_back([&, &processor = *processor] {
+                for (auto i = next_input++; i < inputs.size(); i = next_input++) {
+                    auto& job = report.jobs[i] = separate_file(processor, inputs[i], format);
+                    auto const done = ++completed;
+
+                    if (job.ok())
+                        std::println("[{}/{}] {}: {:.1f}s audio in {:.1f}s ({:.2f}x realtime)",
+                                     done, inputs.size(), job.input.string(),
+                                     job.audio_seconds, job.wall_seconds, job.throughput());
+                    else
+                        std::println(stderr, "[{}/{}] {}: {}",
+                                     done, inputs.size(), job.input.string(), job.error);
+                }
+            });
+        }
+    }
+
+    report.wall_seconds = seconds_since(start);
+    return report;
+}
+
+} // namespace stems
@@ -0,0 +1,404 @@
+#include "blend.h"
+#include "cli_options.h"
+#include "constants.h"
+#include "onnx_model.h"
+#include "simd.h"
+#include "stem_processor.h"
+#include "stft.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <numbers>
+#include <optional>
+#include <print>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Command line options
+struct CliOptions {
+    std::optional<std::string_view> model_path;  // Inference benchmarks only run with a model
+    stems::ModelOptions model{.cache_dir = stems::default_cache_dir()};
+    stems::ProcessingOptions processing{.quiet = true};  // Console output would be timed too
+    double seconds = 60.0;            // Synthetic track length for the end-to-end run
+    std::size_t repetitions = 20uz;   // Timed runs per microbenchmark
+    std::filesystem::path fftw_wisdom{};
+    std::filesystem::path json_path{};
+};
+
+void print_usage(std::string_view program_name) {
+    std::println("Usage: {} [options]", program_name);
+    std::println("\nMicrobenchmarks the STFT, chunk blending, (de)interleaving and FP16 conversion.");
+    std::println("With a model it also times one inference run per chunk and a full separation.");
+    std::println("\nOptions:");
+    std::println("  --model PATH     ONNX model for the inference and end-to-end benchmarks");
+    std::println("  --provider NAME  Execution provider: cpu, cuda, tensorrt, coreml or auto (default: cpu)");
+    std::println("  --batch-size N   Chunks per inference run (default: {})", stems::separation::default_batch_size);
+    std::println("  --chunk-size N   Samples per chunk (default: the model's, else {})",
+                 stems::separation::model_chunk_size);
+    std::println("  --seconds S      Synthetic audio for the end-to-end run (default: 60)");
+    std::println("  --repetitions N  Timed runs per microbenchmark (default: 20)");
+    std::println("  --fftw-wisdom P  FFTW wisdom to import before planning");
+    std::println("  --json PATH      Also write the results as JSON");
+}
+
+std::optional<double> parse_seconds(std::string_view value) {
+    auto seconds = 0.0;
+    auto const [end, error] = std::from_chars(value.data(), value.data() + value.size(), seconds);
+    if (error != std::errc{} or end != value.data() + value.size() or seconds <= 0.0)
+        return std::nullopt;
+    return seconds;
+}
+
+std::optional<CliOptions> parse_arguments(std::span<char*> args) {
+    auto options = CliOptions{};
+
+    for (auto i = 1uz; i < args.size(); ++i) {
+        auto const arg = std::string_view{args[i]};
+
+        // Every option takes a value
+        if (i + 1 == args.size())
+            return std::nullopt;
+        auto const value = std::string_view{args[++i]};
+
+        if (arg == "--model") {
+            options.model_path = value;
+        } else if (arg == "--provider") {
+            auto const provider = stems::parse_provider(value);
+            if (!provider)
+                return std::nullopt;
+            options.model.provider = *provider;
+        } else if (arg == "--batch-size" or arg == "--chunk-size" or arg == "--repetitions") {
+            auto const count = stems::parse_count(value);
+            if (!count)
+                return std::nullopt;
+            if (arg == "--batch-size")
+                options.processing.batch_size = *count;
+            else if (arg == "--chunk-size")
+                options.processing.chunk_size = *count;
+            else
+                options.repetitions = *count;
+        } else if (arg == "--seconds") {
+            auto const seconds = parse_seconds(value);
+            if (!seconds)
+                return std::nullopt;
+            options.seconds = *seconds;
+        } else if (arg == "--fftw-wisdom") {
+            options.fftw_wisdom = value;
+        } else if (arg == "--json") {
+            options.json_path = value;
+        } else {
+            std::println(stderr, "Unknown option: {}", arg);
+            return std::nullopt;
+        }
+    }
+
+    return options;
+}
+
+// Timing of one benchmark over its repetitions
+struct BenchResult {
+    std::string name;
+    std::size_t repetitions;
+    std::size_t samples;  // Samples processed per repetition, for throughput
+    double min_ms;
+    double median_ms;
+    double mean_ms;
+
+    double samples_per_second() const { return min_ms > 0.0 ? samples / (min_ms / 1000.0) : 0.0; }
+};
+
+// Run `body` once to warm caches and plans, then time `repetitions` runs
+BenchResult measure(std::string name, std::size_t samples, std::size_t repetitions,
+                    std::function<void()> const& body) {
+    body();
+
+    auto times = std::vector<double>{};
+    for (auto i = 0uz; i < repetitions; ++i) {
+        auto const start = Clock::now();
+        body();
+        times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+
+    std::ranges::sort(times);
+    auto total = 0.0;
+    for (auto const time : times)
+        total += time;
+
+    auto result = BenchResult{.name = std::move(name),
+                              .repetitions = repetitions,
+                              .samples = samples,
+                              .min_ms = times.front(),
+                              .median_ms = times[times.size() / 2uz],
+                              .mean_ms = total / static_cast<double>(times.size())};
+
+    std::println("  {:<22} min {:9.3f} ms  median {:9.3f} ms  {:8.1f} Msamples/s",
+                 result.name, result.min_ms, result.median_ms, result.samples_per_second() / 1e6);
+    return result;
+}
+
+// Full separation of the synthetic track
+struct EndToEnd {
+    double audio_seconds;
+    double wall_seconds;
+    std::size_t chunks;
+
+    double realtime_factor() const { return wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0; }
+};
+
+// Deterministic test signal: a few partials plus low-level noise, never silent,
+// so the silence gate doesn't skip any chunk
+std::vector<float> synthetic_audio(std::size_t num_samples) {
+    auto generator = std::minstd_rand{42u};
+    auto noise = std::uniform_real_distribution<float>{-0.05f, 0.05f};
+    auto audio = std::vector<float>(num_samples);
+
+    constexpr auto two_pi = 2.0f * std::numbers::pi_v<float>;
+    constexpr auto rate = static_cast<float>(stems::audio::cd_sample_rate);
+    for (auto i = 0uz; i < num_samples; ++i) {
+        auto const t = static_cast<float>(i) / rate;
+        audio[i] = 0.3f * std::sin(two_pi * 110.0f * t) + 0.2f * std::sin(two_pi * 440.0f * t)
+                 + 0.1f * std::sin(two_pi * 3520.0f * t) + noise(generator);
+    }
+    return audio;
+}
+
+std::vector<BenchResult> run_dsp_benchmarks(std::size_t chunk_size, std::size_t repetitions) {
+    std::println("DSP ({} samples per chunk):", chunk_size);
+    auto results = std::vector<BenchResult>{};
+
+    auto const signal = synthetic_audio(chunk_size * 2uz);
+    auto const chunk = std::span{signal}.first(chunk_size);
+
+    // STFT forward into model-layout planes (the batched chunk plan) and back
+    auto const stft = stems::StftProcessor{chunk_size};
+    auto const plane_size = stems::stft_params::num_bins * stems::StftProcessor::num_frames(chunk_size);
+    auto real = std::vector<float>(plane_size);
+    auto imag = std::vector<float>(plane_size);
+    results.push_back(measure("stft_forward", chunk_size, repetitions, [&] {
+        if (!stft.forward(chunk, real, imag))
+            std::abort();
+    }));
+
+    auto const spectrogram = stft.forward(chunk);
+    if (!spectrogram)
+        std::abort();
+    results.push_back(measure("stft_inverse", chunk_size, repetitions, [&] {
+        if (!stft.inverse(*spectrogram))
+            std::abort();
+    }));
+
+    // One channel of an interior chunk: faded head and tail plus the copied body
+    auto const overlap = chunk_size / 20uz;
+    auto const cross_fade = stems::CrossFade{overlap, stems::FadeShape::Triangular};
+    auto output = std::vector<float>(chunk_size);
+    results.push_back(measure("blend_chunk", chunk_size, repetitions, [&] {
+        cross_fade.blend(output, chunk, 0uz, chunk_size, false, false);
+    }));
+
+    // Stereo (de)interleave of a whole chunk
+    auto left = std::vector<float>(chunk_size);
+    auto right = std::vector<float>(chunk_size);
+    results.push_back(measure("deinterleave", chunk_size, repetitions, [&] {
+        stems::simd::deinterleave(left, right, signal);
+    }));
+
+    auto interleaved = std::vector<float>(chunk_size * 2uz);
+    results.push_back(measure("interleave", chunk_size, repetitions, [&] {
+        stems::simd::interleave(interleaved, left, right);
+    }));
+
+    // Tensor boundary conversion for FP16 models
+    auto half = std::vector<std::uint16_t>(signal.size());
+    results.push_back(measure("to_half", signal.size(), repetitions, [&] {
+        stems::simd::to_half(half, signal);
+    }));
+    results.push_back(measure("from_half", signal.size(), repetitions, [&] {
+        stems::simd::from_half(interleaved, half);
+    }));
+
+    return results;
+}
+
+// One Session::Run over a full batch of chunks, through the persistent tensors
+std::optional<BenchResult> run_inference_benchmark(
+    stems::OnnxModel const& model,
+    std::size_t chunk_size,
+    std::size_t batch_size,
+    std::size_t repetitions
+) {
+    auto const batch = std::min(batch_size, model.max_batch_size());
+    auto tensors = model.allocate_tensors(batch, chunk_size);
+    if (!tensors)
+        return std::nullopt;
+
+    // Inputs only need plausible values: the model's cost doesn't depend on them
+    auto const signal = synthetic_audio(chunk_size);
+    auto const stft = stems::StftProcessor{chunk_size};
+    for (auto entry = 0uz; entry < batch; ++entry) {
+        std::ranges::copy(signal, tensors->waveform(entry, 0uz).begin());
+        std::ranges::copy(signal, tensors->waveform(entry, 1uz).begin());
+        if (!stft.forward_stereo(signal, signal, tensors->spectrogram(entry)))
+            return std::nullopt;
+    }
+
+    std::println("Inference ({} x {} samples):", batch, chunk_size);
+    auto failed = false;
+    auto result = measure("infer_batch", batch * chunk_size, repetitions, [&] {
+        failed = !model.infer(*tensors, batch) or failed;
+    });
+    if (failed)
+        return std::nullopt;
+    return result;
+}
+
+std::optional<EndToEnd> run_end_to_end(stems::StemProcessor& processor, double seconds) {
+    auto const frames = static_cast<std::size_t>(seconds * stems::audio::cd_sample_rate);
+    auto const mono = synthetic_audio(frames);
+
+    // Slightly different channels so the stereo image isn't degenerate
+    auto audio = std::vector<float>(frames * 2uz);
+    auto right = std::vector<float>(mono.rbegin(), mono.rend());
+    stems::simd::interleave(audio, mono, right);
+
+    std::println("End to end ({:.1f} s of audio):", seconds);
+    auto const start = Clock::now();
+    auto const separated = processor.process(audio, stems::audio::cd_sample_rate, 2);
+    auto const wall_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (!separated) {
+        std::println(stderr, "Error: {}", stems::error_message(separated.error()));
+        return std::nullopt;
+    }
+
+    auto const result = EndToEnd{.audio_seconds = seconds,
+                                 .wall_seconds = wall_seconds,
+                                 .chunks = processor.last_stats().chunks};
+    std::println("  {:.1f} s audio in {:.2f} s: {:.2f}x realtime", seconds, wall_seconds, result.realtime_factor());
+    return result;
+}
+
+std::string bench_json(BenchResult const& result) {
+    return std::format(R"({{"name": "{}", "repetitions": {}, "samples": {}, "min_ms": {:.6f}, )"
+                       R"("median_ms": {:.6f}, "mean_ms": {:.6f}, "samples_per_second": {:.1f}}})",
+                       result.name, result.repetitions, result.samples, result.min_ms,
+                       result.median_ms, result.mean_ms, result.samples_per_second());
+}
+
+// Flat, stable schema for CI dashboards: one object per benchmark plus the end-to-end run
+bool write_json(
+    std::filesystem::path const& path,
+    CliOptions const& options,
+    std::size_t chunk_size,
+    std::vector<BenchResult> const& results,
+    std::optional<EndToEnd> const& end_to_end,
+    std::optional<stems::OnnxModel> const& model
+) {
+    auto json = std::string{"{\n"};
+    json += std::format("  \"hardware_threads\": {},\n", std::thread::hardware_concurrency());
+    json += std::format("  \"simd_width\": {},\n", stems::simd::width);
+    json += std::format("  \"chunk_size\": {},\n", chunk_size);
+    json += std::format("  \"batch_size\": {},\n", options.processing.batch_size);
+    json += std::format("  \"peak_rss_bytes\": {},\n", stems::memory_stats().peak_rss_bytes);
+    if (model) {
+        json += std::format("  \"execution_provider\": \"{}\",\n", stems::provider_name(model->execution_provider()));
+        json += std::format("  \"precision\": \"{}\",\n", stems::precision_name(model->precision()));
+    }
+
+    json += "  \"benchmarks\": [\n";
+    for (auto i = 0uz; i < results.size(); ++i)
+        json += std::format("    {}{}\n", bench_json(results[i]), i + 1uz < results.size() ? "," : "");
+    json += "  ],\n";
+
+    if (end_to_end)
+        json += std::format(R"(  "end_to_end": {{"audio_seconds": {:.3f}, "wall_seconds": {:.6f}, )"
+                            R"("chunks": {}, "realtime_factor": {:.4f}}})",
+                            end_to_end->audio_seconds, end_to_end->wall_seconds,
+                            end_to_end->chunks, end_to_end->realtime_factor());
+    else
+        json += "  \"end_to_end\": null";
+    json += "\n}\n";
+
+    auto file = std::ofstream{path};
+    file << json;
+    return static_cast<bool>(file);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    auto const args = std::span(argv, static_cast<std::size_t>(argc));
+
+    auto const options = parse_arguments(args);
+    if (!options) {
+        print_usage(args[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Imported before any processor plans, so runs measure transforms rather than planning
+    auto const wisdom = options->fftw_wisdom.empty()
+        ? std::optional<stems::FftwWisdomFile>{}
+        : std::optional<stems::FftwWisdomFile>{std::in_place, options->fftw_wisdom};
+
+    auto model = std::optional<stems::OnnxModel>{};
+    if (options->model_path) {
+        auto loaded = stems::OnnxModel::load(*options->model_path, options->model);
+        if (!loaded) {
+            std::println(stderr, "Error: {}", stems::error_message(loaded.error()));
+            return EXIT_FAILURE;
+        }
+        model = std::move(*loaded);
+    }
+
+    // The model's chunking decides the sizes every other benchmark uses
+    auto const chunking = stems::resolve_chunking(model ? model->fixed_chunk_size() : std::nullopt,
+                                                  options->processing.chunk_size, options->processing.chunk_overlap);
+    if (!chunking) {
+        std::println(stderr, "Error: {}", stems::error_message(chunking.error()));
+        return EXIT_FAILURE;
+    }
+
+    auto results = run_dsp_benchmarks(chunking->size, options->repetitions);
+    auto end_to_end = std::optional<EndToEnd>{};
+
+    if (model) {
+        auto const inference = run_inference_benchmark(*model, chunking->size, options->processing.batch_size,
+                                                       options->repetitions);
+        if (!inference)
+            return EXIT_FAILURE;
+        results.push_back(*inference);
+
+        auto processor = stems::StemProcessor::create(*model, options->processing);
+        if (!processor) {
+            std::println(stderr, "Error: {}", stems::error_message(processor.error()));
+            return EXIT_FAILURE;
+        }
+
+        end_to_end = run_end_to_end(*processor, options->seconds);
+        if (!end_to_end)
+            return EXIT_FAILURE;
+    }
+
+    if (!options->json_path.empty()) {
+        if (!write_json(options->json_path, *options, chunking->size, results, end_to_end, model)) {
+            std::println(stderr, "Error: could not write {}", options->json_path.string());
+            return EXIT_FAILURE;
+        }
+        std::println("Results written to {}", options->json_path.string());
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#include "blend.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace stems {
+
+CrossFade::CrossFade(std::size_t overlap, FadeShape shape) : fade_in_(overlap), fade_out_(overlap) {
+    // Sampled at the centre of each step, so fade_in[i] and fade_out[i] sum
+    // exactly to one (triangular) or their squares do (equal power)
+    for (auto i = 0uz; i < overlap; ++i) {
+        auto const t = (static_cast<float>(i) + 0.5f) / static_cast<float>(overlap);
+        fade_in_[i] = shape == FadeShape::EqualPower
+            ? std::sin(t * std::numbers::pi_v<float> / 2.0f)
+            : t;
+    }
+
+    std::ranges::reverse_copy(fade_in_, fade_out_.begin());
+}
+
+void CrossFade::blend(
+    std::span<float> output,
+    std::span<float const> chunk,
+    std::size_t begin,
+    std::size_t end,
+    bool is_first_chunk,
+    bool is_last_chunk
+) const {
+    auto const size = chunk.size();
+    auto const overlap = fade_in_.size();
+    end = std::min({end, size, output.size()});
+
+    // Intersection of [begin, end) with a region of the chunk
+    auto const clip = [&](std::size_t first, std::size_t last) {
+        auto const from = std::max(first, begin);
+        auto const to = std::min(last, end);
+        return std::pair{from, std::max(from, to)};
+    };
+
+    auto const head_end = is_first_chunk ? 0uz : overlap;
+    auto const tail_begin = is_last_chunk ? size : size - overlap;
+
+    if (auto const [from, to] = clip(0uz, head_end); from < to)
+        simd::multiply_add(output.subspan(from, to - from), chunk.subspan(from, to - from),
+                           std::span{fade_in_}.subspan(from, to - from));
+
+    if (auto const [from, to] = clip(head_end, tail_begin); from < to)
+        std::copy_n(chunk.begin() + static_cast<std::ptrdiff_t>(from), to - from,
+                    output.begin() + static_cast<std::ptrdiff_t>(from));
+
+    if (auto const [from, to] = clip(tail_begin, size); from < to)
+        simd::multiply(output.subspan(from, to - from), chunk.subspan(from, to - from),
+                       std::span{fade_out_}.subspan(from - tail_begin, to - from));
+}
+
+} // namespace stems
@@ -0,0 +1,80 @@
+#include "cli_options.h"
+#include "blend.h"
+#include <utility>
+
+namespace stems {
+
+OptionMatch parse_common_option(
+    std::span<char* const> args,
+    std::size_t& i,
+    ModelOptions& model,
+    ProcessingOptions& processing,
+    std::optional<std::size_t>& intra_op_threads
+) {
+    auto const arg = std::string_view{args[i]};
+
+    // Switches
+    if (arg == "--parallel-execution") {
+        model.parallel_execution = true;
+    } else if (arg == "--no-spin") {
+        model.spin_wait = false;
+    } else if (arg == "--shared-thread-pool") {
+        model.shared_thread_pool = true;
+    } else if (arg == "--no-silence-gate") {
+        processing.silence_threshold_db.reset();
+    } else if (arg == "--quiet") {
+        processing.quiet = true;
+    } else {
+        auto const takes_value = arg == "--provider" or arg == "--batch-size" or arg == "--shifts"
+            or arg == "--chunk-size" or arg == "--overlap" or arg == "--intra-op-threads"
+            or arg == "--inter-op-threads" or arg == "--cpus" or arg == "--silence-threshold"
+            or arg == "--stems" or arg == "--result-cache" or arg == "--fade";
+        if (!takes_value)
+            return OptionMatch::NotCommon;
+        if (i + 1uz == args.size())
+            return OptionMatch::Invalid;
+
+        auto const value = std::string_view{args[++i]};
+        auto const set = [](auto& target, auto const& parsed) {
+            if (!parsed)
+                return false;
+            target = *parsed;
+            return true;
+        };
+
+        auto parsed = true;
+        if (arg == "--provider")
+            parsed = set(model.provider, parse_provider(value));
+        else if (arg == "--batch-size")
+            parsed = set(processing.batch_size, parse_count(value));
+        else if (arg == "--shifts")
+            parsed = set(processing.shifts, parse_count(value));
+        else if (arg == "--chunk-size")
+            parsed = set(processing.chunk_size, parse_count(value));
+        else if (arg == "--overlap")
+            parsed = set(processing.chunk_overlap, parse_count(value));
+        else if (arg == "--intra-op-threads")
+            parsed = set(intra_op_threads, parse_count(value));
+        else if (arg == "--inter-op-threads")
+            parsed = set(model.inter_op_threads, parse_count(value));
+        else if (arg == "--silence-threshold")
+            parsed = set(processing.silence_threshold_db, parse_decibels(value));
+        else if (arg == "--stems")
+            parsed = set(processing.stems, parse_stem_selection(value));
+        else if (arg == "--fade")
+            parsed = set(processing.fade, parse_fade_shape(value));
+        else if (arg == "--result-cache")
+            processing.result_cache_dir = value;
+        else if (auto cpus = parse_cpu_list(value))
+            model.cpu_affinity = std::move(*cpus);
+        else
+            parsed = false;
+
+        if (!parsed)
+            return OptionMatch::Invalid;
+    }
+
+    return OptionMatch::Parsed;
+}
+
+} // namespace stems
@@ -0,0 +1,271 @@
+#include "instrumentation.h"
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <print>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// Every C++ heap allocation in the process passes through the replacements below,
+// but is only counted while a Trace exists, so runs without --timings or --trace pay
+// one relaxed load of the gate. Counts go to one of several cache-line-sized shards
+// picked per thread, so ONNX Runtime's intra-op threads and the DSP pool don't all
+// contend for one line; memory_stats sums them
+std::atomic<std::size_t> live_traces{0uz};
+
+struct alignas(64) AllocationShard {
+    std::atomic<std::uint64_t> count{0u};
+    std::atomic<std::uint64_t> bytes{0u};
+};
+
+constexpr auto num_shards = 16uz;
+std::array<AllocationShard, num_shards> allocation_shards{};
+std::atomic<std::size_t> next_shard{0uz};
+thread_local auto const thread_shard = next_shard.fetch_add(1uz, std::memory_order_relaxed) % num_shards;
+
+std::uint64_t allocation_count() {
+    auto total = std::uint64_t{0u};
+    for (auto const& shard : allocation_shards)
+        total += shard.count.load(std::memory_order_relaxed);
+    return total;
+}
+
+void* counted_allocation(std::size_t size, std::size_t alignment) {
+    if (live_traces.load(std::memory_order_relaxed) > 0uz) {
+        auto& shard = allocation_shards[thread_shard];
+        shard.count.fetch_add(1u, std::memory_order_relaxed);
+        shard.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    // aligned_alloc wants a whole number of alignments, and neither call takes zero
+    auto const bytes = std::max(size, 1uz);
+    while (true) {
+        auto* const memory = alignment <= alignof(std::max_align_t)
+            ? std::malloc(bytes)
+            : std::aligned_alloc(alignment, (bytes + alignment - 1uz) / alignment * alignment);
+        if (memory)
+            return memory;
+
+        // As operator new must: let the installed handler free memory and retry
+        auto const handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc{};
+        handler();
+    }
+}
+
+} // anonymous namespace
+
+// Replaceable global allocation functions; the array and nothrow forms forward here
+// Kept out of line: GCC's -Wmismatched-new-delete misfires on an inlined free() of
+// memory it assumes came from the library operator new
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    return counted_allocation(size, alignof(std::max_align_t));
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t alignment) {
+    return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+
+[[gnu::noinline]] void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void* memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+namespace stems {
+
+namespace {
+
+// Microseconds, the unit of Chrome trace timestamps
+double to_us(Trace::Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+double to_ms(Trace::Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+constexpr double to_mb(std::uint64_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+// ONNX Runtime writes a bare JSON array of events; its contents, without the brackets
+std::optional<std::string> read_event_array(std::filesystem::path const& path) {
+    auto file = std::ifstream{path};
+    if (!file)
+        return std::nullopt;
+
+    auto const text = std::string{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    auto const first = text.find('[');
+    auto const last = text.rfind(']');
+    if (first == std::string::npos or last == std::string::npos or last < first)
+        return std::nullopt;
+
+    auto events = text.substr(first + 1uz, last - first - 1uz);
+    if (events.find_first_not_of(" \t\r\n") == std::string::npos)
+        return std::string{};
+    return events;
+}
+
+} // anonymous namespace
+
+MemoryStats memory_stats() {
+    auto usage = rusage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+
+    // ru_maxrss is bytes on macOS, kilobytes on Linux
+#if defined(__APPLE__)
+    auto const peak_rss = static_cast<std::size_t>(usage.ru_maxrss);
+#else
+    auto const peak_rss = static_cast<std::size_t>(usage.ru_maxrss) * 1024uz;
+#endif
+
+    auto allocated_bytes = std::uint64_t{0u};
+    for (auto const& shard : allocation_shards)
+        allocated_bytes += shard.bytes.load(std::memory_order_relaxed);
+
+    return MemoryStats{.peak_rss_bytes = peak_rss,
+                       .allocations = allocation_count(),
+                       .allocated_bytes = allocated_bytes};
+}
+
+Trace::Trace()
+    : origin_(Clock::now()),
+      origin_system_(std::chrono::system_clock::now()),
+      origin_memory_((live_traces.fetch_add(1uz, std::memory_order_relaxed), memory_stats())) {
+    events_.reserve(4096uz);
+}
+
+Trace::~Trace() {
+    live_traces.fetch_sub(1uz, std::memory_order_relaxed);
+}
+
+void Trace::record(Stage stage, std::optional<std::size_t> chunk, Clock::time_point start, Clock::time_point end) {
+    auto const allocations = allocation_count();
+
+    auto const lock = std::lock_guard{mutex_};
+    auto const thread = threads_.try_emplace(std::this_thread::get_id(), static_cast<std::uint32_t>(threads_.size()));
+    events_.push_back(Event{.stage = stage,
+                            .chunk = chunk,
+                            .thread = thread.first->second,
+                            .start = start,
+                            .end = end,
+                            .allocations = allocations});
+}
+
+void Trace::print_summary() const {
+    struct StageTotals {
+        std::size_t count = 0uz;
+        Clock::duration total{};
+        Clock::duration max{};
+    };
+
+    auto totals = std::array<StageTotals, static_cast<std::size_t>(Stage::NumStages)>{};
+    auto threads = 0uz;
+    {
+        auto const lock = std::lock_guard{mutex_};
+        for (auto const& event : events_) {
+            auto& stage = totals[static_cast<std::size_t>(event.stage)];
+            auto const duration = event.end - event.start;
+            ++stage.count;
+            stage.total += duration;
+            stage.max = std::max(stage.max, duration);
+        }
+        threads = threads_.size();
+    }
+
+    std::println("Stage timings over {} threads (ms):", threads);
+    std::println("  {:<12} {:>7} {:>12} {:>10} {:>10}", "stage", "count", "total", "mean", "max");
+    for (auto i = 0uz; i < totals.size(); ++i) {
+        auto const& stage = totals[i];
+        if (stage.count == 0uz)
+            continue;
+        std::println("  {:<12} {:>7} {:>12.2f} {:>10.3f} {:>10.3f}", stage_name(static_cast<Stage>(i)), stage.count,
+                     to_ms(stage.total), to_ms(stage.total) / static_cast<double>(stage.count), to_ms(stage.max));
+    }
+
+    auto const memory = memory_stats();
+    std::println("Memory: peak RSS {:.1f} MB, {} allocations ({:.1f} MB) during the run",
+                 to_mb(memory.peak_rss_bytes), memory.allocations - origin_memory_.allocations,
+                 to_mb(memory.allocated_bytes - origin_memory_.allocated_bytes));
+}
+
+bool Trace::write_chrome_trace(std::filesystem::path const& path, std::optional<OrtProfile> const& ort_profile) const {
+    // ONNX Runtime's timestamps count from its own start, which precedes the trace
+    // (sessions are created before processing); shift ours onto its time base.
+    // A profile started later can't be aligned without rewriting it, so is left as is
+    auto offset_us = 0.0;
+    auto ort_events = std::optional<std::string>{};
+    if (ort_profile) {
+        ort_events = read_event_array(ort_profile->path);
+        if (!ort_events)
+            std::println(stderr, "Warning: could not read ONNX Runtime profile {}", ort_profile->path.string());
+
+        auto const origin_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            origin_system_.time_since_epoch()).count();
+        auto const ort_start_ns = static_cast<std::int64_t>(ort_profile->start_ns);
+        if (ort_start_ns > 0 and origin_ns > ort_start_ns)
+            offset_us = static_cast<double>(origin_ns - ort_start_ns) / 1000.0;
+    }
+
+    // ONNX Runtime reports the real process id, so both sets land in one process track
+    auto const pid = ::getpid();
+    auto json = std::ostringstream{};
+    json << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    {
+        auto const lock = std::lock_guard{mutex_};
+        for (auto const& [_, thread] : threads_)
+            json << std::format(R"({{"name": "thread_name", "ph": "M", "pid": {}, "tid": {}, )"
+                                R"("args": {{"name": "stems {}"}}}},)" "\n", pid, thread, thread);
+
+        for (auto const& event : events_) {
+            auto const start_us = to_us(event.start - origin_) + offset_us;
+            auto const args = event.chunk ? std::format(R"(, "args": {{"chunk": {}}})", *event.chunk) : std::string{};
+            json << std::format(R"({{"name": "{}", "cat": "stems", "ph": "X", "pid": {}, "tid": {}, )"
+                                R"("ts": {:.3f}, "dur": {:.3f}{}}},)" "\n",
+                                stage_name(event.stage), pid, event.thread, start_us,
+                                to_us(event.end - event.start), args);
+            json << std::format(R"({{"name": "allocations", "ph": "C", "pid": {}, "ts": {:.3f}, )"
+                                R"("args": {{"count": {}}}}},)" "\n",
+                                pid, to_us(event.end - origin_) + offset_us,
+                                event.allocations - origin_memory_.allocations);
+        }
+    }
+
+    if (ort_events and !ort_events->empty())
+        json << *ort_events << ",\n";
+
+    // Closing metadata event, so every line above can end with a comma
+    auto const memory = memory_stats();
+    json << std::format(R"({{"name": "process_name", "ph": "M", "pid": {}, )"
+                        R"("args": {{"name": "stems, peak RSS {:.1f} MB"}}}})" "\n",
+                        pid, to_mb(memory.peak_rss_bytes));
+    json << "]}\n";
+
+    auto file = std::ofstream{path};
+    file << json.str();
+    return static_cast<bool>(file);
+}
+
+} // namespace stems
@@ -1,24 +1,96 @@
-#include "audio_validator.h"
+#include "audio_reader.h"
 #include "audio_writer.h"
+#include "batch_runner.h"
+#include "cli_options.h"
 #include "onnx_model.h"
 #include "stem_processor.h"
+#include <expected>
 #include <filesystem>
+#include <memory>
+#include <optional>
 #include <print>
 #include <span>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <cstdlib>
-#include <sndfile.h>
 
 namespace {
 
+// Measured FFTW plans shared by every run on this machine
+std::filesystem::path default_wisdom_path() {
+    auto const cache_dir = stems::default_cache_dir();
+    return cache_dir.empty() ? std::filesystem::path{} : cache_dir / "fftwf.wisdom";
+}
+
+// Command line options
+struct CliOptions {
+    std::vector<std::string_view> input_files;
+    std::string_view model_path = "models/htdemucs.onnx";
+    std::optional<stems::StemWeights> model_weights{};  // As an ensemble member
+    std::vector<std::pair<std::string_view, std::optional<stems::StemWeights>>> ensemble{};
+    stems::ProcessingOptions processing{};
+    bool stream = false;
+    bool live = false;  // Push the file block by block through incremental separation
+    bool batch = false;
+    stems::ModelOptions model{.cache_dir = stems::default_cache_dir()};
+    std::optional<std::size_t> intra_op_threads;  // Default depends on the job count
+    std::size_t jobs = 1uz;
+    stems::OutputFormat output_format = stems::OutputFormat::Pcm16;
+    std::filesystem::path fftw_wisdom = default_wisdom_path();
+    bool tune_fftw = false;
+    bool timings = false;                // Per-stage summary table after separation
+    std::filesystem::path trace_path{};  // Chrome trace of every stage and ONNX Runtime operator
+};
+
 void print_usage(std::string_view program_name) {
-    std::println("Usage: {} <audio_file> [model_path]", program_name);
+    std::println("Usage: {} <audio_file> [model_path] [options]", program_name);
+    std::println("       {} <audio_file>... --batch [--jobs N] [options]", program_name);
+    std::println("       {} --tune-fftw [--fftw-wisdom PATH]", program_name);
+    std::println("\nOptions:");
+    std::println("  --model PATH     ONNX model to load");
+    std::println("  --ensemble PATH[:WEIGHTS]  Also separate with this model and combine per stem, e.g. "
+                 "vocal.onnx:vocals (repeatable)");
+    std::println("  --model-weights W  Weights of --model in an ensemble, e.g. drums,bass=0.5 (default: 1 for all)");
+    std::println("  --batch-size N   Chunks per inference run (default: {}, needs dynamic-batch model)",
+                 stems::separation::default_batch_size);
+    std::println("  --chunk-size N   Samples per model input (default: the model's export length)");
+    std::println("  --overlap N      Samples shared by neighbouring chunks (default: 5% of the chunk)");
+    std::println("  --fade SHAPE     Chunk cross-fade: triangular or equal-power (default: triangular)");
+    std::println("  --shifts N       Average N delayed separations per chunk, batched together (default: 1)");
+    std::println("  --silence-threshold DB  Chunks peaking below this skip inference (default: {} dBFS)",
+                 stems::separation::silence_threshold_db);
+    std::println("  --no-silence-gate  Run inference on every chunk");
+    std::println("  --output-format F  Stem encoding: pcm16, pcm24, float or flac (default: pcm16)");
+    std::println("  --stems LIST     Stems to keep, e.g. vocals,drums; instrumental = mix - vocals (default: all)");
+    std::println("  --result-cache DIR  Reuse model outputs of chunks separated before (stored in DIR)");
+    std::println("  --stream         Read, separate and write incrementally with bounded memory");
+    std::println("  --live           Separate as a live input, pushed in blocks, and report latency "
+                 "(default chunk: {} samples)", stems::separation::live_chunk_size);
+    std::println("  --batch          Separate every input file, loading the model once (streams each file)");
+    std::println("  --jobs N         Files separated concurrently in batch mode (default: 1)");
+    std::println("  --provider NAME  Execution provider: cpu, cuda, tensorrt, coreml or auto (default: cpu)");
+    std::println("  --intra-op-threads N  Threads per inference run (default: all cores, shared between jobs)");
+    std::println("  --inter-op-threads N  Threads for independent graph branches with --parallel-execution");
+    std::println("  --parallel-execution  Run independent graph nodes concurrently");
+    std::println("  --cpus LIST      Pin inference threads one per CPU, e.g. 0-15 (sets the intra-op count)");
+    std::println("  --no-spin        Idle inference threads sleep instead of spinning");
+    std::println("  --shared-thread-pool  One set of inference pools for every session in the process");
+    std::println("  --fftw-wisdom P  FFTW wisdom file (default: {})", default_wisdom_path().string());
+    std::println("  --tune-fftw      Plan every transform with FFTW_PATIENT and save the wisdom");
+    std::println("  --no-model-cache Always optimise the model graph instead of using {}",
+                 stems::default_cache_dir().string());
+    std::println("  --quiet          No per-chunk progress lines");
+    std::println("  --timings        Print per-stage timings, peak RSS and allocation counts");
+    std::println("  --trace PATH     Write a Chrome trace of every stage with ONNX Runtime's profile (implies --timings)");
     std::println("\nSupported formats: WAV (FLAC and AIFF coming soon)");
-    std::println("\nThis tool separates audio into 4 stems:");
+    std::println("\nThis tool separates audio into 4 stems (6 with htdemucs_6s):");
     std::println("  - vocals");
     std::println("  - drums");
     std::println("  - bass");
     std::println("  - other");
+    std::println("  - instrumental (optional, derived: everything but the vocals)");
     std::println("\nModel path defaults to: models/htdemucs.onnx");
 }
 
@@ -33,26 +105,292 @@ void print_audio_info(stems::AudioInfo const& info) {
     std::println("  Duration: {:.2f} seconds", duration_seconds);
 }
 
-// Load audio file into memory
-std::expected<std::vector<float>, stems::ValidationError> load_audio(
-    std::string_view path,
-    stems::AudioInfo const& info
+// Parse positional arguments and options
+std::optional<CliOptions> parse_arguments(std::span<char*> args) {
+    auto options = CliOptions{};
+    auto model_given = false;
+
+    for (auto i = 1uz; i < args.size(); ++i) {
+        auto const arg = std::string_view{args[i]};
+
+        auto const common = stems::parse_common_option(args, i, options.model, options.processing,
+                                                       options.intra_op_threads);
+        if (common == stems::OptionMatch::Invalid)
+            return std::nullopt;
+        if (common == stems::OptionMatch::Parsed)
+            continue;
+
+        if (arg == "--jobs") {
+            if (i + 1 == args.size())
+                return std::nullopt;
+            auto const count = stems::parse_count(args[++i]);
+            if (!count)
+                return std::nullopt;
+            options.jobs = *count;
+        } else if (arg == "--model") {
+            if (i + 1 == args.size())
+                return std::nullopt;
+            options.model_path = args[++i];
+            model_given = true;
+        } else if (arg == "--ensemble") {
+            if (i + 1 == args.size())
+                return std::nullopt;
+            auto const spec = std::string_view{args[++i]};
+            auto const colon = spec.rfind(':');
+            auto weights = std::optional<stems::StemWeights>{};
+            if (colon != std::string_view::npos) {
+                weights = stems::parse_stem_weights(spec.substr(colon + 1uz));
+                if (!weights)
+                    return std::nullopt;
+            }
+            options.ensemble.emplace_back(spec.substr(0uz, colon), weights);
+        } else if (arg == "--model-weights") {
+            if (i + 1 == args.size())
+                return std::nullopt;
+            options.model_weights = stems::parse_stem_weights(args[++i]);
+            if (!options.model_weights)
+                return std::nullopt;
+        } else if (arg == "--output-format") {
+            if (i + 1 == args.size())
+                return std::nullopt;
+            auto const format = stems::parse_output_format(args[++i]);
+            if (!format)
+                return std::nullopt;
+            options.output_format = *format;
+        } else if (arg == "--fftw-wisdom") {
+            if (i + 1 == args.size())
+                return std::nullopt;
+            options.fftw_wisdom = args[++i];
+        } else if (arg == "--tune-fftw") {
+            options.tune_fftw = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--live") {
+            options.live = true;
+        } else if (arg == "--batch") {
+            options.batch = true;
+        } else if (arg == "--no-model-cache") {
+            options.model.cache_dir.clear();
+        } else if (arg == "--timings") {
+            options.timings = true;
+        } else if (arg == "--trace") {
+            if (i + 1 == args.size())
+                return std::nullopt;
+            options.trace_path = args[++i];
+        } else if (arg.starts_with("--")) {
+            std::println(stderr, "Unknown option: {}", arg);
+            return std::nullopt;
+        } else {
+            options.input_files.push_back(arg);
+        }
+    }
+
+    // Single-file mode keeps the positional model path
+    if (!options.batch and !model_given and options.input_files.size() == 2uz) {
+        options.model_path = options.input_files.back();
+        options.input_files.pop_back();
+    }
+
+    // ONNX Runtime's profile is written next to the trace it is merged into
+    if (!options.trace_path.empty()) {
+        options.timings = true;
+        options.model.profile_prefix = options.trace_path.parent_path() / (options.trace_path.stem().string() + "_onnxruntime");
+    }
+
+    if (options.tune_fftw)
+        return options.input_files.empty() ? std::optional{options} : std::nullopt;
+
+    if (options.input_files.empty() or (!options.batch and options.input_files.size() != 1uz))
+        return std::nullopt;
+
+    return options;
+}
+
+// Offline tuning: measure the transforms much harder than at startup and keep the result
+// Wisdom is machine specific, but a file tuned on the deployment hardware can be shipped
+int tune_fftw(std::filesystem::path const& wisdom_path, std::size_t chunk_size) {
+    if (wisdom_path.empty()) {
+        std::println(stderr, "No FFTW wisdom path (set --fftw-wisdom or HOME)");
+        return EXIT_FAILURE;
+    }
+
+    std::println("Tuning FFTW plans with FFTW_PATIENT, this can take a few minutes...");
+    auto wisdom = stems::FftwWisdomFile{wisdom_path};
+    {
+        auto const stft = stems::StftProcessor{chunk_size, FFTW_PATIENT};
+    }
+
+    if (!wisdom.save()) {
+        std::println(stderr, "Error: could not write {}", wisdom_path.string());
+        return EXIT_FAILURE;
+    }
+
+    std::println("✓ FFTW wisdom saved to {}", wisdom_path.string());
+    return EXIT_SUCCESS;
+}
+
+// Trace for --timings or --trace, nullptr when neither is given
+std::shared_ptr<stems::Trace> make_trace(CliOptions const& options) {
+    return options.timings ? std::make_shared<stems::Trace>() : nullptr;
+}
+
+// Print the stage summary and write the Chrome trace, ONNX Runtime's operators included
+bool finish_trace(CliOptions const& options, stems::Trace const& trace, stems::OnnxModel const& model) {
+    std::println("");
+    trace.print_summary();
+    if (options.trace_path.empty())
+        return true;
+
+    if (!trace.write_chrome_trace(options.trace_path, model.end_profiling())) {
+        std::println(stderr, "Error: could not write {}", options.trace_path.string());
+        return false;
+    }
+
+    std::println("Trace written to {} (open in ui.perfetto.dev or chrome://tracing)", options.trace_path.string());
+    return true;
+}
+
+// Feed the file through incremental separation as a live source would, writing each
+// finished block as it is emitted
+int separate_live(
+    stems::StemProcessor& processor,
+    stems::AudioReader& reader,
+    std::filesystem::path const& output_path,
+    stems::OutputFormat format
 ) {
-    auto file_info = SF_INFO{};
-    auto* file = sf_open(path.data(), SFM_READ, &file_info);
-    if (!file)
-        return std::unexpected(stems::ValidationError::FileNotFound);
+    auto const& info = reader.info();
+    if (info.channels != stems::audio::stereo_channels) {
+        std::println(stderr, "Error: {}", stems::error_message(stems::ProcessingError::InvalidAudio));
+        return EXIT_FAILURE;
+    }
 
-    auto const total_samples = static_cast<std::size_t>(info.frames * info.channels);
-    auto audio_data = std::vector<float>(total_samples);
+    auto writer = stems::StemWriter::open(output_path, processor.output_names(), info.sample_rate, info.channels, format);
+    if (!writer) {
+        std::println(stderr, "Error: {}", stems::error_message(writer.error()));
+        return EXIT_FAILURE;
+    }
 
-    auto const frames_read = sf_readf_float(file, audio_data.data(), info.frames);
-    sf_close(file);
+    auto write_failure = std::optional<stems::WriteError>{};
+    auto separation = processor.start_incremental(info.sample_rate, [&](stems::StemAudioView block) {
+        auto const written = writer->write(block);
+        if (!written)
+            write_failure = written.error();
+        return written.has_value();
+    });
+    if (!separation) {
+        std::println(stderr, "Error: {}", stems::error_message(separation.error()));
+        return EXIT_FAILURE;
+    }
 
-    if (frames_read != info.frames)
-        return std::unexpected(stems::ValidationError::CorruptedFile);
+    auto left = std::vector<float>(stems::separation::live_block_size);
+    auto right = std::vector<float>(stems::separation::live_block_size);
+    auto result = std::expected<void, stems::ProcessingError>{};
+    while (result) {
+        auto const frames = reader.read(left, right);
+        if (!frames) {
+            std::println(stderr, "Error: {}", stems::error_message(frames.error()));
+            return EXIT_FAILURE;
+        }
+        if (*frames == 0uz)
+            break;
+        result = separation->push(std::span{left}.first(*frames), std::span{right}.first(*frames));
+    }
+    if (result)
+        result = separation->finish();
+
+    if (write_failure) {
+        std::println(stderr, "Error: {}", stems::error_message(*write_failure));
+        return EXIT_FAILURE;
+    }
+    if (!result) {
+        std::println(stderr, "Error: {}", stems::error_message(result.error()));
+        return EXIT_FAILURE;
+    }
+    if (auto const closed = writer->close(); !closed) {
+        std::println(stderr, "Error: {}", stems::error_message(closed.error()));
+        return EXIT_FAILURE;
+    }
+
+    auto const latency = separation->latency();
+    std::println("\nLatency over {} chunks: {:.2f}s input window + {:.0f} ms mean / {:.0f} ms max separation",
+                 latency.chunks, latency.window_seconds, latency.mean_compute_seconds * 1000.0,
+                 latency.max_compute_seconds * 1000.0);
+    std::println("Worst case {:.2f}s behind input, real-time factor {:.3f}{}", latency.max_latency_seconds(),
+                 latency.real_time_factor, latency.real_time_factor < 1.0 ? "" : " (falling behind a live input)");
+    return EXIT_SUCCESS;
+}
+
+// Processor over --model and every --ensemble member, each loaded with the same options
+std::optional<stems::StemProcessor> create_processor(
+    CliOptions const& options,
+    stems::OnnxModel const& model,
+    stems::ModelOptions model_options,
+    stems::ProcessingOptions const& processing
+) {
+    auto members = std::vector<stems::EnsembleMember>{};
+    members.push_back({.model = model, .weights = options.model_weights});
+
+    // Only the first model's profile is merged into a trace
+    model_options.profile_prefix.clear();
+    for (auto const& [path, weights] : options.ensemble) {
+        std::println("Loading ensemble model: {}", path);
+        auto member = stems::OnnxModel::load(path, model_options);
+        if (!member) {
+            std::println(stderr, "Error: {}", stems::error_message(member.error()));
+            return std::nullopt;
+        }
+        members.push_back({.model = std::move(*member), .weights = weights});
+    }
 
-    return audio_data;
+    auto processor = stems::StemProcessor::create(std::move(members), processing);
+    if (!processor) {
+        std::println(stderr, "Error: {}", stems::error_message(processor.error()));
+        return std::nullopt;
+    }
+    return std::move(*processor);
+}
+
+// Separate many files with one loaded model shared by every job
+int separate_batch(CliOptions const& options) {
+    auto const jobs = std::min(options.jobs, options.input_files.size());
+    auto model_options = options.model;
+    model_options.intra_op_threads = options.intra_op_threads.value_or(
+        stems::intra_op_threads_for(std::thread::hardware_concurrency(), jobs));
+
+    std::println("Loading model: {} ({} jobs, {} intra-op threads)",
+                 options.model_path, jobs, model_options.intra_op_threads);
+    auto const model = stems::OnnxModel::load(options.model_path, model_options);
+    if (!model) {
+        std::println(stderr, "Error: {}", stems::error_message(model.error()));
+        return EXIT_FAILURE;
+    }
+
+    auto processing = options.processing;
+    processing.trace = make_trace(options);
+    auto const processor = create_processor(options, *model, model_options, processing);
+    if (!processor)
+        return EXIT_FAILURE;
+
+    auto const inputs = std::vector<std::filesystem::path>(options.input_files.begin(), options.input_files.end());
+    std::println("\nSeparating {} files...", inputs.size());
+    auto const report = stems::run_batch(*processor, inputs, jobs, options.output_format);
+
+    std::println("\nBatch summary:");
+    for (auto const& job : report.jobs) {
+        if (job.ok())
+            std::println("  {}: {:.1f}s audio in {:.1f}s ({:.2f}x realtime, {}/{} chunks silent, {} cached)",
+                         job.input.string(), job.audio_seconds, job.wall_seconds, job.throughput(),
+                         job.silent_chunks, job.chunks, job.cached_chunks);
+        else
+            std::println("  {}: failed ({})", job.input.string(), job.error);
+    }
+
+    std::println("\n{}/{} files separated: {:.1f}s audio in {:.1f}s ({:.2f} audio-seconds per second)",
+                 report.jobs.size() - report.failures(), report.jobs.size(),
+                 report.audio_seconds(), report.wall_seconds, report.throughput());
+
+    auto const traced = !processing.trace or finish_trace(options, *processing.trace, *model);
+    return report.failures() == 0 and traced ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 } // anonymous namespace
@@ -60,52 +398,90 @@ std::expected<std::vector<float>, stems::ValidationError> load_audio(
 int main(int argc, char* argv[]) {
     auto const args = std::span(argv, static_cast<std::size_t>(argc));
 
-    if (args.size() < 2 || args.size() > 3) {
+    auto const options = parse_arguments(args);
+    if (!options) {
         print_usage(args[0]);
         return EXIT_FAILURE;
     }
 
-    auto const input_file = std::string_view{args[1]};
-    auto const model_path = (args.size() == 3)
-        ? std::string_view{args[2]}
-        : std::string_view{"models/htdemucs.onnx"};
+    if (options->tune_fftw)
+        return tune_fftw(options->fftw_wisdom,
+                         options->processing.chunk_size.value_or(stems::separation::model_chunk_size));
+
+    // Imported before any processor plans, saved back on exit if planning added to it
+    auto const wisdom = stems::FftwWisdomFile{options->fftw_wisdom};
+
+    if (options->batch)
+        return separate_batch(*options);
 
-    // Validate input file
-    auto const info_result = stems::validate_audio_file(input_file);
-    if (!info_result) {
-        std::println(stderr, "Error: {}", stems::error_message(info_result.error()));
+    auto const input_file = options->input_files.front();
+    auto const model_path = options->model_path;
+
+    // Validate input file; the reader keeps it open for separation
+    auto reader = stems::AudioReader::open(input_file);
+    if (!reader) {
+        std::println(stderr, "Error: {}", stems::error_message(reader.error()));
         std::println(stderr, "File: {}", input_file);
         return EXIT_FAILURE;
     }
 
-    auto const& info = *info_result;
+    auto const& info = reader->info();
     std::println("✓ Valid lossless audio file");
     print_audio_info(info);
+    if (auto const encoding = reader->mapped_encoding())
+        std::println("  Reader: memory-mapped ({})", stems::wav_encoding_name(*encoding));
 
     // Load ONNX model
     std::println("\nLoading model: {}", model_path);
-    auto model_result = stems::OnnxModel::load(model_path);
+    auto model_options = options->model;
+    model_options.intra_op_threads = options->intra_op_threads.value_or(0uz);
+    auto model_result = stems::OnnxModel::load(model_path, model_options);
     if (!model_result) {
         std::println(stderr, "Error: {}", stems::error_message(model_result.error()));
         return EXIT_FAILURE;
     }
 
-    // Load audio data
-    std::println("\nLoading audio data...");
-    auto audio_result = load_audio(input_file, info);
-    if (!audio_result) {
-        std::println(stderr, "Error loading audio: {}",
-                     stems::error_message(audio_result.error()));
+    auto const output_path = std::filesystem::path{input_file};
+    auto processing = options->processing;
+    processing.trace = make_trace(*options);
+
+    // A short chunk keeps live latency down; fixed-shape models only take their export length
+    if (options->live and !processing.chunk_size) {
+        if (auto const fixed = model_result->fixed_chunk_size())
+            std::println("Model has a fixed time axis, so live chunks are {} samples", *fixed);
+        else
+            processing.chunk_size = stems::separation::live_chunk_size;
+    }
+    auto processor_result = create_processor(*options, *model_result, model_options, processing);
+    if (!processor_result)
         return EXIT_FAILURE;
+    auto& processor = *processor_result;
+
+    if (options->live) {
+        std::println("\nSeparating stems (live)...");
+        auto const status = separate_live(processor, *reader, output_path, options->output_format);
+        if (status == EXIT_SUCCESS and processing.trace and !finish_trace(*options, *processing.trace, *model_result))
+            return EXIT_FAILURE;
+        return status;
     }
 
-    auto const& audio_data = *audio_result;
-    std::println("Loaded {} samples", audio_data.size());
+    if (options->stream) {
+        std::println("\nSeparating stems (streaming)...");
+        auto const job = stems::separate_file(processor, *reader, output_path, options->output_format);
+        if (!job.ok()) {
+            std::println(stderr, "Error: {}", job.error);
+            return EXIT_FAILURE;
+        }
 
-    // Process stems
+        std::println("\n✓ Stem separation complete! ({:.2f}x realtime)", job.throughput());
+        if (processing.trace and !finish_trace(*options, *processing.trace, *model_result))
+            return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+
+    // Process stems, decoding each chunk straight into the model input
     std::println("\nSeparating stems...");
-    auto processor = stems::StemProcessor{std::move(*model_result)};
-    auto stems_result = processor.process(audio_data, info.sample_rate, info.channels);
+    auto stems_result = processor.process(*reader);
 
     if (!stems_result) {
         std::println(stderr, "Error: {}", stems::error_message(stems_result.error()));
@@ -114,13 +490,11 @@ int main(int argc, char* argv[]) {
 
     // Write output files
     std::println("\nWriting output files...");
-    auto const output_path = std::filesystem::path{input_file};
-    auto write_result = stems::write_stems(
-        output_path,
-        *stems_result,
-        info.sample_rate,
-        info.channels
-    );
+    auto write_result = [&] {
+        auto const span = stems::TraceSpan{processing.trace.get(), stems::Stage::Write};
+        return stems::write_stems(output_path, *stems_result, processor.output_names(), info.sample_rate,
+                                  options->output_format);
+    }();
 
     if (!write_result) {
         std::println(stderr, "Error: {}", stems::error_message(write_result.error()));
@@ -128,5 +502,7 @@ int main(int argc, char* argv[]) {
     }
 
     std::println("\n✓ Stem separation complete!");
+    if (processing.trace and !finish_trace(*options, *processing.trace, *model_result))
+        return EXIT_FAILURE;
     return EXIT_SUCCESS;
 }
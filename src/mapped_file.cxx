@@ -0,0 +1,56 @@
+#include "mapped_file.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+
+namespace stems {
+
+MappedFile::MappedFile(std::byte const* data, std::size_t size) : data_(data), size_(size) {}
+
+MappedFile::~MappedFile() {
+    if (data_)
+        ::munmap(const_cast<std::byte*>(data_), size_);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0uz)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        if (data_)
+            ::munmap(const_cast<std::byte*>(data_), size_);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0uz);
+    }
+    return *this;
+}
+
+void MappedFile::advise_sequential() const {
+    if (data_)
+        ::madvise(const_cast<std::byte*>(data_), size_, MADV_SEQUENTIAL);
+}
+
+std::optional<MappedFile> MappedFile::open(std::filesystem::path const& path) {
+    auto const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return std::nullopt;
+
+    auto const end = ::lseek(fd, 0, SEEK_END);
+    if (end <= 0) {
+        ::close(fd);
+        return std::nullopt;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    auto const size = static_cast<std::size_t>(end);
+    auto* const memory = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (memory == MAP_FAILED)
+        return std::nullopt;
+
+    return MappedFile{static_cast<std::byte const*>(memory), size};
+}
+
+} // namespace stems
@@ -1,14 +1,26 @@
 #include "onnx_model.h"
+#include "hash.h"
+#include "simd.h"
+#include <unistd.h>
 #include <algorithm>
+#include <array>
+#include <cstdlib>
 #include <filesystem>
+#include <format>
+#include <limits>
+#include <mutex>
 #include <print>
+#include <system_error>
+#include <type_traits>
+#include <vector>
 
 namespace stems {
 
 namespace {
 
-// Minimum expected file size for htdemucs model (300MB typical, allow 100MB minimum)
-constexpr auto min_model_size = 100'000'000uz; // 100 MB
+// Minimum expected file size for htdemucs model (300MB typical for FP32, about a
+// quarter of that for INT8 exports, allow 50MB minimum)
+constexpr auto min_model_size = 50'000'000uz; // 50 MB
 
 // Check if file exists and has reasonable size
 std::expected<void, ModelError> validate_model_file(std::string_view path) {
@@ -24,7 +36,8 @@ std::expected<void, ModelError> validate_model_file(std::string_view path) {
 
     if (total_size < min_model_size) {
         std::println(stderr, "Model file is too small: {} bytes", total_size);
-        std::println(stderr, "Expected at least {} bytes (~300MB for htdemucs)", min_model_size);
+        std::println(stderr, "Expected at least {} bytes (~300MB for htdemucs, less for FP16/INT8 exports)",
+                     min_model_size);
         std::println(stderr, "");
         std::println(stderr, "The model file appears to be corrupted or incomplete.");
         std::println(stderr, "Please regenerate it using the instructions in models/README.md:");
@@ -36,51 +49,528 @@ std::expected<void, ModelError> validate_model_file(std::string_view path) {
     return {};
 }
 
+// Optimisation applied when building the cache; cached models load with optimisation disabled
+constexpr auto graph_optimization_level = GraphOptimizationLevel::ORT_ENABLE_EXTENDED;
+
+// Name ONNX Runtime registers each provider under
+constexpr std::string_view ort_provider_name(ExecutionProvider provider) {
+    switch (provider) {
+        case ExecutionProvider::Cuda:
+            return "CUDAExecutionProvider";
+        case ExecutionProvider::TensorRt:
+            return "TensorrtExecutionProvider";
+        case ExecutionProvider::CoreMl:
+            return "CoreMLExecutionProvider";
+        case ExecutionProvider::Auto:
+        case ExecutionProvider::Cpu:
+            break;
+    }
+    return "CPUExecutionProvider";
+}
+
+// TensorRT and CoreML compile subgraphs into kernels that can't be serialised,
+// so only graphs optimised for CPU and CUDA are cached (TensorRT keeps an engine cache)
+constexpr bool supports_graph_cache(ExecutionProvider provider) {
+    return provider == ExecutionProvider::Cpu or provider == ExecutionProvider::Cuda;
+}
+
+// Providers running on a CUDA device, which can use page-locked host tensors
+constexpr bool uses_cuda(ExecutionProvider provider) {
+    return provider == ExecutionProvider::Cuda or provider == ExecutionProvider::TensorRt;
+}
+
+// Compile-time tests
+static_assert(ort_provider_name(ExecutionProvider::Auto) == "CPUExecutionProvider");
+static_assert(supports_graph_cache(ExecutionProvider::Cuda));
+static_assert(!supports_graph_cache(ExecutionProvider::TensorRt));
+
+// Providers to try in order; CPU always ends the list as the fallback
+std::vector<ExecutionProvider> provider_candidates(ExecutionProvider requested) {
+    if (requested == ExecutionProvider::Auto)
+        return {ExecutionProvider::TensorRt, ExecutionProvider::Cuda, ExecutionProvider::CoreMl, ExecutionProvider::Cpu};
+    if (requested == ExecutionProvider::Cpu)
+        return {ExecutionProvider::Cpu};
+    return {requested, ExecutionProvider::Cpu};
+}
+
+// Whether this ONNX Runtime build was compiled with the provider
+bool provider_available(ExecutionProvider provider) {
+    auto const available = Ort::GetAvailableProviders();
+    return std::ranges::find(available, ort_provider_name(provider)) != available.end();
+}
+
+// Hash of the model and external weight files as they are on disk (path, size,
+// modification time), so a re-exported model never matches its predecessor
+std::uint64_t model_files_key(std::string_view model_path, std::uint64_t seed) {
+    auto const model = std::filesystem::path{model_path};
+    auto const data = std::filesystem::path{model.string() + ".data"};
+    for (auto const& file : {model, data}) {
+        auto error = std::error_code{};
+        auto const size = std::filesystem::file_size(file, error);
+        if (error)
+            continue;  // No external weights
+
+        auto const canonical = std::filesystem::weakly_canonical(file, error);
+        auto const modified = std::filesystem::last_write_time(file, error).time_since_epoch().count();
+        seed = fnv1a::hash(std::format("{}|{}|{}", canonical.string(), size, modified), seed);
+    }
+    return seed;
+}
+
+// Cache file for a model, named by a key over everything that affects the optimised graph:
+// the model files, the ONNX Runtime version, the execution provider and the optimisation level
+std::filesystem::path optimised_model_path(
+    std::string_view model_path,
+    std::filesystem::path const& cache_dir,
+    ExecutionProvider provider
+) {
+    auto key = fnv1a::hash(Ort::GetVersionString());
+    key = fnv1a::hash(ort_provider_name(provider), key);
+    key = fnv1a::hash(std::format("{}", static_cast<int>(graph_optimization_level)), key);
+    key = model_files_key(model_path, key);
+
+    return cache_dir / std::format("{}-{:016x}.ort", std::filesystem::path{model_path}.stem().string(), key);
+}
+
+// Pinning runs one intra-op thread per listed CPU
+std::size_t intra_op_thread_count(ModelOptions const& options) {
+    return options.cpu_affinity.empty() ? options.intra_op_threads : options.cpu_affinity.size();
+}
+
+// ONNX Runtime affinity string: one 1-based processor id per pool thread, separated by ';'
+// The thread calling Session::Run counts towards the intra-op threads but is managed by
+// the caller, so the pool threads take every CPU after the first
+std::string thread_affinities(std::span<std::size_t const> cpus) {
+    auto affinities = std::string{};
+    for (auto const cpu : cpus.subspan(std::min(cpus.size(), 1uz)))
+        affinities += std::format("{}{}", affinities.empty() ? "" : ";", cpu + 1uz);
+    return affinities;
+}
+
+// ONNX Runtime allows one environment per process, so every model shares it
+struct Environment {
+    std::shared_ptr<Ort::Env> env;
+    bool shared_pools;  // Environment owns global intra/inter-op pools
+};
+
+// The first model to create the environment decides whether it has global thread pools
+Environment acquire_environment(ModelOptions const& options) {
+    static auto mutex = std::mutex{};
+    static auto current = std::weak_ptr<Ort::Env>{};
+    static auto shared_pools = false;
+
+    auto const lock = std::lock_guard{mutex};
+    if (auto env = current.lock())
+        return {std::move(env), shared_pools};
+
+    auto env = std::shared_ptr<Ort::Env>{};
+    if (options.shared_thread_pool) {
+        auto threading = Ort::ThreadingOptions{};
+        threading.SetGlobalIntraOpNumThreads(static_cast<int>(intra_op_thread_count(options)));
+        threading.SetGlobalInterOpNumThreads(static_cast<int>(options.inter_op_threads));
+        threading.SetGlobalSpinControl(options.spin_wait ? 1 : 0);
+        if (auto const affinities = thread_affinities(options.cpu_affinity); !affinities.empty())
+            Ort::ThrowOnError(Ort::GetApi().SetGlobalIntraOpThreadAffinity(threading, affinities.c_str()));
+
+        env = std::make_shared<Ort::Env>(threading, ORT_LOGGING_LEVEL_WARNING, "stems");
+    } else {
+        env = std::make_shared<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "stems");
+    }
+
+    current = env;
+    shared_pools = options.shared_thread_pool;
+    return {std::move(env), shared_pools};
+}
+
+// Thread pools, execution mode and spinning for one session
+void configure_threads(Ort::SessionOptions& session_options, ModelOptions const& options) {
+    session_options.SetExecutionMode(options.parallel_execution ? ORT_PARALLEL : ORT_SEQUENTIAL);
+
+    // Pool sizes, spinning and affinity then come from the environment
+    if (options.shared_thread_pool) {
+        session_options.DisablePerSessionThreads();
+        return;
+    }
+
+    session_options.SetIntraOpNumThreads(static_cast<int>(intra_op_thread_count(options))); // 0 = all cores
+    session_options.SetInterOpNumThreads(static_cast<int>(options.inter_op_threads));
+
+    if (!options.spin_wait) {
+        session_options.AddConfigEntry("session.intra_op.allow_spinning", "0");
+        session_options.AddConfigEntry("session.inter_op.allow_spinning", "0");
+    }
+
+    if (auto const affinities = thread_affinities(options.cpu_affinity); !affinities.empty())
+        session_options.AddConfigEntry("session.intra_op_thread_affinities", affinities.c_str());
+}
+
+Ort::SessionOptions make_session_options(ModelOptions const& options, ExecutionProvider provider) {
+    auto session_options = Ort::SessionOptions{};
+    configure_threads(session_options, options);
+    session_options.SetGraphOptimizationLevel(graph_optimization_level);
+    if (!options.profile_prefix.empty())
+        session_options.EnableProfiling(options.profile_prefix.c_str());
+
+    // Nodes the provider can't run fall back to the CPU provider within the same session
+    switch (provider) {
+        case ExecutionProvider::Cuda: {
+            auto cuda_options = OrtCUDAProviderOptions{};
+            cuda_options.device_id = 0;
+            session_options.AppendExecutionProvider_CUDA(cuda_options);
+            break;
+        }
+        case ExecutionProvider::TensorRt: {
+            // Building TensorRT engines takes minutes, so they are cached next to the graphs
+            auto const engine_dir = options.cache_dir.empty() ? std::string{} : (options.cache_dir / "tensorrt").string();
+            auto tensorrt_options = OrtTensorRTProviderOptions{};
+            tensorrt_options.device_id = 0;
+            if (!engine_dir.empty()) {
+                tensorrt_options.trt_engine_cache_enable = 1;
+                tensorrt_options.trt_engine_cache_path = engine_dir.c_str();
+            }
+            session_options.AppendExecutionProvider_TensorRT(tensorrt_options);
+
+            // Subgraphs TensorRT rejects run on CUDA rather than CPU
+            session_options.AppendExecutionProvider_CUDA(OrtCUDAProviderOptions{});
+            break;
+        }
+        case ExecutionProvider::CoreMl:
+            session_options.AppendExecutionProvider("CoreML");
+            break;
+        case ExecutionProvider::Auto:
+        case ExecutionProvider::Cpu:
+            break;
+    }
+
+    return session_options;
+}
+
+// Session over a cached ORT-format model, reading graph and weights straight from the mapping
+std::shared_ptr<Ort::Session> load_cached_session(
+    Ort::Env& env,
+    ModelOptions const& options,
+    ExecutionProvider provider,
+    MappedFile const& cached
+) {
+    auto session_options = make_session_options(options, provider);
+    session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+    session_options.AddConfigEntry("session.load_model_format", "ORT");
+    session_options.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+    session_options.AddConfigEntry("session.use_ort_model_bytes_for_initializers", "1");
+
+    auto const bytes = cached.bytes();
+    return std::make_shared<Ort::Session>(env, bytes.data(), bytes.size(), session_options);
+}
+
+// Session from the original model, optimising the graph and saving it to the cache when enabled
+std::shared_ptr<Ort::Session> load_session(
+    Ort::Env& env,
+    std::string_view model_path,
+    ModelOptions const& options,
+    ExecutionProvider provider,
+    std::filesystem::path const& cache_path
+) {
+    auto session_options = make_session_options(options, provider);
+    auto error = std::error_code{};
+    auto const caching = !cache_path.empty()
+        and (std::filesystem::create_directories(cache_path.parent_path(), error), !error);
+
+    // Written under a temporary name so concurrent loads never see a partial file
+    auto const temp_path = std::filesystem::path{cache_path.string() + std::format(".{}.tmp", ::getpid())};
+    if (caching) {
+        session_options.AddConfigEntry("session.save_model_format", "ORT");
+        session_options.SetOptimizedModelFilePath(temp_path.c_str());
+    }
+
+    auto session = std::shared_ptr<Ort::Session>{};
+    try {
+        session = std::make_shared<Ort::Session>(env, model_path.data(), session_options);
+    } catch (...) {
+        // A failed load may have written part of the optimised model; the caller reports the error
+        if (caching)
+            std::filesystem::remove(temp_path, error);
+        throw;
+    }
+
+    if (caching) {
+        std::filesystem::rename(temp_path, cache_path, error);
+        if (error) {
+            std::println(stderr, "Could not cache optimised model: {}", error.message());
+            std::filesystem::remove(temp_path, error);
+        } else {
+            std::println("  Cached optimised model: {}", cache_path.string());
+        }
+    }
+
+    return session;
+}
+
+// A session and the cached model bytes it reads in place (if any)
+struct LoadedSession {
+    std::shared_ptr<MappedFile const> model_bytes;
+    std::shared_ptr<Ort::Session> session;
+};
+
+// Create a session on one provider, preferring the optimised cache, which skips
+// graph optimisation entirely. Throws Ort::Exception if the provider can't be used
+LoadedSession open_session(
+    Ort::Env& env,
+    std::string_view model_path,
+    ModelOptions const& options,
+    ExecutionProvider provider
+) {
+    auto const cache_path = options.cache_dir.empty() or !supports_graph_cache(provider)
+        ? std::filesystem::path{}
+        : optimised_model_path(model_path, options.cache_dir, provider);
+
+    if (auto cached = cache_path.empty() ? std::nullopt : MappedFile::open(cache_path)) {
+        try {
+            auto model_bytes = std::make_shared<MappedFile const>(std::move(*cached));
+            auto session = load_cached_session(env, options, provider, *model_bytes);
+            std::println("  Using optimised model cache: {}", cache_path.string());
+            return {std::move(model_bytes), std::move(session)};
+        } catch (Ort::Exception const& e) {
+            // Stale or corrupt, rebuild it from the original model
+            std::println(stderr, "Ignoring unusable model cache {}: {}", cache_path.string(), e.what());
+            auto error = std::error_code{};
+            std::filesystem::remove(cache_path, error);
+        }
+    }
+
+    return {nullptr, load_session(env, model_path, options, provider, cache_path)};
+}
+
+// Page-locked host allocator from the CUDA provider, or null if the session can't supply one
+std::shared_ptr<Ort::Allocator> make_pinned_allocator(Ort::Session const& session) {
+    try {
+        auto const memory_info = Ort::MemoryInfo{"CudaPinned", OrtDeviceAllocator, 0, OrtMemTypeCPUOutput};
+        return std::make_shared<Ort::Allocator>(session, memory_info);
+    } catch (Ort::Exception const& e) {
+        std::println(stderr, "Pinned host memory unavailable, using pageable buffers: {}", e.what());
+        return nullptr;
+    }
+}
+
+// Identify the model outputs by rank:
+//   [batch, stems, channels, time]         time-domain waveforms (what we want)
+//   [batch, stems, channels, freq, frames] frequency-branch spectrograms
+// Exports made with --waveform-only have no spectrogram output at all
+std::expected<ModelIo, ModelError> find_model_io(Ort::Session const& session) {
+    auto allocator = Ort::AllocatorWithDefaultOptions{};
+    auto io = ModelIo{
+        .waveform_output = {},
+        .max_batch_size = 1uz,
+        .chunk_size = std::nullopt,
+        .num_stems = 0uz,
+        .has_spectrogram_output = false,
+        .half_io = false,
+        .precision = ModelPrecision::Fp32
+    };
+    auto output_type = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+
+    for (auto i = 0uz; i < session.GetOutputCount(); ++i) {
+        auto const name = session.GetOutputNameAllocated(i, allocator);
+        auto const info = session.GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo();
+        auto const shape = info.GetShape();
+
+        if (shape.size() == 4 and io.waveform_output.empty()) {
+            io.waveform_output = name.get();
+            io.num_stems = shape[1] > 0 ? static_cast<std::size_t>(shape[1]) : 0uz;
+            output_type = info.GetElementType();
+        } else if (shape.size() == 5) {
+            io.has_spectrogram_output = true;
+        }
+    }
+
+    if (io.waveform_output.empty()) {
+        std::println(stderr, "Model has no [batch, stems, channels, time] waveform output");
+        return std::unexpected(ModelError::InvalidModel);
+    }
+
+    // Output buffers are preallocated, so the stem count must be fixed in the export
+    if (io.num_stems != 4 and io.num_stems != 6) {
+        std::println(stderr, "Unexpected number of stems: {} (expected 4 or 6)", io.num_stems);
+        return std::unexpected(ModelError::InvalidModel);
+    }
+
+    // A batch axis exported as dynamic reports -1, otherwise it is fixed
+    auto const input_shape = session.GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+    io.max_batch_size = input_shape.empty() or input_shape[0] < 0
+        ? std::numeric_limits<std::size_t>::max()
+        : static_cast<std::size_t>(input_shape[0]);
+
+    // Waveform input [batch, 2, time]: likewise -1 when the time axis is dynamic
+    if (input_shape.size() == 3uz and input_shape[2] > 0)
+        io.chunk_size = static_cast<std::size_t>(input_shape[2]);
+
+    // FP16 exports without kept I/O types take and return half tensors, which are
+    // converted at the boundary; quantised exports keep float I/O
+    auto const waveform_type = session.GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetElementType();
+    auto const spectrogram_type = session.GetInputTypeInfo(1).GetTensorTypeAndShapeInfo().GetElementType();
+    if (waveform_type != spectrogram_type or waveform_type != output_type
+        or (output_type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT and output_type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16)) {
+        std::println(stderr, "Model inputs and output must all be float32 or all float16");
+        return std::unexpected(ModelError::InvalidModel);
+    }
+    io.half_io = output_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+
+    // Weight precision isn't visible through the session, so the converter records it
+    auto const metadata = session.GetModelMetadata().LookupCustomMetadataMapAllocated("precision", allocator);
+    auto const recorded = metadata ? parse_precision(metadata.get()) : std::nullopt;
+    io.precision = recorded.value_or(io.half_io ? ModelPrecision::Fp16 : ModelPrecision::Fp32);
+
+    return io;
+}
+
+// Page-locked when an allocator is given, aligned pageable host memory otherwise
+template <typename T>
+TensorBuffer<T> make_tensor_buffer(std::shared_ptr<Ort::Allocator> const& pinned, std::size_t size) {
+    return pinned ? TensorBuffer<T>{pinned, size} : TensorBuffer<T>{size};
+}
+
+// Tensor over a bound buffer of floats or FP16 bit patterns, `count` elements long
+template <typename T>
+Ort::Value bound_tensor(
+    Ort::MemoryInfo const& memory_info,
+    TensorBuffer<T>& buffer,
+    std::size_t count,
+    std::span<int64_t const> shape
+) {
+    constexpr auto element_type = std::is_same_v<T, float>
+        ? ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT
+        : ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+    return Ort::Value::CreateTensor(memory_info, buffer.data(), count * sizeof(T),
+                                    shape.data(), shape.size(), element_type);
+}
+
+// Precisions whose kernels the provider doesn't accelerate still run, but slowly
+void warn_precision_mismatch(ModelPrecision precision, ExecutionProvider provider) {
+    if (precision == ModelPrecision::Fp16 and provider == ExecutionProvider::Cpu)
+        std::println(stderr, "FP16 models are meant for GPU providers; on CPU most kernels run "
+                             "through float conversions (use an FP32 or INT8 model)");
+    if (precision == ModelPrecision::Int8 and provider != ExecutionProvider::Cpu)
+        std::println(stderr, "INT8 models are quantised for the CPU provider; {} runs the "
+                             "quantised nodes on CPU (use an FP16 model)", ort_provider_name(provider));
+}
+
 } // anonymous namespace
 
+std::filesystem::path default_cache_dir() {
+    if (auto const* cache_home = std::getenv("XDG_CACHE_HOME"); cache_home and *cache_home)
+        return std::filesystem::path{cache_home} / "stems";
+    if (auto const* home = std::getenv("HOME"); home and *home)
+        return std::filesystem::path{home} / ".cache" / "stems";
+    return {};
+}
+
 OnnxModel::OnnxModel(
-    std::unique_ptr<Ort::Env> env,
-    std::unique_ptr<Ort::Session> session,
-    std::string path
+    std::shared_ptr<Ort::Env> env,
+    std::shared_ptr<MappedFile const> model_bytes,
+    std::shared_ptr<Ort::Session> session,
+    std::string path,
+    ModelIo io,
+    ExecutionProvider provider
 ) : env_(std::move(env)),
+    model_bytes_(std::move(model_bytes)),
     session_(std::move(session)),
-    model_path_(std::move(path)) {}
+    model_path_(std::move(path)),
+    io_(std::move(io)),
+    provider_(provider) {}
 
-std::expected<OnnxModel, ModelError> OnnxModel::load(std::string_view model_path) {
+std::expected<OnnxModel, ModelError> OnnxModel::load(std::string_view model_path, ModelOptions options) {
     // Validate model file exists and has reasonable size
     if (auto const validation = validate_model_file(model_path); !validation)
         return std::unexpected(validation.error());
 
     try {
-        // Create ONNX Runtime environment
-        auto env = std::make_unique<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "stems");
-
-        // Configure session options
-        Ort::SessionOptions session_options;
-        session_options.SetIntraOpNumThreads(0); // Use all available threads
-        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
-
-        // Load model
-        auto session = std::make_unique<Ort::Session>(
-            *env,
-            model_path.data(),
-            session_options
-        );
+        // Shared ONNX Runtime environment; sessions only use its pools if it has them
+        auto [env, shared_pools] = acquire_environment(options);
+        if (options.shared_thread_pool and !shared_pools)
+            std::println(stderr, "ONNX Runtime environment was created without shared thread pools, "
+                                 "using per-session threads");
+        options.shared_thread_pool = options.shared_thread_pool and shared_pools;
+
+        // Try the requested provider, falling back to CPU if it is missing or fails
+        auto loaded = LoadedSession{};
+        auto provider = ExecutionProvider::Cpu;
+        for (auto const candidate : provider_candidates(options.provider)) {
+            if (candidate != ExecutionProvider::Cpu and !provider_available(candidate)) {
+                if (options.provider != ExecutionProvider::Auto)
+                    std::println(stderr, "{} is not available in this ONNX Runtime build, falling back to CPU",
+                                 ort_provider_name(candidate));
+                continue;
+            }
+
+            try {
+                loaded = open_session(*env, model_path, options, candidate);
+                provider = candidate;
+                break;
+            } catch (Ort::Exception const& e) {
+                if (candidate == ExecutionProvider::Cpu)
+                    throw;
+                std::println(stderr, "{} failed to initialise ({}), trying next provider",
+                             ort_provider_name(candidate), e.what());
+            }
+        }
+
+        auto& session = loaded.session;
 
         // Verify model loaded successfully
         auto const num_inputs = session->GetInputCount();
         auto const num_outputs = session->GetOutputCount();
 
+        if (num_inputs != 2)
+            return std::unexpected(ModelError::InvalidModel);
+
+        // Only the time-domain waveform is read, so locate it and skip the rest
+        auto io = find_model_io(*session);
+        if (!io)
+            return std::unexpected(io.error());
+
         std::println("Model loaded successfully:");
         std::println("  Inputs: {}", num_inputs);
         std::println("  Outputs: {}", num_outputs);
-
-        return OnnxModel(
+        std::println("  Waveform output: {}{}", io->waveform_output,
+                     io->has_spectrogram_output ? " (spectrogram output skipped)" : "");
+        std::println("  Execution provider: {}", ort_provider_name(provider));
+        std::println("  Threads: {} intra-op{}{}{}{}",
+                     intra_op_thread_count(options) == 0uz ? std::string{"all cores"}
+                                                           : std::format("{}", intra_op_thread_count(options)),
+                     options.cpu_affinity.empty() ? "" : " (pinned)",
+                     options.parallel_execution ? ", parallel execution" : "",
+                     options.spin_wait ? "" : ", no spinning",
+                     options.shared_thread_pool ? ", shared pools" : "");
+        std::println("  Precision: {}{}", precision_name(io->precision),
+                     io->half_io ? " (FP16 tensors, converted at the boundary)" : "");
+        warn_precision_mismatch(io->precision, provider);
+        std::println("  Stems: {}", io->num_stems);
+        std::println("  Batch axis: {}", io->max_batch_size == std::numeric_limits<std::size_t>::max()
+            ? std::string{"dynamic"}
+            : std::format("fixed ({})", io->max_batch_size));
+        std::println("  Time axis: {}", io->chunk_size
+            ? std::format("fixed ({} samples)", *io->chunk_size)
+            : std::string{"dynamic"});
+
+        auto model = OnnxModel(
             std::move(env),
+            std::move(loaded.model_bytes),
             std::move(session),
-            std::string{model_path}
+            std::string{model_path},
+            std::move(*io),
+            provider
         );
 
+        // Tensors in page-locked memory let the device copy them by DMA
+        if (uses_cuda(provider))
+            model.pinned_allocator_ = make_pinned_allocator(*model.session_);
+
+        model.profiling_ = !options.profile_prefix.empty();
+
+        // Providers round differently, so their outputs are told apart
+        model.identity_ = model_files_key(model_path, fnv1a::hash(ort_provider_name(provider),
+                                                                   fnv1a::hash(precision_name(model.io_.precision))));
+        return model;
+
     } catch (Ort::Exception const& e) {
         std::println(stderr, "ONNX Runtime error: {}", e.what());
         return std::unexpected(ModelError::LoadFailed);
@@ -89,182 +579,162 @@ std::expected<OnnxModel, ModelError> OnnxModel::load(std::string_view model_path
     }
 }
 
-std::expected<std::vector<Spectrogram>, ModelError> OnnxModel::infer(
-    std::vector<float> const& audio_left,
-    std::vector<float> const& audio_right,
-    Spectrogram const& spec_left,
-    Spectrogram const& spec_right
-) {
-    try {
-        // Demucs htdemucs model expects dual inputs:
-        // 1. Time-domain waveform: [batch, channels, time]
-        // 2. Spectrogram: [batch, channels, freq, time] with complex-as-channels
-
-        auto const num_samples = audio_left.size();
-        auto const num_frames = spec_left.num_frames;
-        auto const num_bins = spec_left.num_bins;
-
-        std::println("Preparing ONNX tensors:");
-        std::println("  Time-domain: [1, 2, {}]", num_samples);
-        std::println("  Spectrogram: [1, 2, {}, {}]", num_bins, num_frames);
-
-        // Prepare time-domain input tensor [1, 2, time]
-        // Interleave left and right channels
-        auto waveform_data = std::vector<float>(2 * num_samples);
-        for (auto i = 0uz; i < num_samples; ++i) {
-            waveform_data[i] = audio_left[i];                    // Channel 0 (left)
-            waveform_data[num_samples + i] = audio_right[i];     // Channel 1 (right)
-        }
-
-        auto const waveform_shape = std::array<int64_t, 3>{1, 2, static_cast<int64_t>(num_samples)};
-        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault);
-
-        auto waveform_tensor = Ort::Value::CreateTensor<float>(
-            memory_info,
-            waveform_data.data(),
-            waveform_data.size(),
-            waveform_shape.data(),
-            waveform_shape.size()
-        );
-
-        // Prepare spectrogram input tensor [1, 4, freq, time]
-        // Complex-as-channels: real_left, imag_left, real_right, imag_right
-        auto const spec_size = num_bins * num_frames;
-
-        // Verify input spectrogram sizes match expected dimensions
-        if (spec_left.real.size() != spec_size or spec_left.imag.size() != spec_size or
-            spec_right.real.size() != spec_size or spec_right.imag.size() != spec_size) {
-            std::println(stderr, "Spectrogram size mismatch!");
-            return std::unexpected(ModelError::InferenceFailed);
-        }
-
-        auto spectrogram_data = std::vector<float>(4 * spec_size);
+ModelTensors::ModelTensors(
+    std::size_t capacity,
+    std::size_t num_samples,
+    std::size_t num_frames,
+    std::size_t num_stems,
+    bool half_io,
+    std::shared_ptr<Ort::Allocator> pinned
+) : capacity_(capacity),
+    num_samples_(num_samples),
+    num_frames_(num_frames),
+    num_stems_(num_stems),
+    half_io_(half_io),
+    pinned_(pinned != nullptr) {
+    auto const waveform_size = capacity * 2uz * num_samples;
+    auto const spectrogram_size = capacity * NumPlanes * stft_params::num_bins * num_frames;
+    auto const output_size = capacity * num_stems * 2uz * num_samples;
+
+    // Only the bound buffers are worth pinning; float staging stays pageable
+    auto const float_pinned = half_io ? nullptr : pinned;
+    waveform_ = make_tensor_buffer<float>(float_pinned, waveform_size);
+    spectrogram_ = make_tensor_buffer<float>(float_pinned, spectrogram_size);
+    output_ = make_tensor_buffer<float>(float_pinned, output_size);
+
+    if (half_io) {
+        half_waveform_ = make_tensor_buffer<std::uint16_t>(pinned, waveform_size);
+        half_spectrogram_ = make_tensor_buffer<std::uint16_t>(pinned, spectrogram_size);
+        half_output_ = make_tensor_buffer<std::uint16_t>(pinned, output_size);
+    }
+}
 
-        // Channel 0: real components (left)
-        std::copy(spec_left.real.begin(), spec_left.real.end(),
-                  spectrogram_data.begin());
+std::span<float> ModelTensors::waveform(std::size_t batch_idx, std::size_t channel) {
+    return waveform_.span().subspan((batch_idx * 2uz + channel) * num_samples_, num_samples_);
+}
 
-        // Channel 1: imaginary components (left)
-        std::copy(spec_left.imag.begin(), spec_left.imag.end(),
-                  spectrogram_data.begin() + spec_size);
+std::span<float> ModelTensors::spectrogram(std::size_t batch_idx, Plane plane) {
+    auto const plane_size = stft_params::num_bins * num_frames_;
+    return spectrogram_.span().subspan((batch_idx * NumPlanes + plane) * plane_size, plane_size);
+}
 
-        // Channel 2: real components (right)
-        std::copy(spec_right.real.begin(), spec_right.real.end(),
-                  spectrogram_data.begin() + 2 * spec_size);
+std::span<float> ModelTensors::spectrogram(std::size_t batch_idx) {
+    auto const entry_size = NumPlanes * stft_params::num_bins * num_frames_;
+    return spectrogram_.span().subspan(batch_idx * entry_size, entry_size);
+}
 
-        // Channel 3: imaginary components (right)
-        std::copy(spec_right.imag.begin(), spec_right.imag.end(),
-                  spectrogram_data.begin() + 3 * spec_size);
+StemAudioView ModelTensors::output(std::size_t batch_idx) const {
+    auto const entry_size = num_stems_ * 2uz * num_samples_;
+    return {output_.data() + batch_idx * entry_size, num_stems_, 2uz, num_samples_};
+}
 
-        auto const spec_shape = std::array<int64_t, 4>{
-            1, 4,
-            static_cast<int64_t>(num_bins),
-            static_cast<int64_t>(num_frames)
-        };
+void ModelTensors::copy_inputs(ModelTensors const& from, std::size_t batch_size) {
+    auto const waveform_count = batch_size * 2uz * num_samples_;
+    auto const spectrogram_count = batch_size * NumPlanes * stft_params::num_bins * num_frames_;
+    std::ranges::copy(from.waveform_.span().first(waveform_count), waveform_.data());
+    std::ranges::copy(from.spectrogram_.span().first(spectrogram_count), spectrogram_.data());
+}
 
-        auto spectrogram_tensor = Ort::Value::CreateTensor<float>(
-            memory_info,
-            spectrogram_data.data(),
-            spectrogram_data.size(),
-            spec_shape.data(),
-            spec_shape.size()
-        );
+std::expected<ModelTensors, ModelError> OnnxModel::allocate_tensors(
+    std::size_t capacity,
+    std::size_t num_samples
+) const {
+    if (capacity == 0 or capacity > io_.max_batch_size) {
+        std::println(stderr, "Invalid batch size {} (model accepts up to {})",
+                     capacity, io_.max_batch_size);
+        return std::unexpected(ModelError::InferenceFailed);
+    }
 
-        // Prepare input/output names (must match ONNX model's actual names)
-        auto const input_names = std::array{
-            "input",  // Time-domain waveform input
-            "x"       // Spectrogram input
-        };
-
-        auto const output_names = std::array{
-            "output",   // Primary output (spectrograms for all 4 stems)
-            "add_67"    // Secondary output (time-domain waveforms)
-        };
-
-        // Prepare input tensor array
-        auto input_tensors = std::vector<Ort::Value>{};
-        input_tensors.push_back(std::move(waveform_tensor));
-        input_tensors.push_back(std::move(spectrogram_tensor));
-
-        std::println("Running ONNX inference...");
-
-        // Run inference
-        auto output_tensors = session_->Run(
-            Ort::RunOptions{nullptr},
-            input_names.data(),
-            input_tensors.data(),
-            input_tensors.size(),
-            output_names.data(),
-            output_names.size()
-        );
+    auto const num_frames = StftProcessor::num_frames(num_samples);
+    if (num_frames == 0uz)
+        return std::unexpected(ModelError::InferenceFailed);
 
-        std::println("Inference complete, got {} output tensors", output_tensors.size());
+    try {
+        return ModelTensors{capacity, num_samples, num_frames, io_.num_stems, io_.half_io, pinned_allocator_};
+    } catch (Ort::Exception const& e) {
+        std::println(stderr, "Tensor allocation failed: {}", e.what());
+        return std::unexpected(ModelError::InferenceFailed);
+    }
+}
 
-        // The model outputs TWO tensors:
-        // output_tensors[0] = "output" [1, 4, 4, 2048, 336] - spectrogram outputs
-        // output_tensors[1] = "add_67" [1, 4, 2, 343980] - time-domain waveforms (what we want!)
-        //
-        // We use the time-domain output directly to avoid iSTFT conversion
-        // Shape: [batch=1, stems=4, channels=2, samples=343980]
+void OnnxModel::bind(ModelTensors& tensors, std::size_t batch_size) const {
+    auto const memory_info = tensors.pinned_
+        ? Ort::MemoryInfo{"CudaPinned", OrtDeviceAllocator, 0, OrtMemTypeCPUOutput}
+        : Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault);
+    tensors.bound_batch_size_ = 0uz;
+
+    auto const batch = static_cast<int64_t>(batch_size);
+    auto const num_samples = static_cast<int64_t>(tensors.num_samples_);
+    auto const num_stems = static_cast<int64_t>(tensors.num_stems_);
+
+    auto const waveform_count = batch_size * 2uz * tensors.num_samples_;
+    auto const spectrogram_count = batch_size * ModelTensors::NumPlanes * stft_params::num_bins * tensors.num_frames_;
+    auto const output_count = batch_size * tensors.num_stems_ * 2uz * tensors.num_samples_;
+
+    // FP16 models bind the half-precision copies of each buffer
+    auto const make_tensor = [&](TensorBuffer<float>& buffer, TensorBuffer<std::uint16_t>& half,
+                                 std::size_t count, std::span<int64_t const> shape) {
+        return tensors.half_io_ ? bound_tensor(memory_info, half, count, shape)
+                                : bound_tensor(memory_info, buffer, count, shape);
+    };
+
+    // Time-domain input [N, 2, time]
+    auto const waveform_shape = std::array<int64_t, 3>{batch, 2, num_samples};
+    auto const waveform_tensor = make_tensor(tensors.waveform_, tensors.half_waveform_, waveform_count, waveform_shape);
+
+    // Spectrogram input [N, 4, freq, time]
+    // Complex-as-channels: real_left, imag_left, real_right, imag_right
+    auto const spec_shape = std::array<int64_t, 4>{
+        batch,
+        static_cast<int64_t>(ModelTensors::NumPlanes),
+        static_cast<int64_t>(stft_params::num_bins),
+        static_cast<int64_t>(tensors.num_frames_)
+    };
+    auto const spectrogram_tensor =
+        make_tensor(tensors.spectrogram_, tensors.half_spectrogram_, spectrogram_count, spec_shape);
+
+    // Time-domain output [N, stems, 2, time], written in place by Session::Run
+    auto const output_shape = std::array<int64_t, 4>{batch, num_stems, 2, num_samples};
+    auto const output_tensor = make_tensor(tensors.output_, tensors.half_output_, output_count, output_shape);
+
+    // Input names must match the ONNX model's actual names
+    tensors.binding_ = std::make_unique<Ort::IoBinding>(*session_);
+    tensors.binding_->BindInput("input", waveform_tensor);  // Time-domain waveform input
+    tensors.binding_->BindInput("x", spectrogram_tensor);   // Spectrogram input
+
+    // Only the time-domain waveforms ("add_67" in htdemucs exports) are bound
+    // The spectrogram output ([N, 4, 4, 2048, 336], ~44 MB per chunk) is never read
+    tensors.binding_->BindOutput(io_.waveform_output.c_str(), output_tensor);
+    tensors.bound_batch_size_ = batch_size;
+}
 
-        if (output_tensors.size() < 2) {
-            std::println(stderr, "Expected 2 output tensors, got {}", output_tensors.size());
-            return std::unexpected(ModelError::InferenceFailed);
-        }
+std::expected<void, ModelError> OnnxModel::infer(ModelTensors& tensors, std::size_t batch_size) const {
+    if (batch_size == 0 or batch_size > tensors.capacity_) {
+        std::println(stderr, "Invalid batch size {} (tensors hold up to {})",
+                     batch_size, tensors.capacity_);
+        return std::unexpected(ModelError::InferenceFailed);
+    }
 
-        // Get the time-domain output (add_67)
-        auto& time_domain_output = output_tensors[1];
-        auto* data = time_domain_output.GetTensorMutableData<float>();
-        auto const shape_info = time_domain_output.GetTensorTypeAndShapeInfo();
-        auto const shape = shape_info.GetShape();
-
-        // Verify shape: [batch, stems, channels, samples]
-        // Expect shape[0]=1 (batch), shape[1]=4 or 6 (stems), shape[2]=2 (stereo), shape[3]=samples
-        if (shape.size() != 4 or shape[0] != 1 or shape[2] != 2) {
-            std::println(stderr, "Unexpected time-domain output shape: [{}, {}, {}, {}]",
-                         shape.size() > 0 ? shape[0] : 0,
-                         shape.size() > 1 ? shape[1] : 0,
-                         shape.size() > 2 ? shape[2] : 0,
-                         shape.size() > 3 ? shape[3] : 0);
-            return std::unexpected(ModelError::InferenceFailed);
+    try {
+        // Tensors only need rebuilding when the active batch size changes
+        if (!tensors.binding_ or tensors.bound_batch_size_ != batch_size)
+            bind(tensors, batch_size);
+
+        // FP16 models: convert the active entries at the tensor boundary
+        auto const waveform_count = batch_size * 2uz * tensors.num_samples_;
+        auto const spectrogram_count = batch_size * ModelTensors::NumPlanes * stft_params::num_bins * tensors.num_frames_;
+        auto const output_count = batch_size * tensors.num_stems_ * 2uz * tensors.num_samples_;
+        if (tensors.half_io_) {
+            simd::to_half(tensors.half_waveform_.span().first(waveform_count), tensors.waveform_.span());
+            simd::to_half(tensors.half_spectrogram_.span().first(spectrogram_count), tensors.spectrogram_.span());
         }
 
-        auto const num_stems = static_cast<std::size_t>(shape[1]);
+        session_->Run(Ort::RunOptions{nullptr}, *tensors.binding_);
 
-        // Validate number of stems (4 or 6)
-        if (num_stems != 4 and num_stems != 6) {
-            std::println(stderr, "Unexpected number of stems: {} (expected 4 or 6)", num_stems);
-            return std::unexpected(ModelError::InferenceFailed);
-        }
-        auto const num_channels = static_cast<std::size_t>(shape[2]);
-        auto const samples_per_stem = static_cast<std::size_t>(shape[3]);
-
-        std::println("Extracted {} stems with {} channels, {} samples each",
-                     num_stems, num_channels, samples_per_stem);
-
-        // For now, convert to "fake" spectrograms just to match the interface
-        // TODO: Change interface to return time-domain audio directly
-        auto result = std::vector<Spectrogram>{};
-        result.reserve(num_stems);
-
-        for (auto stem_idx = 0uz; stem_idx < num_stems; ++stem_idx) {
-            // Extract left channel for this stem and store as "real" component
-            // Shape indexing: data[batch * (stems * channels * samples) + stem * (channels * samples) + channel * samples + sample]
-            auto const stem_offset = stem_idx * num_channels * samples_per_stem;
-            auto const left_offset = stem_offset + 0 * samples_per_stem;  // Channel 0 (left)
-
-            // Store time-domain audio in the real component (misuse of Spectrogram structure)
-            auto stem_spec = Spectrogram{
-                .real = std::vector<float>(data + left_offset, data + left_offset + samples_per_stem),
-                .imag = std::vector<float>(samples_per_stem, 0.0f),  // Unused
-                .num_frames = 1,  // Dummy value
-                .num_bins = samples_per_stem  // Store sample count here (hack)
-            };
-
-            result.push_back(std::move(stem_spec));
-        }
+        if (tensors.half_io_)
+            simd::from_half(tensors.output_.span().first(output_count), tensors.half_output_.span());
 
-        return result;
+        return {};
 
     } catch (Ort::Exception const& e) {
         std::println(stderr, "ONNX inference error: {}", e.what());
@@ -275,4 +745,20 @@ std::expected<std::vector<Spectrogram>, ModelError> OnnxModel::infer(
     }
 }
 
+std::optional<OrtProfile> OnnxModel::end_profiling() const {
+    if (!profiling_)
+        return std::nullopt;
+
+    try {
+        auto allocator = Ort::AllocatorWithDefaultOptions{};
+        auto const start_ns = session_->GetProfilingStartTimeNs();
+        auto const path = session_->EndProfilingAllocated(allocator);
+        return OrtProfile{.path = path.get(), .start_ns = start_ns};
+
+    } catch (Ort::Exception const& e) {
+        std::println(stderr, "Could not end ONNX Runtime profiling: {}", e.what());
+        return std::nullopt;
+    }
+}
+
 } // namespace stems
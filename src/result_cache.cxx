@@ -0,0 +1,140 @@
+#include "result_cache.h"
+#include "hash.h"
+#include <unistd.h>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <system_error>
+#include <utility>
+
+namespace stems {
+
+namespace {
+
+// Bumped whenever the entry layout or the meaning of a key changes
+constexpr auto entry_magic = std::array{'S', 'T', 'E', 'M', 'R', 'E', 'S', '2'};
+
+// Fixed-size header in front of the samples: the chunk's [2][samples] input, then
+// its [stems][2][samples] output
+struct EntryHeader {
+    std::array<char, 8> magic;
+    std::uint64_t key;
+    std::uint64_t seed;
+    std::uint64_t num_stems;
+    std::uint64_t num_samples;
+    std::array<std::byte, 24> reserved;  // Pads to 64 bytes so the samples stay aligned
+};
+
+static_assert(sizeof(EntryHeader) == 64uz);
+
+// Distinguishes temporary files of concurrent stores within one process
+std::atomic<std::uint64_t> store_counter{0u};
+
+} // anonymous namespace
+
+CachedResult::CachedResult(MappedFile file, std::size_t num_stems, std::size_t num_samples)
+    : file_(std::move(file)), num_stems_(num_stems), num_samples_(num_samples) {}
+
+StemAudioView CachedResult::view() const {
+    auto const* const input = reinterpret_cast<float const*>(file_.bytes().data() + sizeof(EntryHeader));
+    return {input + 2uz * num_samples_, num_stems_, 2uz, num_samples_};
+}
+
+ResultCache::ResultCache(std::filesystem::path dir, std::uint64_t seed, std::size_t num_stems, std::size_t num_samples)
+    : dir_(std::move(dir)), seed_(seed), num_stems_(num_stems), num_samples_(num_samples) {}
+
+std::optional<ResultCache> ResultCache::open(
+    std::filesystem::path const& dir,
+    std::uint64_t model_identity,
+    std::size_t num_stems,
+    std::size_t num_samples
+) {
+    auto error = std::error_code{};
+    std::filesystem::create_directories(dir, error);
+    if (error)
+        return std::nullopt;
+
+    auto const seed = fnv1a::hash(std::format("{:016x}|{}|{}|{}", model_identity, num_stems, num_samples,
+                                              std::string_view{entry_magic.data(), entry_magic.size()}));
+    return ResultCache{dir, seed, num_stems, num_samples};
+}
+
+std::uint64_t ResultCache::key(std::span<float const> waveform) const {
+    return fnv1a::hash(std::as_bytes(waveform), seed_);
+}
+
+std::filesystem::path ResultCache::entry_path(std::uint64_t key) const {
+    return dir_ / std::format("{:016x}.stems", key);
+}
+
+std::optional<CachedResult> ResultCache::load(std::uint64_t key, std::span<float const> waveform) const {
+    auto file = MappedFile::open(entry_path(key));
+    if (!file)
+        return std::nullopt;
+
+    auto const bytes = file->bytes();
+    auto const input_bytes = 2uz * num_samples_ * sizeof(float);
+    auto const sample_bytes = num_stems_ * 2uz * num_samples_ * sizeof(float);
+    if (waveform.size_bytes() != input_bytes or bytes.size() != sizeof(EntryHeader) + input_bytes + sample_bytes)
+        return std::nullopt;
+
+    auto header = EntryHeader{};
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != entry_magic or header.key != key or header.seed != seed_
+        or header.num_stems != num_stems_ or header.num_samples != num_samples_)
+        return std::nullopt;
+
+    // The key is only 64 bits; another chunk's input under it is a collision, not a hit
+    if (std::memcmp(bytes.data() + sizeof(EntryHeader), waveform.data(), input_bytes) != 0)
+        return std::nullopt;
+
+    // Blending reads each sample once, front to back
+    file->advise_sequential();
+    return CachedResult{std::move(*file), num_stems_, num_samples_};
+}
+
+bool ResultCache::store(std::uint64_t key, std::span<float const> waveform, StemAudioView output) const {
+    if (waveform.size() != 2uz * num_samples_ or output.num_stems() != num_stems_ or output.num_channels() != 2uz
+        or output.num_samples() != num_samples_)
+        return false;
+
+    auto const path = entry_path(key);
+    auto const temp_path = std::filesystem::path{
+        std::format("{}.{}.{}.tmp", path.string(), ::getpid(), store_counter++)};
+
+    auto const header = EntryHeader{.magic = entry_magic,
+                                    .key = key,
+                                    .seed = seed_,
+                                    .num_stems = num_stems_,
+                                    .num_samples = num_samples_,
+                                    .reserved = {}};
+    {
+        auto file = std::ofstream{temp_path, std::ios::binary};
+        file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        file.write(reinterpret_cast<char const*>(waveform.data()), static_cast<std::streamsize>(waveform.size_bytes()));
+        for (auto stem = 0uz; stem < num_stems_; ++stem)
+            for (auto channel = 0uz; channel < 2uz; ++channel) {
+                auto const samples = std::as_bytes(output.channel(stem, channel));
+                file.write(reinterpret_cast<char const*>(samples.data()), static_cast<std::streamsize>(samples.size()));
+            }
+
+        file.close();
+        if (!file) {
+            auto error = std::error_code{};
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+    }
+
+    auto error = std::error_code{};
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+    return true;
+}
+
+} // namespace stems
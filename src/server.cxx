@@ -0,0 +1,300 @@
+#include "server.h"
+#include "batch_runner.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace stems {
+
+namespace {
+
+// How often the accept loop checks the stop flag
+constexpr auto accept_poll_ms = 200;
+
+// Clients must send their whole request line this soon after connecting
+constexpr auto request_timeout = std::chrono::seconds{5};
+
+// Owned file descriptor, closed on destruction
+class UniqueFd {
+public:
+    UniqueFd() = default;
+    explicit UniqueFd(int fd) : fd_(fd) {}
+    ~UniqueFd() { reset(); }
+
+    UniqueFd(UniqueFd&& other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+    UniqueFd& operator=(UniqueFd&& other) noexcept {
+        if (this != &other) {
+            reset();
+            fd_ = std::exchange(other.fd_, -1);
+        }
+        return *this;
+    }
+
+    int get() const { return fd_; }
+    explicit operator bool() const { return fd_ >= 0; }
+
+private:
+    void reset() {
+        if (fd_ >= 0)
+            ::close(fd_);
+        fd_ = -1;
+    }
+
+    int fd_ = -1;
+};
+
+// A queued separation request and the connection awaiting its reply
+struct Job {
+    int priority;
+    std::uint64_t sequence;
+    std::filesystem::path input;
+    UniqueFd client;
+};
+
+// Highest priority first, FIFO within a priority
+struct JobOrder {
+    bool operator()(Job const& a, Job const& b) const {
+        return a.priority != b.priority ? a.priority < b.priority : a.sequence > b.sequence;
+    }
+};
+
+// Unbounded blocking priority queue feeding the warm workers
+class JobQueue {
+public:
+    void push(Job job) {
+        auto const lock = std::lock_guard{mutex_};
+        jobs_.push_back(std::move(job));
+        std::ranges::push_heap(jobs_, JobOrder{});
+        not_empty_.notify_one();
+    }
+
+    // Blocks while empty, returns nullopt once closed
+    std::optional<Job> pop() {
+        auto lock = std::unique_lock{mutex_};
+        not_empty_.wait(lock, [this] { return closed_ or !jobs_.empty(); });
+        if (closed_)
+            return std::nullopt;
+
+        std::ranges::pop_heap(jobs_, JobOrder{});
+        auto job = std::move(jobs_.back());
+        jobs_.pop_back();
+        return job;
+    }
+
+    // Stop handing out work and return whatever was still waiting
+    std::vector<Job> close() {
+        auto const lock = std::lock_guard{mutex_};
+        closed_ = true;
+        not_empty_.notify_all();
+        return std::move(jobs_);
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::vector<Job> jobs_;
+    bool closed_ = false;
+};
+
+void send_reply(int fd, std::string_view reply) {
+    while (!reply.empty()) {
+        auto const sent = ::write(fd, reply.data(), reply.size());
+        if (sent <= 0)
+            return;  // Client went away, nothing to report to
+        reply.remove_prefix(static_cast<std::size_t>(sent));
+    }
+}
+
+// A connection whose request line is still arriving
+// The accept loop polls every pending connection alongside the listener, so a slow
+// or idle client only ever holds up its own request
+struct PendingRequest {
+    UniqueFd client;
+    std::chrono::steady_clock::time_point deadline;
+    std::string line{};
+};
+
+enum class ReadState {
+    Partial,   // Nothing more to read yet
+    Complete,  // `line` holds the newline-terminated request
+    Failed     // Closed, errored or too long
+};
+
+// Take whatever has arrived on a pending connection, without blocking
+ReadState read_available(PendingRequest& request) {
+    auto buffer = std::array<char, 512>{};
+    while (true) {
+        auto const received = ::recv(request.client.get(), buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if (received < 0)
+            return errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR ? ReadState::Partial : ReadState::Failed;
+        if (received == 0)
+            return ReadState::Failed;
+
+        auto const searched = request.line.size();
+        request.line.append(buffer.data(), static_cast<std::size_t>(received));
+        if (auto const end = request.line.find('\n', searched); end != std::string::npos) {
+            request.line.resize(end + 1uz);
+            return ReadState::Complete;
+        }
+        if (request.line.size() >= protocol::max_request_size)
+            return ReadState::Failed;
+    }
+}
+
+std::expected<UniqueFd, ServerError> listen_on(std::filesystem::path const& socket_path) {
+    auto address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+
+    auto const path = socket_path.string();
+    if (path.empty() or path.size() >= sizeof(address.sun_path))
+        return std::unexpected(ServerError::BindFailed);
+    std::ranges::copy(path, address.sun_path);
+
+    auto listener = UniqueFd{::socket(AF_UNIX, SOCK_STREAM, 0)};
+    if (!listener)
+        return std::unexpected(ServerError::SocketFailed);
+
+    // Replace a socket left behind by a previous run
+    std::filesystem::remove(socket_path);
+
+    if (::bind(listener.get(), reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0) {
+        std::println(stderr, "bind {}: {}", path, std::strerror(errno));
+        return std::unexpected(ServerError::BindFailed);
+    }
+
+    if (::listen(listener.get(), SOMAXCONN) != 0)
+        return std::unexpected(ServerError::ListenFailed);
+
+    return listener;
+}
+
+} // anonymous namespace
+
+std::expected<void, ServerError> run_server(
+    StemProcessor const& prototype,
+    ServerOptions const& options,
+    std::atomic<bool> const& stop
+) {
+    auto listener = listen_on(options.socket_path);
+    if (!listener)
+        return std::unexpected(listener.error());
+
+    // Copies of the warm processor share its session, STFT plans and DSP pool
+    auto const num_workers = std::max(options.jobs, 1uz);
+    auto processors = std::vector<std::unique_ptr<StemProcessor>>{};
+    for (auto i = 0uz; i < num_workers; ++i)
+        processors.push_back(std::make_unique<StemProcessor>(prototype));
+
+    auto queue = JobQueue{};
+    auto workers = std::vector<std::jthread>{};
+    for (auto& processor : processors) {
+        workers.emplace_back([&queue, &processor = *processor, output_format = options.output_format] {
+            while (auto job = queue.pop()) {
+                std::println("Job {} (priority {}): {}", job->sequence, job->priority, job->input.string());
+                auto const report = separate_file(processor, job->input, output_format);
+
+                if (report.ok())
+                    send_reply(job->client.get(),
+                               std::format("OK {:.3f} {:.3f}\n", report.audio_seconds, report.wall_seconds));
+                else
+                    send_reply(job->client.get(), std::format("ERROR {}\n", report.error));
+
+                std::println("Job {} {}: {:.2f}x realtime", job->sequence,
+                             report.ok() ? "done" : "failed", report.throughput());
+            }
+        });
+    }
+
+    std::println("Listening on {} with {} warm workers", options.socket_path.string(), num_workers);
+
+    auto sequence = std::uint64_t{0};
+    auto const dispatch = [&](UniqueFd client, std::optional<std::string> const& line) {
+        auto const request = line
+            ? protocol::parse_request(*line)
+            : std::unexpected(ServerError::InvalidRequest);
+
+        if (!request) {
+            send_reply(client.get(), std::format("ERROR {}\n", error_message(request.error())));
+            return;
+        }
+
+        switch (request->command) {
+            case protocol::Command::Ping:
+                send_reply(client.get(), "PONG\n");
+                break;
+            case protocol::Command::Separate:
+                queue.push(Job{
+                    .priority = request->priority,
+                    .sequence = sequence++,
+                    .input = std::filesystem::path{request->path},
+                    .client = std::move(client)
+                });
+                break;
+        }
+    };
+
+    auto pending = std::vector<PendingRequest>{};
+    auto fds = std::vector<pollfd>{};
+    while (!stop) {
+        // Clients that didn't finish their request line in time
+        auto const now = std::chrono::steady_clock::now();
+        for (auto& request : pending)
+            if (request.deadline <= now)
+                dispatch(std::move(request.client), std::nullopt);
+        std::erase_if(pending, [](auto const& request) { return !request.client; });
+
+        // The listener first, then every pending connection in arrival order
+        fds.clear();
+        fds.push_back(pollfd{.fd = listener->get(), .events = POLLIN, .revents = 0});
+        for (auto const& request : pending)
+            fds.push_back(pollfd{.fd = request.client.get(), .events = POLLIN, .revents = 0});
+        if (::poll(fds.data(), static_cast<nfds_t>(fds.size()), accept_poll_ms) <= 0)
+            continue;
+
+        for (auto i = 0uz; i < pending.size(); ++i) {
+            if (fds[i + 1uz].revents == 0)
+                continue;
+            auto const state = read_available(pending[i]);
+            if (state != ReadState::Partial)
+                dispatch(std::move(pending[i].client),
+                         state == ReadState::Complete ? std::optional{pending[i].line} : std::nullopt);
+        }
+        std::erase_if(pending, [](auto const& request) { return !request.client; });
+
+        if ((fds.front().revents & POLLIN) != 0) {
+            if (auto client = UniqueFd{::accept(listener->get(), nullptr, nullptr)})
+                pending.push_back(PendingRequest{.client = std::move(client),
+                                                 .deadline = std::chrono::steady_clock::now() + request_timeout});
+        }
+    }
+
+    // Running jobs finish; queued ones and requests still arriving are told the server is going away
+    for (auto const& request : pending)
+        send_reply(request.client.get(), "ERROR Server shutting down\n");
+    for (auto const& job : queue.close())
+        send_reply(job.client.get(), "ERROR Server shutting down\n");
+    workers.clear();
+
+    std::filesystem::remove(options.socket_path);
+    std::println("Server stopped");
+    return {};
+}
+
+} // namespace stems
@@ -0,0 +1,155 @@
+#include "server.h"
+#include "batch_runner.h"
+#include "cli_options.h"
+#include "onnx_model.h"
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <optional>
+#include <print>
+#include <span>
+#include <string_view>
+#include <thread>
+
+namespace {
+
+// Set from the signal handler, polled by the accept loop
+std::atomic<bool> stop_requested{false};
+static_assert(std::atomic<bool>::is_always_lock_free, "Flag is written from a signal handler");
+
+extern "C" void request_stop(int) {
+    stop_requested = true;
+}
+
+// Command line options
+struct CliOptions {
+    std::string_view model_path = "models/htdemucs.onnx";
+    stems::ModelOptions model{.cache_dir = stems::default_cache_dir()};
+    std::optional<std::size_t> intra_op_threads;  // Default depends on the job count
+    stems::ServerOptions server{};
+    stems::ProcessingOptions processing{};
+};
+
+// Socket in the per-user runtime directory when there is one
+std::filesystem::path default_socket_path() {
+    if (auto const* runtime_dir = std::getenv("XDG_RUNTIME_DIR"); runtime_dir and *runtime_dir)
+        return std::filesystem::path{runtime_dir} / "stems.sock";
+    return "/tmp/stems.sock";
+}
+
+void print_usage(std::string_view program_name) {
+    std::println("Usage: {} [options]", program_name);
+    std::println("\nOptions:");
+    std::println("  --socket PATH    Unix socket to listen on (default: {})", default_socket_path().string());
+    std::println("  --model PATH     ONNX model to keep loaded (default: models/htdemucs.onnx)");
+    std::println("  --provider NAME  Execution provider: cpu, cuda, tensorrt, coreml or auto (default: cpu)");
+    std::println("  --jobs N         Files separated concurrently (default: 1)");
+    std::println("  --batch-size N   Chunks per inference run (default: {}, needs dynamic-batch model)",
+                 stems::separation::default_batch_size);
+    std::println("  --chunk-size N   Samples per model input (default: the model's export length)");
+    std::println("  --overlap N      Samples shared by neighbouring chunks (default: 5% of the chunk)");
+    std::println("  --silence-threshold DB  Chunks peaking below this skip inference (default: {} dBFS)",
+                 stems::separation::silence_threshold_db);
+    std::println("  --no-silence-gate  Run inference on every chunk");
+    std::println("  --output-format F  Stem encoding: pcm16, pcm24, float or flac (default: pcm16)");
+    std::println("  --stems LIST     Stems to keep, e.g. vocals,drums; instrumental = mix - vocals (default: all)");
+    std::println("  --result-cache DIR  Reuse model outputs of chunks separated before (stored in DIR)");
+    std::println("  --fade SHAPE     Chunk cross-fade: triangular or equal-power (default: triangular)");
+    std::println("  --shifts N       Average N delayed separations per chunk, batched together (default: 1)");
+    std::println("  --intra-op-threads N  Threads per inference run (default: all cores, shared between jobs)");
+    std::println("  --inter-op-threads N  Threads for independent graph branches with --parallel-execution");
+    std::println("  --parallel-execution  Run independent graph nodes concurrently");
+    std::println("  --cpus LIST      Pin inference threads one per CPU, e.g. 0-15 (sets the intra-op count)");
+    std::println("  --no-spin        Idle inference threads sleep instead of spinning");
+    std::println("  --shared-thread-pool  One set of inference pools for every session in the process");
+    std::println("  --quiet          No per-chunk progress lines");
+    std::println("\nProtocol (one line per connection):");
+    std::println("  SEPARATE <priority> <path>   -> OK <audio_seconds> <wall_seconds> | ERROR <message>");
+    std::println("  PING                         -> PONG");
+}
+
+std::optional<CliOptions> parse_arguments(std::span<char*> args) {
+    auto options = CliOptions{};
+    options.server.socket_path = default_socket_path();
+
+    for (auto i = 1uz; i < args.size(); ++i) {
+        auto const arg = std::string_view{args[i]};
+
+        auto const common = stems::parse_common_option(args, i, options.model, options.processing,
+                                                       options.intra_op_threads);
+        if (common == stems::OptionMatch::Invalid)
+            return std::nullopt;
+        if (common == stems::OptionMatch::Parsed)
+            continue;
+
+        if (i + 1 == args.size())
+            return std::nullopt;  // Every other option takes a value
+
+        if (arg == "--socket") {
+            options.server.socket_path = args[++i];
+        } else if (arg == "--model") {
+            options.model_path = args[++i];
+        } else if (arg == "--jobs") {
+            auto const count = stems::parse_count(args[++i]);
+            if (!count)
+                return std::nullopt;
+            options.server.jobs = *count;
+        } else if (arg == "--output-format") {
+            auto const format = stems::parse_output_format(args[++i]);
+            if (!format)
+                return std::nullopt;
+            options.server.output_format = *format;
+        } else {
+            std::println(stderr, "Unknown option: {}", arg);
+            return std::nullopt;
+        }
+    }
+
+    return options;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    auto const args = std::span(argv, static_cast<std::size_t>(argc));
+
+    auto const options = parse_arguments(args);
+    if (!options) {
+        print_usage(args[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+    std::signal(SIGPIPE, SIG_IGN);  // Clients that disconnect early must not kill the daemon
+
+    // Loaded once and shared by every worker
+    auto model_options = options->model;
+    model_options.intra_op_threads = options->intra_op_threads.value_or(
+        stems::intra_op_threads_for(std::thread::hardware_concurrency(), options->server.jobs));
+
+    std::println("Loading model: {}", options->model_path);
+    auto const model = stems::OnnxModel::load(options->model_path, model_options);
+    if (!model) {
+        std::println(stderr, "Error: {}", stems::error_message(model.error()));
+        return EXIT_FAILURE;
+    }
+
+    // Plans measured on an earlier start (or by stems --tune-fftw) make warm-up instant
+    auto const cache_dir = stems::default_cache_dir();
+    auto const wisdom = stems::FftwWisdomFile{cache_dir.empty() ? std::filesystem::path{} : cache_dir / "fftwf.wisdom"};
+
+    auto const processor = stems::StemProcessor::create(*model, options->processing);
+    if (!processor) {
+        std::println(stderr, "Error: {}", stems::error_message(processor.error()));
+        return EXIT_FAILURE;
+    }
+
+    if (auto const result = stems::run_server(*processor, options->server, stop_requested); !result) {
+        std::println(stderr, "Error: {}", stems::error_message(result.error()));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,98 +1,481 @@
 #include "stem_processor.h"
 #include "constants.h"
+#include "pipeline.h"
+#include "simd.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <format>
+#include <mutex>
+#include <optional>
 #include <print>
+#include <ranges>
+#include <string>
+#include <thread>
 
 namespace stems {
 
 namespace {
 
+// Samples per deinterleave task (large enough to amortise the hand-off)
+constexpr auto deinterleave_block = 65536uz;
+
 // De-interleave stereo audio into separate left/right channels
 std::pair<std::vector<float>, std::vector<float>> deinterleave_stereo(
-    std::vector<float> const& interleaved
+    std::vector<float> const& interleaved,
+    ThreadPool& pool
 ) {
     auto const num_samples = interleaved.size() / 2uz;
     auto left = std::vector<float>(num_samples);
     auto right = std::vector<float>(num_samples);
 
-    for (auto i = 0uz; i < num_samples; ++i) {
-        left[i] = interleaved[i * 2uz];
-        right[i] = interleaved[i * 2uz + 1uz];
-    }
+    auto const num_blocks = (num_samples + deinterleave_block - 1uz) / deinterleave_block;
+    pool.parallel_for(num_blocks, [&](std::size_t block) {
+        auto const begin = block * deinterleave_block;
+        auto const frames = std::min(num_samples, begin + deinterleave_block) - begin;
+        simd::deinterleave(std::span{left}.subspan(begin, frames), std::span{right}.subspan(begin, frames),
+                           std::span{interleaved}.subspan(begin * 2uz, frames * 2uz));
+    });
 
     return {left, right};
 }
 
-// Interleave separate left/right channels into stereo
-std::vector<float> interleave_stereo(
-    std::vector<float> const& left,
-    std::vector<float> const& right
-) {
-    auto const num_samples = left.size();
-    auto interleaved = std::vector<float>(num_samples * 2uz);
-
-    for (auto i = 0uz; i < num_samples; ++i) {
-        interleaved[i * 2uz] = left[i];
-        interleaved[i * 2uz + 1uz] = right[i];
-    }
-
-    return interleaved;
-}
-
 // Extract chunk from audio with zero-padding if needed
-std::vector<float> extract_chunk(
+// Writes into caller-owned storage (the model's waveform tensor)
+void extract_chunk(
     std::vector<float> const& audio,
     std::size_t offset,
-    std::size_t target_size
+    std::span<float> chunk
 ) {
-    auto chunk = std::vector<float>(target_size, 0.0f);
     auto const available = offset < audio.size()
-        ? std::min(target_size, audio.size() - offset)
+        ? std::min(chunk.size(), audio.size() - offset)
         : 0uz;
 
     if (available > 0)
-        std::copy_n(audio.begin() + offset, available, chunk.begin());
+        std::copy_n(audio.begin() + static_cast<std::ptrdiff_t>(offset), available, chunk.begin());
 
-    return chunk;
+    std::fill(chunk.begin() + static_cast<std::ptrdiff_t>(available), chunk.end(), 0.0f);
 }
 
-// Apply overlap-add with linear crossfade to avoid artifacts
-// Blends chunk into output buffer at given offset with smooth transitions
-void blend_chunk(
-    std::vector<float>& output,
-    std::vector<float> const& chunk,
+// Samples per blend task; each task blends that range of every stem and channel
+constexpr auto blend_block = 16384uz;
+
+// Separated copies of one chunk, member-major: every ensemble member's output for each
+// shift. Copy j of a member was separated from the input delayed by delays[j] samples
+// (ascending from 0), so chunk sample t is its sample t + delays[j]
+struct ChunkCopies {
+    std::span<StemAudioView const> copies;
+    std::span<std::size_t const> delays;
+    std::span<float const> weights;  // [members][stems], each stem's summing to 1; empty for one member
+
+    StemAudioView front() const { return copies.front(); }
+
+    float weight(std::size_t member, std::size_t stem) const {
+        return weights.empty() ? 1.0f : weights[member * front().num_stems() + stem];
+    }
+
+    // One plane combined over the copies across [begin, end) of `scratch`, indexed by
+    // chunk sample: the weighted mean over members of each member's mean over shifts.
+    // Members without weight for the stem are never read, and a plane only one undelayed
+    // copy contributes to is read in place. A copy delayed by d has no output for the
+    // chunk's last d samples, which average over the shifts that do
+    std::span<float const> plane(
+        std::size_t stem,
+        std::size_t channel,
+        std::size_t begin,
+        std::size_t end,
+        std::span<float> scratch
+    ) const {
+        auto const shifts = delays.size();
+        auto const members = copies.size() / shifts;
+        if (shifts == 1uz) {
+            auto weighted = 0uz;
+            auto only = 0uz;
+            for (auto member = 0uz; member < members; ++member)
+                if (weight(member, stem) > 0.0f) {
+                    ++weighted;
+                    only = member;
+                }
+            if (weighted == 1uz)
+                return copies[only].channel(stem, channel);
+        }
+
+        auto const size = front().num_samples();
+        std::ranges::fill(scratch.subspan(begin, end - begin), 0.0f);
+        for (auto member = 0uz; member < members; ++member) {
+            auto const member_weight = weight(member, stem);
+            if (member_weight == 0.0f)
+                continue;
+
+            for (auto copy = 0uz; copy < shifts; ++copy) {
+                auto const delay = delays[copy];
+                auto const samples = copies[member * shifts + copy].channel(stem, channel);
+                for (auto i = begin; i < std::min(end, size - delay); ++i)
+                    scratch[i] += member_weight * samples[i + delay];
+            }
+        }
+
+        auto const all_shifts = size - delays.back();
+        auto const scale = 1.0f / static_cast<float>(shifts);
+        for (auto i = begin; i < std::min(end, all_shifts); ++i)
+            scratch[i] *= scale;
+        for (auto i = std::max(begin, all_shifts); i < end; ++i)
+            scratch[i] /= static_cast<float>(std::ranges::count_if(delays, [&](auto delay) { return i + delay < size; }));
+
+        return scratch;
+    }
+};
+
+// Delay of a chunk with a single copy
+constexpr auto no_delay = std::array{0uz};
+
+// A sink's chunk: silent and cached chunks come as one undelayed copy of one model
+ChunkCopies chunk_copies(
+    std::span<StemAudioView const> copies,
+    std::span<std::size_t const> delays,
+    std::span<float const> weights
+) {
+    if (copies.size() == 1uz)
+        return {copies, no_delay, {}};
+    return {copies, delays, weights};
+}
+
+// Overlap-add the selected outputs of one separated chunk into planar output starting
+// at `offset`; unselected stems are never touched. The instrumental is the chunk's mix
+// minus its vocals, formed in `scratch` block by block just before it is blended, so it
+// costs no extra pass over the track; shifted copies are averaged the same way
+// Blocks of the chunk blend concurrently; output past its end is dropped
+void blend_stems(
+    CrossFade const& cross_fade,
+    StemSelection const& selection,
+    StemAudio& output,
     std::size_t offset,
-    std::size_t overlap_size,
+    ChunkCopies chunk,
+    StemAudioView mix,
+    StemAudio& scratch,
     bool is_first_chunk,
-    bool is_last_chunk
+    bool is_last_chunk,
+    ThreadPool& pool
+) {
+    auto const chunk_size = chunk.front().num_samples();
+    auto const num_channels = chunk.front().num_channels();
+    auto const num_blocks = (chunk_size + blend_block - 1uz) / blend_block;
+    auto const model_outputs = selection.num_model_outputs();
+    auto const vocals = separation::stem_index("vocals", chunk.front().num_stems());
+
+    pool.parallel_for(num_blocks, [&](std::size_t block) {
+        auto const begin = block * blend_block;
+        auto const end = std::min(chunk_size, begin + blend_block);
+
+        auto const blend = [&](std::size_t out, std::size_t channel, std::span<float const> samples) {
+            auto const target = output.channel(out, channel);
+            if (offset < target.size())
+                cross_fade.blend(target.subspan(offset), samples, begin, end, is_first_chunk, is_last_chunk);
+        };
+
+        for (auto out = 0uz; out < model_outputs; ++out)
+            for (auto channel = 0uz; channel < num_channels; ++channel)
+                blend(out, channel, chunk.plane(selection.model_stem(out), channel, begin, end,
+                                                scratch.channel(1uz, channel)));
+
+        if (selection.instrumental) {
+            for (auto channel = 0uz; channel < num_channels; ++channel) {
+                auto const instrumental = scratch.channel(0uz, channel);
+                auto const input = mix.channel(0uz, channel);
+                auto const vocal = chunk.plane(vocals, channel, begin, end, scratch.channel(1uz, channel));
+                for (auto i = begin; i < end; ++i)
+                    instrumental[i] = input[i] - vocal[i];
+                blend(model_outputs, channel, instrumental);
+            }
+        }
+    });
+}
+
+// Linear peak below which a chunk skips inference, 0 with the gate off
+float gate_level(ProcessingOptions const& options) {
+    return options.silence_threshold_db ? std::pow(10.0f, *options.silence_threshold_db / 20.0f) : 0.0f;
+}
+
+// Where a chunk's separated output comes from
+enum class ChunkOutput {
+    Inferred,  // Model output tensor entry
+    Silent,    // Below the silence gate, separates to zeros
+    Cached     // Stored by an earlier separation
+};
+
+// One chunk of a batch: the tensor entry of an inferred chunk, or the index of a
+// cached one among the slot's cached results
+struct BatchChunk {
+    std::size_t chunk_idx;
+    ChunkOutput output;
+    std::size_t entry = 0uz;
+    std::uint64_t key = 0u;  // Result cache key of an inferred chunk's input
+};
+
+// Stored output of a chunk, and a copy of its mix when the instrumental is derived
+// (the tensor entry the chunk was read into goes to the chunk after it)
+struct CachedChunk {
+    CachedResult result;
+    StemAudio mix;
+};
+
+// One pipeline slot: a batch of consecutive chunks and the model tensors that hold them
+// Silent and cached chunks don't take a tensor entry, so only `num_inferred` entries are run
+struct BatchSlot {
+    std::vector<BatchChunk> chunks;
+    std::vector<CachedChunk> cached;
+    std::size_t num_inferred = 0uz;
+    ModelTensors tensors;
+    std::vector<ModelTensors> members;  // Inputs copied from `tensors`, for the other ensemble members
+};
+
+} // anonymous namespace
+
+std::expected<StemProcessor, ProcessingError> StemProcessor::create(OnnxModel model, ProcessingOptions options) {
+    auto members = std::vector<EnsembleMember>{};
+    members.push_back({.model = std::move(model)});
+    return create(std::move(members), options);
+}
+
+std::expected<StemProcessor, ProcessingError> StemProcessor::create(
+    std::vector<EnsembleMember> members,
+    ProcessingOptions options
 ) {
-    auto const chunk_size = chunk.size();
-    auto const end = std::min(offset + chunk_size, output.size());
+    if (members.empty())
+        return std::unexpected(ProcessingError::InvalidEnsemble);
+
+    // Any fixed-shape member decides the chunk size for all of them
+    auto const fixed_member = std::ranges::find_if(members, [](auto const& member) {
+        return member.model.fixed_chunk_size().has_value();
+    });
+    auto const model_chunk_size = fixed_member != members.end() ? fixed_member->model.fixed_chunk_size() : std::nullopt;
+
+    auto const chunking = resolve_chunking(model_chunk_size, options.chunk_size, options.chunk_overlap);
+    if (!chunking) {
+        if (model_chunk_size)
+            std::println(stderr, "Model has a fixed time axis of {} samples (export with a dynamic "
+                                 "time axis for other chunk sizes)", *model_chunk_size);
+        std::println(stderr, "Chunks need at least {} samples and an overlap of at most half the chunk",
+                     min_chunk_size);
+        return std::unexpected(chunking.error());
+    }
+
+    auto const num_stems = members.front().model.num_stems();
+    for (auto const& member : members) {
+        auto const fixed = member.model.fixed_chunk_size();
+        if (member.model.num_stems() != num_stems or (fixed and *fixed != chunking->size)) {
+            std::println(stderr, "Ensemble members must separate the same stems from the same chunk size");
+            return std::unexpected(ProcessingError::InvalidEnsemble);
+        }
+    }
+
+    auto const selection = options.stems.value_or(StemSelection::all(num_stems));
+    if (!selection.valid_for(num_stems)) {
+        std::println(stderr, "The {}-stem model separates {}", num_stems,
+                     num_stems == 6uz ? "drums, bass, other, vocals, guitar and piano"
+                                      : "drums, bass, other and vocals");
+        return std::unexpected(ProcessingError::InvalidStemSelection);
+    }
 
-    for (auto i = 0uz; i < chunk_size and (offset + i) < end; ++i) {
-        auto const output_idx = offset + i;
-        auto weight = 1.0f;
+    // Weights are normalised per stem; every stem that is kept (or the instrumental
+    // needs) has to come from at least one member
+    auto weights = std::vector<float>{};
+    if (members.size() > 1uz) {
+        auto member_weights = std::vector<std::optional<StemWeights>>{};
+        for (auto const& member : members)
+            member_weights.push_back(member.weights);
 
-        // Fade in at start of chunk (except for first chunk)
-        if (!is_first_chunk and i < overlap_size) {
-            weight = static_cast<float>(i) / static_cast<float>(overlap_size);
+        auto normalised = ensemble_weights(member_weights, num_stems);
+        if (!normalised) {
+            std::println(stderr, "Ensemble weight for a stem a {}-stem model doesn't separate", num_stems);
+            return std::unexpected(ProcessingError::InvalidEnsemble);
         }
+        weights = std::move(*normalised);
 
-        // Fade out at end of chunk (except for last chunk)
-        auto const dist_from_end = chunk_size - i;
-        if (!is_last_chunk and dist_from_end <= overlap_size) {
-            auto const fade_out_weight = static_cast<float>(dist_from_end) / static_cast<float>(overlap_size);
-            weight = std::min(weight, fade_out_weight);
+        auto const vocals = separation::stem_index("vocals", num_stems);
+        auto const needed = [&](std::size_t stem) {
+            return selection.contains(stem) or (selection.instrumental and stem == vocals);
+        };
+        for (auto stem = 0uz; stem < num_stems; ++stem) {
+            auto const weighted = std::ranges::any_of(std::views::iota(0uz, members.size()), [&](auto member) {
+                return weights[member * num_stems + stem] > 0.0f;
+            });
+            if (needed(stem) and !weighted) {
+                std::println(stderr, "No ensemble member has weight for {}", separation::stem_name(stem, num_stems));
+                return std::unexpected(ProcessingError::InvalidEnsemble);
+            }
+        }
+
+        // A member without weight for any kept stem would only be inferred and discarded
+        auto kept = std::vector<EnsembleMember>{};
+        auto kept_weights = std::vector<float>{};
+        for (auto member = 0uz; member < members.size(); ++member) {
+            auto const row = std::span{weights}.subspan(member * num_stems, num_stems);
+            auto const contributes = std::ranges::any_of(std::views::iota(0uz, num_stems), [&](auto stem) {
+                return needed(stem) and row[stem] > 0.0f;
+            });
+            if (!contributes) {
+                std::println(stderr, "Ensemble model {} has no weight for the kept stems, skipping it", member + 1uz);
+                continue;
+            }
+            kept.push_back(std::move(members[member]));
+            kept_weights.insert(kept_weights.end(), row.begin(), row.end());
         }
 
-        // Overlap-add: blend with existing content
-        output[output_idx] = output[output_idx] * (1.0f - weight) + chunk[i] * weight;
+        members = std::move(kept);
+        weights = members.size() > 1uz ? std::move(kept_weights) : std::vector<float>{};
     }
+
+    auto models = std::vector<OnnxModel>{};
+    for (auto& member : members)
+        models.push_back(std::move(member.model));
+    auto const max_batch = std::ranges::min(models | std::views::transform(&OnnxModel::max_batch_size));
+
+    // Every copy of a chunk goes in one batch, delayed by whole hops within the overlap
+    auto const max_delay = std::min(separation::max_shift, chunking->overlap);
+    if (options.shifts == 0uz or options.shifts > max_shifts(max_delay) or options.shifts > max_batch) {
+        std::println(stderr, "Shifts need a batch entry each ({} in this model) and a distinct delay within "
+                             "the overlap ({} with {} samples)",
+                     max_batch, max_shifts(max_delay), chunking->overlap);
+        return std::unexpected(ProcessingError::InvalidShifts);
+    }
+
+    // Separation works without the cache, just without its hits
+    // Entries hold single separations, so averaged ones aren't stored
+    auto result_cache = std::shared_ptr<ResultCache const>{};
+    if (!options.result_cache_dir.empty() and (options.shifts > 1uz or models.size() > 1uz)) {
+        std::println(stderr, "The result cache holds unshifted single-model separations, separating without it");
+    } else if (!options.result_cache_dir.empty()) {
+        if (auto cache = ResultCache::open(options.result_cache_dir, models.front().identity(), num_stems,
+                                           chunking->size))
+            result_cache = std::make_shared<ResultCache const>(std::move(*cache));
+        else
+            std::println(stderr, "Could not create result cache {}, separating without it",
+                         options.result_cache_dir.string());
+    }
+
+    return StemProcessor{std::move(models), std::move(weights), options, *chunking, selection,
+                         std::move(result_cache)};
 }
 
-} // anonymous namespace
+StemProcessor::StemProcessor(
+    std::vector<OnnxModel> models,
+    std::vector<float> weights,
+    ProcessingOptions options,
+    Chunking chunking,
+    StemSelection selection,
+    std::shared_ptr<ResultCache const> result_cache
+) : model_(std::move(models.front())),
+      members_(std::make_move_iterator(models.begin() + 1), std::make_move_iterator(models.end())),
+      weights_(std::move(weights)),
+      chunking_(chunking),
+      stft_{chunking.size},
+      cross_fade_{chunking.overlap, options.fade},
+      options_(options),
+      selection_(selection),
+      result_cache_(std::move(result_cache)),
+      pool_{std::make_shared<ThreadPool>(
+          options.dsp_threads.value_or(dsp_threads_for(std::thread::hardware_concurrency())))},
+      member_pool_{members_.empty() ? nullptr : std::make_shared<ThreadPool>(members_.size())} {
+    auto const max_delay = std::min(separation::max_shift, chunking.overlap);
+    for (auto copy = 0uz; copy < options.shifts; ++copy)
+        shift_delays_.push_back(shift_delay(copy, options.shifts, max_delay));
+}
 
-StemProcessor::StemProcessor(OnnxModel model)
-    : model_(std::move(model)), stft_{} {}
+std::size_t StemProcessor::max_batch_size() const {
+    auto batch = model_.max_batch_size();
+    for (auto const& member : members_)
+        batch = std::min(batch, member.max_batch_size());
+    return batch;
+}
+
+std::expected<std::vector<ModelTensors>, ModelError> StemProcessor::allocate_member_tensors(std::size_t capacity) const {
+    auto tensors = std::vector<ModelTensors>{};
+    for (auto const& member : members_) {
+        auto member_tensors = member.allocate_tensors(capacity, chunking_.size);
+        if (!member_tensors)
+            return std::unexpected(member_tensors.error());
+        tensors.push_back(std::move(*member_tensors));
+    }
+    return tensors;
+}
+
+std::expected<void, ModelError> StemProcessor::infer_members(
+    ModelTensors& tensors,
+    std::span<ModelTensors> member_tensors,
+    std::size_t batch_size
+) const {
+    if (members_.empty())
+        return model_.infer(tensors, batch_size);
+
+    // Sessions are independent, so the members run side by side (each with its own
+    // intra-op threads, or on its own device), on threads kept for the processor's life
+    auto results = std::vector<std::expected<void, ModelError>>(members_.size() + 1uz);
+    member_pool_->parallel_for(results.size(), [&](std::size_t i) {
+        if (i == 0uz) {
+            results[i] = model_.infer(tensors, batch_size);
+        } else {
+            member_tensors[i - 1uz].copy_inputs(tensors, batch_size);
+            results[i] = members_[i - 1uz].infer(member_tensors[i - 1uz], batch_size);
+        }
+    });
+
+    for (auto const& result : results)
+        if (!result)
+            return result;
+    return {};
+}
+
+void StemProcessor::member_outputs(
+    ModelTensors const& tensors,
+    std::span<ModelTensors const> member_tensors,
+    std::size_t first_entry,
+    std::vector<StemAudioView>& copies
+) const {
+    for (auto copy = 0uz; copy < shift_delays_.size(); ++copy)
+        copies.push_back(tensors.output(first_entry + copy));
+    for (auto const& member : member_tensors)
+        for (auto copy = 0uz; copy < shift_delays_.size(); ++copy)
+            copies.push_back(member.output(first_entry + copy));
+}
+
+StemAudio StemProcessor::blend_scratch() const {
+    auto const combined = combines_copies(shift_delays_.size(), weights_, model_.num_stems());
+    return selection_.instrumental or combined ? StemAudio{2uz, 2uz, chunking_.size} : StemAudio{};
+}
+
+bool StemProcessor::transform(ModelTensors& tensors, std::size_t entry, std::size_t channel) const {
+    auto const real = tensors.spectrogram(entry, channel == 0uz ? ModelTensors::RealLeft : ModelTensors::RealRight);
+    auto const imag = tensors.spectrogram(entry, channel == 0uz ? ModelTensors::ImagLeft : ModelTensors::ImagRight);
+    return stft_.forward(tensors.waveform(entry, channel), real, imag).has_value();
+}
+
+bool StemProcessor::transform_shifted(
+    ModelTensors& tensors,
+    std::size_t base,
+    std::size_t copy,
+    std::size_t channel
+) const {
+    auto const delay = shift_delays_[copy];
+    auto const input = tensors.waveform(base, channel);
+    auto const delayed = tensors.waveform(base + copy, channel);
+    std::ranges::fill(delayed.first(delay), 0.0f);
+    std::ranges::copy(input.first(input.size() - delay), delayed.begin() + static_cast<std::ptrdiff_t>(delay));
+
+    auto const real_plane = channel == 0uz ? ModelTensors::RealLeft : ModelTensors::RealRight;
+    auto const imag_plane = channel == 0uz ? ModelTensors::ImagLeft : ModelTensors::ImagRight;
+    return stft_.forward_delayed(delayed, delay / stft_params::hop_size,
+                                 tensors.spectrogram(base, real_plane), tensors.spectrogram(base, imag_plane),
+                                 tensors.spectrogram(base + copy, real_plane),
+                                 tensors.spectrogram(base + copy, imag_plane)).has_value();
+}
+
+std::vector<std::string_view> StemProcessor::output_names() const {
+    auto names = std::vector<std::string_view>{};
+    for (auto output = 0uz; output < selection_.num_outputs(); ++output)
+        names.push_back(selection_.output_name(output, model_.num_stems()));
+    return names;
+}
 
 std::expected<SeparatedStems, ProcessingError> StemProcessor::process(
     std::vector<float> const& audio,
@@ -108,111 +491,650 @@ std::expected<SeparatedStems, ProcessingError> StemProcessor::process(
                  audio.size(), sample_rate, channels);
 
     // De-interleave stereo input
-    auto const [left, right] = deinterleave_stereo(audio);
+    auto const [left, right] = deinterleave_stereo(audio, *pool_);
     auto const num_samples = left.size();
 
     // Calculate chunking parameters
-    auto constexpr chunk_size = separation::model_chunk_size;
-    auto constexpr overlap = separation::chunk_overlap;
-    auto const step = chunk_size - overlap;
-    auto const num_chunks = (num_samples + step - 1) / step;
+    auto const overlap = chunking_.overlap;
+    auto const step = chunking_.step();
+    auto const num_chunks = chunking_.num_chunks(num_samples);
 
     std::println("Chunking audio: {} chunks of {} samples with {} overlap",
-                 num_chunks, chunk_size, overlap);
+                 num_chunks, chunking_.size, overlap);
+
+    // One planar stereo output buffer for every selected output
+    auto const num_outputs = selection_.num_outputs();
+    auto output = StemAudio{num_outputs, 2uz, num_samples};
+    auto scratch = blend_scratch();
+
+    auto const source = [&](std::size_t chunk_idx, std::span<float> left_chunk, std::span<float> right_chunk) {
+        extract_chunk(left, chunk_idx * step, left_chunk);
+        extract_chunk(right, chunk_idx * step, right_chunk);
+        return std::expected<void, ProcessingError>{};
+    };
+
+    auto const sink = [&](std::size_t chunk_idx, std::span<StemAudioView const> copies, StemAudioView mix) {
+        auto const is_first = chunk_idx == 0;
+        auto const is_last = chunk_idx == num_chunks - 1;
+
+        auto const span = TraceSpan{options_.trace.get(), Stage::Blend, chunk_idx};
+        blend_stems(cross_fade_, selection_, output, chunk_idx * step, chunk_copies(copies, shift_delays_, weights_), mix,
+                    scratch, is_first, is_last, *pool_);
+        return true;
+    };
+
+    if (auto const result = run_pipeline(num_chunks, source, sink); !result)
+        return std::unexpected(result.error());
+
+    std::println("Stem separation complete!");
+    for (auto const name : output_names())
+        std::println("  {}: {} samples x {} channels", name, output.num_samples(), output.num_channels());
+
+    return output;
+}
+
+std::expected<SeparatedStems, ProcessingError> StemProcessor::process(AudioReader& reader) {
+    auto const& info = reader.info();
+    if (info.channels != 2 or info.frames < 0) {
+        std::println(stderr, "Only stereo audio is supported (got {} channels)", info.channels);
+        return std::unexpected(ProcessingError::InvalidAudio);
+    }
+
+    auto const num_samples = static_cast<std::size_t>(info.frames);
+    std::println("Processing {} frames at {} Hz ({} channels)",
+                 num_samples, info.sample_rate, info.channels);
+
+    auto const step = chunking_.step();
+    auto const num_chunks = chunking_.num_chunks(num_samples);
+
+    std::println("Chunking audio: {} chunks of {} samples with {} overlap",
+                 num_chunks, chunking_.size, chunking_.overlap);
+
+    auto output = StemAudio{selection_.num_outputs(), 2uz, num_samples};
+    auto scratch = blend_scratch();
+
+    auto const sink = [&](std::size_t chunk_idx, std::span<StemAudioView const> copies, StemAudioView mix) {
+        auto const is_first = chunk_idx == 0;
+        auto const is_last = chunk_idx == num_chunks - 1;
+
+        auto const span = TraceSpan{options_.trace.get(), Stage::Blend, chunk_idx};
+        blend_stems(cross_fade_, selection_, output, chunk_idx * step, chunk_copies(copies, shift_delays_, weights_), mix,
+                    scratch, is_first, is_last, *pool_);
+        return true;
+    };
+
+    if (auto const result = run_pipeline(num_chunks, read_chunks(reader), sink); !result)
+        return std::unexpected(result.error());
+
+    std::println("Stem separation complete!");
+    return output;
+}
+
+std::expected<void, ProcessingError> StemProcessor::process_stream(
+    AudioReader& reader,
+    StemSink const& stem_sink
+) {
+    auto const& info = reader.info();
+    if (info.channels != 2 or info.frames < 0) {
+        std::println(stderr, "Only stereo audio is supported (got {} channels)", info.channels);
+        return std::unexpected(ProcessingError::InvalidAudio);
+    }
 
-    // Initialize output buffers for all possible stems (support up to 6 stems)
-    auto drums_out = std::vector<float>(num_samples, 0.0f);
-    auto bass_out = std::vector<float>(num_samples, 0.0f);
-    auto other_out = std::vector<float>(num_samples, 0.0f);
-    auto vocals_out = std::vector<float>(num_samples, 0.0f);
-    auto guitar_out = std::vector<float>(num_samples, 0.0f);
-    auto piano_out = std::vector<float>(num_samples, 0.0f);
+    auto const num_samples = static_cast<std::size_t>(info.frames);
+    std::println("Streaming {} frames at {} Hz ({} channels)",
+                 num_samples, info.sample_rate, info.channels);
 
-    auto num_detected_stems = 0uz;  // Will be set after first inference
+    // Calculate chunking parameters
+    auto const chunk_size = chunking_.size;
+    auto const overlap = chunking_.overlap;
+    auto const step = chunking_.step();
+    auto const num_chunks = chunking_.num_chunks(num_samples);
 
-    // Process each chunk
-    for (auto chunk_idx = 0uz; chunk_idx < num_chunks; ++chunk_idx) {
-        auto const offset = chunk_idx * step;
+    std::println("Chunking audio: {} chunks of {} samples with {} overlap",
+                 num_chunks, chunk_size, overlap);
+
+    // Output window covering the current chunk. After blending chunk k the first
+    // `step` samples are final (chunk k+1 starts there), so they are flushed and
+    // the faded-out tail slides to the front for chunk k+1's fade-in to add to
+    auto const num_outputs = selection_.num_outputs();
+    auto window = StemAudio{num_outputs, 2uz, chunk_size};
+    auto scratch = blend_scratch();
+
+    auto const sink = [&](std::size_t chunk_idx, std::span<StemAudioView const> copies, StemAudioView mix) {
         auto const is_first = chunk_idx == 0;
         auto const is_last = chunk_idx == num_chunks - 1;
 
-        std::println("Processing chunk {}/{} (offset: {} samples)",
-                     chunk_idx + 1, num_chunks, offset);
+        {
+            auto const span = TraceSpan{options_.trace.get(), Stage::Blend, chunk_idx};
+            blend_stems(cross_fade_, selection_, window, 0uz, chunk_copies(copies, shift_delays_, weights_), mix, scratch,
+                        is_first, is_last, *pool_);
+        }
+
+        auto const finished = is_last ? num_samples - chunk_idx * step : step;
+        {
+            auto const span = TraceSpan{options_.trace.get(), Stage::Write, chunk_idx};
+            if (!stem_sink(window.view().samples(0uz, finished)))
+                return false;
+        }
+
+        // Only the faded-out tail carries over; the rest is overwritten by the next chunk
+        pool_->parallel_for(num_outputs * 2uz, [&](std::size_t plane) {
+            auto const samples = window.channel(plane / 2uz, plane % 2uz);
+            std::ranges::copy(samples.subspan(step), samples.begin());
+        });
+        return true;
+    };
+
+    if (auto const result = run_pipeline(num_chunks, read_chunks(reader), sink); !result)
+        return std::unexpected(result.error());
+
+    std::println("Streaming separation complete!");
+    return {};
+}
+
+std::expected<IncrementalSeparation, ProcessingError> StemProcessor::start_incremental(int sample_rate, StemSink sink) {
+    if (sample_rate <= 0)
+        return std::unexpected(ProcessingError::InvalidAudio);
+
+    auto tensors = model_.allocate_tensors(shift_delays_.size(), chunking_.size);
+    auto member_tensors = allocate_member_tensors(shift_delays_.size());
+    if (!tensors or !member_tensors)
+        return std::unexpected(ProcessingError::InferenceFailed);
+
+    auto const rate = static_cast<double>(sample_rate);
+    std::println("Incremental separation: chunks of {} samples ({:.2f}s) with {} overlap",
+                 chunking_.size, static_cast<double>(chunking_.size) / rate, chunking_.overlap);
+    std::println("Output follows input by {:.2f}-{:.2f}s plus separation time",
+                 static_cast<double>(chunking_.overlap) / rate, static_cast<double>(chunking_.size) / rate);
+
+    return IncrementalSeparation{*this, std::move(*tensors), std::move(*member_tensors), sample_rate, std::move(sink)};
+}
+
+IncrementalSeparation::IncrementalSeparation(
+    StemProcessor& processor,
+    ModelTensors tensors,
+    std::vector<ModelTensors> member_tensors,
+    int sample_rate,
+    StemSink sink
+) : processor_(&processor),
+      tensors_(std::move(tensors)),
+      member_tensors_(std::move(member_tensors)),
+      sample_rate_(sample_rate),
+      sink_(std::move(sink)),
+      window_{processor.selection_.num_outputs(), 2uz, processor.chunking_.size},
+      scratch_{processor.blend_scratch()},
+      silence_(processor.options_.silence_threshold_db ? processor.chunking_.size : 0uz),
+      gate_(gate_level(processor.options_)) {}
+
+std::expected<void, ProcessingError> IncrementalSeparation::push(std::span<float const> interleaved) {
+    if (finished_ or interleaved.size() % 2uz != 0uz)
+        return std::unexpected(ProcessingError::InvalidAudio);
+
+    auto const chunk_size = processor_->chunking_.size;
+    while (!interleaved.empty()) {
+        auto const frames = std::min(chunk_size - filled_, interleaved.size() / 2uz);
+        simd::deinterleave(tensors_.waveform(0uz, 0uz).subspan(filled_, frames),
+                           tensors_.waveform(0uz, 1uz).subspan(filled_, frames), interleaved.first(frames * 2uz));
+        interleaved = interleaved.subspan(frames * 2uz);
+
+        if (auto const result = commit(frames); !result)
+            return result;
+    }
+    return {};
+}
+
+std::expected<void, ProcessingError> IncrementalSeparation::push(
+    std::span<float const> left,
+    std::span<float const> right
+) {
+    if (finished_ or left.size() != right.size())
+        return std::unexpected(ProcessingError::InvalidAudio);
 
-        // Extract chunk with padding
-        auto const left_chunk = extract_chunk(left, offset, chunk_size);
-        auto const right_chunk = extract_chunk(right, offset, chunk_size);
+    auto const chunk_size = processor_->chunking_.size;
+    while (!left.empty()) {
+        auto const frames = std::min(chunk_size - filled_, left.size());
+        std::ranges::copy(left.first(frames), tensors_.waveform(0uz, 0uz).subspan(filled_).begin());
+        std::ranges::copy(right.first(frames), tensors_.waveform(0uz, 1uz).subspan(filled_).begin());
+        left = left.subspan(frames);
+        right = right.subspan(frames);
 
-        // Compute STFT for chunk
-        auto stft_left_result = stft_.forward(left_chunk);
-        auto stft_right_result = stft_.forward(right_chunk);
+        if (auto const result = commit(frames); !result)
+            return result;
+    }
+    return {};
+}
+
+std::expected<void, ProcessingError> IncrementalSeparation::finish() {
+    if (finished_)
+        return std::unexpected(ProcessingError::InvalidAudio);
+
+    // The last chunk is zero-padded like the end of a file, and keeps its tail
+    auto result = std::expected<void, ProcessingError>{};
+    if (pushed_ > emitted_) {
+        for (auto channel = 0uz; channel < 2uz; ++channel)
+            std::ranges::fill(tensors_.waveform(0uz, channel).subspan(filled_), 0.0f);
+        result = run_chunk(true);
+    }
+
+    finished_ = true;
+    processor_->stats_ = SeparationStats{.chunks = chunk_idx_, .silent_chunks = silent_chunks_};
+    return result;
+}
 
-        if (!stft_left_result or !stft_right_result) {
-            std::println(stderr, "STFT failed for chunk {}", chunk_idx + 1);
-            return std::unexpected(ProcessingError::StftFailed);
+LatencyStats IncrementalSeparation::latency() const {
+    auto const seconds = [](Clock::duration duration) { return std::chrono::duration<double>(duration).count(); };
+    auto const audio_seconds = static_cast<double>(emitted_) / static_cast<double>(sample_rate_);
+
+    return LatencyStats{
+        .chunks = chunk_idx_,
+        .window_seconds = static_cast<double>(processor_->chunking_.size) / static_cast<double>(sample_rate_),
+        .mean_compute_seconds = chunk_idx_ > 0uz ? seconds(total_compute_) / static_cast<double>(chunk_idx_) : 0.0,
+        .max_compute_seconds = seconds(max_compute_),
+        .real_time_factor = audio_seconds > 0.0 ? seconds(total_compute_) / audio_seconds : 0.0};
+}
+
+std::expected<void, ProcessingError> IncrementalSeparation::commit(std::size_t frames) {
+    auto const& chunking = processor_->chunking_;
+    filled_ += frames;
+    pushed_ += frames;
+    if (filled_ < chunking.size)
+        return {};
+
+    if (auto const result = run_chunk(false); !result)
+        return result;
+
+    // The overlap is the start of the next chunk
+    for (auto channel = 0uz; channel < 2uz; ++channel) {
+        auto const samples = tensors_.waveform(0uz, channel);
+        std::ranges::copy(samples.subspan(chunking.step()), samples.begin());
+    }
+    filled_ = chunking.overlap;
+    return {};
+}
+
+std::expected<void, ProcessingError> IncrementalSeparation::run_chunk(bool is_last) {
+    auto& processor = *processor_;
+    auto* const trace = processor.options_.trace.get();
+    auto const chunk_size = processor.chunking_.size;
+    auto const shifts = processor.shift_delays_.size();
+    auto const start = Clock::now();
+
+    // An error leaves the window half-blended, so nothing more can be pushed
+    auto const fail = [&](ProcessingError error) {
+        finished_ = true;
+        return std::unexpected(error);
+    };
+
+    auto const left = tensors_.waveform(0uz, 0uz);
+    auto const right = tensors_.waveform(0uz, 1uz);
+    auto const silent = gate_ > 0.0f and std::max(simd::peak(left), simd::peak(right)) < gate_;
+    if (silent) {
+        ++silent_chunks_;
+    } else {
+        auto stft_failed = std::atomic<bool>{false};
+        processor.pool_->parallel_for(2uz, [&](std::size_t channel) {
+            auto const span = TraceSpan{trace, Stage::Stft, chunk_idx_};
+            if (!processor.transform(tensors_, 0uz, channel))
+                stft_failed = true;
+        });
+
+        auto const copies = shifts - 1uz;
+        if (!stft_failed and copies > 0uz)
+            processor.pool_->parallel_for(copies * 2uz, [&](std::size_t task) {
+                auto const span = TraceSpan{trace, Stage::Stft, chunk_idx_};
+                if (!processor.transform_shifted(tensors_, 0uz, 1uz + task / 2uz, task % 2uz))
+                    stft_failed = true;
+            });
+
+        if (stft_failed) {
+            std::println(stderr, "STFT failed for chunk {}", chunk_idx_ + 1);
+            return fail(ProcessingError::StftFailed);
         }
 
-        // Run inference on chunk
-        auto const& spec_left = stft_left_result.value();
-        auto const& spec_right = stft_right_result.value();
+        auto const span = TraceSpan{trace, Stage::Inference, chunk_idx_};
+        if (auto const result = processor.infer_members(tensors_, member_tensors_, shifts); !result) {
+            std::println(stderr, "Inference failed for chunk {}", chunk_idx_ + 1);
+            return fail(ProcessingError::InferenceFailed);
+        }
+    }
+
+    copies_.clear();
+    if (silent)
+        copies_.push_back(StemAudioView{silence_.data(), processor.model_.num_stems(), 2uz, silence_.size(), 0uz});
+    else
+        processor.member_outputs(tensors_, member_tensors_, 0uz, copies_);
+
+    auto const mix = silent
+        ? StemAudioView{silence_.data(), 1uz, 2uz, silence_.size(), 0uz}
+        : StemAudioView{left.data(), 1uz, 2uz, chunk_size};
+    {
+        auto const span = TraceSpan{trace, Stage::Blend, chunk_idx_};
+        blend_stems(processor.cross_fade_, processor.selection_, window_, 0uz,
+                    chunk_copies(copies_, processor.shift_delays_, processor.weights_), mix, scratch_, chunk_idx_ == 0uz, is_last,
+                    *processor.pool_);
+    }
 
-        auto inference_result = model_.infer(left_chunk, right_chunk, spec_left, spec_right);
-        if (!inference_result) {
-            std::println(stderr, "Inference failed for chunk {}", chunk_idx + 1);
+    auto const compute = Clock::now() - start;
+    total_compute_ += compute;
+    max_compute_ = std::max(max_compute_, compute);
+    if (!processor.options_.quiet)
+        std::println("Chunk {} separated in {:.0f} ms", chunk_idx_ + 1,
+                     std::chrono::duration<double, std::milli>(compute).count());
+
+    auto const step = processor.chunking_.step();
+    auto const finished = is_last ? pushed_ - emitted_ : step;
+    {
+        auto const span = TraceSpan{trace, Stage::Write, chunk_idx_};
+        if (!sink_(window_.view().samples(0uz, finished)))
+            return fail(ProcessingError::OutputGenerationFailed);
+    }
+    emitted_ += finished;
+    ++chunk_idx_;
+
+    // Only the faded-out tail carries over, as in process_stream
+    processor.pool_->parallel_for(window_.num_stems() * 2uz, [&](std::size_t plane) {
+        auto const samples = window_.channel(plane / 2uz, plane % 2uz);
+        std::ranges::copy(samples.subspan(step), samples.begin());
+    });
+    return {};
+}
+
+StemProcessor::ChunkSource StemProcessor::read_chunks(AudioReader& reader) const {
+    auto const overlap = chunking_.overlap;
+    auto const step = chunking_.step();
+
+    return [&reader, overlap, step,
+            remaining = static_cast<std::size_t>(std::max(reader.info().frames, 0L)),
+            carry_left = std::vector<float>(overlap),
+            carry_right = std::vector<float>(overlap)](
+               std::size_t chunk_idx, std::span<float> left_chunk, std::span<float> right_chunk) mutable
+        -> std::expected<void, ProcessingError> {
+        auto filled = 0uz;
+        if (chunk_idx > 0) {
+            std::ranges::copy(carry_left, left_chunk.begin());
+            std::ranges::copy(carry_right, right_chunk.begin());
+            filled = overlap;
+        }
+
+        auto const frames_read = reader.read(left_chunk.subspan(filled), right_chunk.subspan(filled));
+        if (!frames_read) {
+            std::println(stderr, "Read failed for chunk {}", chunk_idx + 1);
+            return std::unexpected(ProcessingError::CorruptedFile);
+        }
+
+        // Only frames past the header's count are padding; ending sooner is a truncated file
+        auto const owed = std::min(left_chunk.size() - filled, remaining);
+        if (*frames_read < owed) {
+            std::println(stderr, "File ended {} frames early, in chunk {}", remaining - *frames_read, chunk_idx + 1);
+            return std::unexpected(ProcessingError::CorruptedFile);
+        }
+        remaining -= std::min(remaining, *frames_read);
+
+        // Zero-pad past end of file
+        filled += *frames_read;
+        std::ranges::fill(left_chunk.subspan(filled), 0.0f);
+        std::ranges::fill(right_chunk.subspan(filled), 0.0f);
+
+        std::ranges::copy(left_chunk.subspan(step), carry_left.begin());
+        std::ranges::copy(right_chunk.subspan(step), carry_right.begin());
+        return {};
+    };
+}
+
+std::expected<void, ProcessingError> StemProcessor::run_pipeline(
+    std::size_t num_chunks,
+    ChunkSource const& source,
+    ChunkSink const& sink
+) {
+    // Batch size is limited by the model's batch axis, which holds every shifted copy
+    // of each chunk: a chunk takes `shifts` consecutive entries, undelayed copy first
+    auto const shifts = shift_delays_.size();
+    auto const batch_size = std::clamp(options_.batch_size, 1uz, max_batch_size() / shifts);
+    if (batch_size != options_.batch_size)
+        std::println("Model accepts batches of up to {}, using batch size {}{}", max_batch_size(),
+                     batch_size, shifts > 1uz ? std::format(" ({} shifts each)", shifts) : "");
+
+    auto const num_batches = (num_chunks + batch_size - 1) / batch_size;
+    if (members_.empty())
+        std::println("Detected {}-stem model", model_.num_stems());
+    else
+        std::println("Ensemble of {} {}-stem models, run concurrently", members_.size() + 1uz, model_.num_stems());
+    if (selection_ != StemSelection::all(model_.num_stems())) {
+        auto names = std::string{};
+        for (auto const name : output_names())
+            names += std::format("{}{}", names.empty() ? "" : ", ", name);
+        std::println("Keeping {}", names);
+    }
+    if (shifts > 1uz)
+        std::println("Averaging {} shifts per chunk, delayed by up to {} samples", shifts, shift_delays_.back());
+    std::println("Inference input: [{}, 2, {}] + [{}, 4, {}, {}]", batch_size * shifts, chunking_.size,
+                 batch_size * shifts, stft_params::num_bins, StftProcessor::num_frames(chunking_.size));
+
+    // Spans are recorded from every stage thread and pool worker into one trace
+    auto* const trace = options_.trace.get();
+
+    // Chunks whose peak stays below the gate separate to silence, so they skip
+    // STFT and inference and are blended as zeros
+    auto const gate = gate_level(options_);
+
+    // Zero output for gated chunks: one plane shared by every stem and channel (stride 0)
+    auto const silence = options_.silence_threshold_db
+        ? std::vector<float>(chunking_.size)
+        : std::vector<float>{};
+    // A gated chunk's mix is below the gate too, so its instrumental is taken as silent
+    auto const silent_view = StemAudioView{silence.data(), model_.num_stems(), 2uz, silence.size(), 0uz};
+    auto const silent_mix = StemAudioView{silence.data(), 1uz, 2uz, silence.size(), 0uz};
+    auto silent_chunks = std::atomic<std::size_t>{0uz};
+    auto cached_chunks = std::atomic<std::size_t>{0uz};
+    auto store_failed = false;  // Blend stage only
+
+    // Three-stage pipeline so STFT and blending overlap with Session::Run:
+    //   prepare (worker thread): extract + STFT batch k+1
+    //   infer (this thread):     model inference on batch k
+    //   blend (worker thread):   overlap-add batch k-1
+    // Each batch slot owns persistent model tensors and cycles
+    // free -> prepared -> inferred -> free, so buffers are allocated once
+    auto constexpr num_slots = separation::pipeline_depth + 1uz;
+    auto free_batches = BoundedQueue<BatchSlot>{num_slots};
+    auto prepared_batches = BoundedQueue<BatchSlot>{separation::pipeline_depth};
+    auto inferred_batches = BoundedQueue<BatchSlot>{separation::pipeline_depth};
+
+    for (auto i = 0uz; i < std::min(num_slots, num_batches); ++i) {
+        auto tensors = model_.allocate_tensors(batch_size * shifts, chunking_.size);
+        auto member_tensors = allocate_member_tensors(batch_size * shifts);
+        if (!tensors or !member_tensors)
             return std::unexpected(ProcessingError::InferenceFailed);
+        auto slot = BatchSlot{.chunks = {}, .cached = {}, .num_inferred = 0uz, .tensors = std::move(*tensors),
+                              .members = std::move(*member_tensors)};
+        slot.chunks.reserve(batch_size);
+        free_batches.push(std::move(slot));
+    }
+
+    // First failure wins; closing every queue unblocks the other stages
+    auto failure_mutex = std::mutex{};
+    auto failure = std::optional<ProcessingError>{};
+    auto const fail = [&](ProcessingError error) {
+        {
+            auto const lock = std::lock_guard{failure_mutex};
+            if (!failure)
+                failure = error;
         }
+        free_batches.close();
+        prepared_batches.close();
+        inferred_batches.close();
+    };
+
+    auto prepare_stage = std::jthread{[&] {
+        for (auto batch_idx = 0uz; batch_idx < num_batches; ++batch_idx) {
+            auto slot = free_batches.pop();
+            if (!slot)
+                return;
+
+            auto& tensors = slot->tensors;
+            slot->chunks.clear();
+            slot->num_inferred = 0uz;
+
+            // Chunk audio goes straight into the next free waveform entry, in chunk order;
+            // a gated or cached chunk leaves its entry free for the chunk after it
+            auto const first_chunk = batch_idx * batch_size;
+            for (auto chunk_idx = first_chunk; chunk_idx < std::min(num_chunks, first_chunk + batch_size); ++chunk_idx) {
+                if (!options_.quiet)
+                    std::println("Processing chunk {}/{}", chunk_idx + 1, num_chunks);
+
+                auto const span = TraceSpan{trace, Stage::Prepare, chunk_idx};
+                auto const entry = slot->num_inferred;
+                auto const left = tensors.waveform(entry * shifts, 0);
+                auto const right = tensors.waveform(entry * shifts, 1);
+                if (auto const read = source(chunk_idx, left, right); !read) {
+                    fail(read.error());
+                    return;
+                }
+
+                if (gate > 0.0f and std::max(simd::peak(left), simd::peak(right)) < gate) {
+                    slot->chunks.push_back({.chunk_idx = chunk_idx, .output = ChunkOutput::Silent});
+                    ++silent_chunks;
+                    continue;
+                }
 
-        auto const& stem_specs = inference_result.value();
+                // Left and right are adjacent in the tensor, so the key covers both at once
+                auto const input = std::span<float const>{left.data(), left.size() * 2uz};
+                auto const key = result_cache_ ? result_cache_->key(input) : 0u;
+                if (auto result = result_cache_ ? result_cache_->load(key, input) : std::nullopt) {
+                    auto mix = selection_.instrumental ? StemAudio{1uz, 2uz, chunking_.size} : StemAudio{};
+                    if (selection_.instrumental) {
+                        std::ranges::copy(left, mix.channel(0uz, 0uz).begin());
+                        std::ranges::copy(right, mix.channel(0uz, 1uz).begin());
+                    }
 
-        // Detect number of stems from first chunk
-        if (chunk_idx == 0) {
-            num_detected_stems = stem_specs.size();
-            if (num_detected_stems != 4 and num_detected_stems != 6) {
-                std::println(stderr, "Unexpected number of stems: {} (expected 4 or 6)", num_detected_stems);
-                return std::unexpected(ProcessingError::OutputGenerationFailed);
+                    slot->chunks.push_back({.chunk_idx = chunk_idx, .output = ChunkOutput::Cached,
+                                            .entry = slot->cached.size()});
+                    slot->cached.push_back({std::move(*result), std::move(mix)});
+                    ++cached_chunks;
+                    continue;
+                }
+
+                slot->chunks.push_back({.chunk_idx = chunk_idx, .output = ChunkOutput::Inferred,
+                                        .entry = entry, .key = key});
+                ++slot->num_inferred;
+            }
+
+            auto const chunk_of = [&](std::size_t entry) {
+                return std::ranges::find_if(slot->chunks, [&](BatchChunk const& chunk) {
+                    return chunk.output == ChunkOutput::Inferred and chunk.entry == entry;
+                })->chunk_idx;
+            };
+
+            // Every channel of every chunk is an independent transform, straight into
+            // its real/imaginary planes of the spectrogram tensor
+            auto stft_failed = std::atomic<bool>{false};
+            pool_->parallel_for(slot->num_inferred * 2uz, [&](std::size_t task) {
+                auto const chunk_idx = chunk_of(task / 2uz);
+                auto const span = TraceSpan{trace, Stage::Stft, chunk_idx};
+                if (!transform(tensors, task / 2uz * shifts, task % 2uz)) {
+                    std::println(stderr, "STFT failed for chunk {}", chunk_idx + 1);
+                    stft_failed = true;
+                }
+            });
+
+            // Shifted copies reuse most of their chunk's frames, so they follow it
+            auto const copies = shifts - 1uz;
+            if (!stft_failed and copies > 0uz)
+                pool_->parallel_for(slot->num_inferred * copies * 2uz, [&](std::size_t task) {
+                    auto const entry = task / (copies * 2uz);
+                    auto const copy = 1uz + task / 2uz % copies;
+                    auto const chunk_idx = chunk_of(entry);
+                    auto const span = TraceSpan{trace, Stage::Stft, chunk_idx};
+                    if (!transform_shifted(tensors, entry * shifts, copy, task % 2uz)) {
+                        std::println(stderr, "STFT failed for chunk {} shift {}", chunk_idx + 1, copy);
+                        stft_failed = true;
+                    }
+                });
+
+            if (stft_failed) {
+                fail(ProcessingError::StftFailed);
+                return;
             }
-            std::println("Detected {}-stem model", num_detected_stems);
-        }
 
-        // Verify consistent stem count
-        if (stem_specs.size() != num_detected_stems) {
-            std::println(stderr, "Inconsistent stem count: expected {}, got {}",
-                         num_detected_stems, stem_specs.size());
-            return std::unexpected(ProcessingError::OutputGenerationFailed);
+            if (!prepared_batches.push(std::move(*slot)))
+                return;
         }
 
-        // Model outputs time-domain audio directly (stored in spec.real)
-        // htdemucs outputs in order: drums, bass, other, vocals [, guitar, piano]
-        blend_chunk(drums_out, stem_specs[0].real, offset, overlap, is_first, is_last);
-        blend_chunk(bass_out, stem_specs[1].real, offset, overlap, is_first, is_last);
-        blend_chunk(other_out, stem_specs[2].real, offset, overlap, is_first, is_last);
-        blend_chunk(vocals_out, stem_specs[3].real, offset, overlap, is_first, is_last);
+        prepared_batches.close();
+    }};
 
-        // Process additional stems for 6-stem model
-        if (num_detected_stems == 6) {
-            blend_chunk(guitar_out, stem_specs[4].real, offset, overlap, is_first, is_last);
-            blend_chunk(piano_out, stem_specs[5].real, offset, overlap, is_first, is_last);
+    auto blend_stage = std::jthread{[&] {
+        auto copies = std::vector<StemAudioView>{};
+        copies.reserve(shifts * (members_.size() + 1uz));
+
+        while (auto slot = inferred_batches.pop()) {
+            // Model outputs time-domain stereo audio directly, read in place
+            // htdemucs outputs in order: drums, bass, other, vocals [, guitar, piano]
+            // An inferred chunk's input is still in the slot's waveform tensor: [2, time] of its first entry
+            for (auto const& chunk : slot->chunks) {
+                copies.clear();
+                auto mix = silent_mix;
+                if (chunk.output == ChunkOutput::Inferred) {
+                    member_outputs(slot->tensors, slot->members, chunk.entry * shifts, copies);
+                    mix = StemAudioView{slot->tensors.waveform(chunk.entry * shifts, 0uz).data(), 1uz, 2uz,
+                                        chunking_.size};
+                } else if (chunk.output == ChunkOutput::Cached) {
+                    copies.push_back(slot->cached[chunk.entry].result.view());
+                    mix = slot->cached[chunk.entry].mix.view();
+                } else {
+                    copies.push_back(silent_view);
+                }
+                auto const stems = copies.front();
+
+                if (!sink(chunk.chunk_idx, copies, mix)) {
+                    fail(ProcessingError::OutputGenerationFailed);
+                    return;
+                }
+
+                // A cache that can't be written only costs the next run its hits
+                if (result_cache_ and chunk.output == ChunkOutput::Inferred
+                    and !result_cache_->store(chunk.key, {mix.channel(0uz, 0uz).data(), 2uz * chunking_.size}, stems)
+                    and !store_failed) {
+                    std::println(stderr, "Could not store chunk {} in the result cache", chunk.chunk_idx + 1);
+                    store_failed = true;
+                }
+            }
+
+            slot->cached.clear();  // Unmap the stored results
+            if (!free_batches.push(std::move(*slot)))
+                return;
+        }
+    }};
+
+    // Inference stage runs on the calling thread (an all-silent batch has nothing to run)
+    while (auto slot = prepared_batches.pop()) {
+        if (slot->num_inferred > 0uz) {
+            auto const span = TraceSpan{trace, Stage::Inference, slot->chunks.front().chunk_idx};
+            if (auto const result = infer_members(slot->tensors, slot->members, slot->num_inferred * shifts); !result) {
+                std::println(stderr, "Inference failed for chunks {}-{}",
+                             slot->chunks.front().chunk_idx + 1, slot->chunks.back().chunk_idx + 1);
+                fail(ProcessingError::InferenceFailed);
+                break;
+            }
         }
+
+        if (!inferred_batches.push(std::move(*slot)))
+            break;
     }
 
-    std::println("Stem separation complete!");
-    std::println("  Drums: {} samples", drums_out.size());
-    std::println("  Bass: {} samples", bass_out.size());
-    std::println("  Other: {} samples", other_out.size());
-    std::println("  Vocals: {} samples", vocals_out.size());
-    if (num_detected_stems == 6) {
-        std::println("  Guitar: {} samples", guitar_out.size());
-        std::println("  Piano: {} samples", piano_out.size());
-    }
-
-    return SeparatedStems{
-        .drums = interleave_stereo(drums_out, drums_out),
-        .bass = interleave_stereo(bass_out, bass_out),
-        .other = interleave_stereo(other_out, other_out),
-        .vocals = interleave_stereo(vocals_out, vocals_out),  // TODO: Process right channel
-        .guitar = num_detected_stems == 6 ? interleave_stereo(guitar_out, guitar_out) : std::vector<float>{},
-        .piano = num_detected_stems == 6 ? interleave_stereo(piano_out, piano_out) : std::vector<float>{}
-    };
+    inferred_batches.close();
+    prepare_stage.join();
+    blend_stage.join();
+
+    stats_ = SeparationStats{.chunks = num_chunks, .silent_chunks = silent_chunks, .cached_chunks = cached_chunks};
+    if (stats_.silent_chunks > 0uz)
+        std::println("Skipped inference on {} of {} chunks (silent)", stats_.silent_chunks, stats_.chunks);
+    if (stats_.cached_chunks > 0uz)
+        std::println("Reused {} of {} chunks from the result cache", stats_.cached_chunks, stats_.chunks);
+
+    if (failure)
+        return std::unexpected(*failure);
+
+    return {};
 }
 
 } // namespace stems
@@ -1,5 +1,11 @@
 #include "stft.h"
+#include "simd.h"
+#include <unistd.h>
 #include <algorithm>
+#include <cstdlib>
+#include <format>
+#include <system_error>
+#include <array>
 #include <cmath>
 #include <numbers>
 #include <print>
@@ -38,8 +44,121 @@ std::size_t calculate_num_frames(std::size_t signal_length) {
     return signal_length / stft_params::hop_size + 1uz;
 }
 
+// Window one frame of the center-padded signal into `frame` (window_size samples)
+void window_frame(
+    std::span<float const> audio,
+    std::size_t frame_idx,
+    std::span<float const> window,
+    std::span<float> frame
+) {
+    // Center padding: pad signal by window_size/2 on each side
+    // This matches torch.stft(center=True) behavior
+    auto constexpr pad_size = stft_params::window_size / 2;
+
+    // Frame starts at frame_idx * hop in the padded signal
+    auto const start_pos = frame_idx * stft_params::hop_size;
+
+    // Clip the frame to the signal once instead of testing every sample:
+    // [0, lead) is padding before the start, [lead, lead + count) is audio
+    auto const lead = start_pos < pad_size ? pad_size - start_pos : 0uz;
+    auto const audio_start = start_pos + lead - pad_size;
+    auto const count = audio_start < audio.size()
+        ? std::min(stft_params::window_size - lead, audio.size() - audio_start)
+        : 0uz;
+
+    if (count == stft_params::window_size) {
+        // Interior frame: straight vector multiply
+        simd::multiply(frame, audio.subspan(audio_start, count), window);
+    } else {
+        // Edge frame: zero-pad around the part that overlaps the signal
+        std::fill_n(frame.begin(), lead, 0.0f);
+        simd::multiply(frame.subspan(lead, count), audio.subspan(audio_start, count), window.subspan(lead, count));
+        std::fill(frame.begin() + static_cast<std::ptrdiff_t>(lead + count), frame.end(), 0.0f);
+    }
+}
+
+// Per-thread transform buffers, so one processor can be used from many threads
+// Allocated with fftwf_alloc_* to keep the SIMD alignment the plans were made with
+struct Scratch {
+    FftwRealBuffer frame{fftwf_alloc_real(stft_params::fft_size)};
+    FftwComplexBuffer spectrum{fftwf_alloc_complex(stft_params::fft_bins)};
+
+    // Batched chunk buffers, grown to the largest chunk this thread transforms
+    FftwRealBuffer chunk_input;
+    FftwRealBuffer chunk_real;
+    FftwRealBuffer chunk_imag;
+    std::size_t chunk_frames = 0uz;
+};
+
+Scratch& thread_scratch() {
+    thread_local auto scratch = Scratch{};
+    return scratch;
+}
+
+bool reserve_chunk(Scratch& scratch, std::size_t num_frames) {
+    if (scratch.chunk_frames >= num_frames)
+        return true;
+
+    scratch.chunk_input.reset(fftwf_alloc_real(num_frames * stft_params::fft_size));
+    scratch.chunk_real.reset(fftwf_alloc_real(stft_params::fft_bins * num_frames));
+    scratch.chunk_imag.reset(fftwf_alloc_real(stft_params::fft_bins * num_frames));
+
+    auto const allocated = scratch.chunk_input and scratch.chunk_real and scratch.chunk_imag;
+    scratch.chunk_frames = allocated ? num_frames : 0uz;
+    return allocated;
+}
+
+// Current process-wide wisdom (empty if FFTW can't export it)
+std::string export_wisdom() {
+    auto const wisdom = std::unique_ptr<char, decltype(&std::free)>{fftwf_export_wisdom_to_string(), &std::free};
+    return wisdom ? std::string{wisdom.get()} : std::string{};
+}
+
 } // anonymous namespace
 
+FftwWisdomFile::FftwWisdomFile(std::filesystem::path path) : path_(std::move(path)) {
+    if (path_.empty() or !std::filesystem::exists(path_))
+        return;
+
+    loaded_ = fftwf_import_wisdom_from_filename(path_.c_str()) != 0;
+    if (loaded_)
+        saved_ = export_wisdom();
+    else
+        std::println(stderr, "Ignoring unreadable FFTW wisdom: {}", path_.string());
+}
+
+FftwWisdomFile::~FftwWisdomFile() {
+    save();
+}
+
+bool FftwWisdomFile::save() {
+    if (path_.empty())
+        return false;
+
+    auto wisdom = export_wisdom();
+    if (wisdom.empty() or wisdom == saved_)
+        return true;
+
+    // Written under a temporary name so concurrent processes never read a partial file
+    auto error = std::error_code{};
+    std::filesystem::create_directories(path_.parent_path(), error);
+    auto const temp_path = std::filesystem::path{path_.string() + std::format(".{}.tmp", ::getpid())};
+
+    if (fftwf_export_wisdom_to_filename(temp_path.c_str()) == 0) {
+        std::println(stderr, "Could not write FFTW wisdom: {}", path_.string());
+        return false;
+    }
+
+    std::filesystem::rename(temp_path, path_, error);
+    if (error) {
+        std::filesystem::remove(temp_path, error);
+        return false;
+    }
+
+    saved_ = std::move(wisdom);
+    return true;
+}
+
 FftwPlan::FftwPlan(fftwf_plan plan) : plan_(plan) {}
 
 FftwPlan::~FftwPlan() {
@@ -65,172 +184,371 @@ void FftwPlan::execute() {
     fftwf_execute(plan_);
 }
 
-StftProcessor::StftProcessor() : window_(make_hann_window(stft_params::window_size)) {
-    initialize_fftw();
-}
+StftProcessor::StftProcessor() : StftProcessor(0uz) {}
+
+StftProcessor::StftProcessor(std::size_t chunk_samples, unsigned planner_flags) {
+    auto plans = std::make_shared<Plans>();
+    compute_windows(*plans);
 
-StftProcessor::~StftProcessor() {
-    if (forward_plan_)
-        fftwf_destroy_plan(forward_plan_);
-    if (fftw_input_)
-        fftwf_free(fftw_input_);
-    if (fftw_output_)
-        fftwf_free(fftw_output_);
+    if (!plan_transforms(*plans, planner_flags))
+        std::println(stderr, "FFTW planning failed");
+
+    if (chunk_samples > 0uz and !plan_chunk(*plans, chunk_samples, planner_flags))
+        std::println(stderr, "Batched STFT planning failed, using per-frame transforms");
+
+    plans_ = std::move(plans);
 }
 
-bool StftProcessor::initialize_fftw() {
-    // Allocate FFTW buffers once
-    fftw_input_ = fftwf_alloc_real(stft_params::fft_size);
-    fftw_output_ = fftwf_alloc_complex(stft_params::num_bins);
+bool StftProcessor::plan_transforms(Plans& plans, unsigned planner_flags) {
+    // Planning buffers only fix size and alignment; execution uses per-thread scratch
+    // (r2c writes the Nyquist bin too)
+    auto const real = FftwRealBuffer{fftwf_alloc_real(stft_params::fft_size)};
+    auto const complex = FftwComplexBuffer{fftwf_alloc_complex(stft_params::fft_bins)};
 
-    if (!fftw_input_ or !fftw_output_)
+    if (!real or !complex)
         return false;
 
-    // Create FFTW plan once
-    forward_plan_ = fftwf_plan_dft_r2c_1d(
+    plans.forward = FftwPlan{fftwf_plan_dft_r2c_1d(
+        static_cast<int>(stft_params::fft_size),
+        real.get(),
+        complex.get(),
+        planner_flags
+    )};
+
+    plans.inverse = FftwPlan{fftwf_plan_dft_c2r_1d(
         static_cast<int>(stft_params::fft_size),
-        fftw_input_,
-        fftw_output_,
-        FFTW_MEASURE  // Use MEASURE for better performance
-    );
+        complex.get(),
+        real.get(),
+        planner_flags
+    )};
 
-    return forward_plan_ != nullptr;
+    return plans.forward.get() != nullptr and plans.inverse.get() != nullptr;
 }
 
-void StftProcessor::compute_hann_window() {
-    window_ = make_hann_window(stft_params::window_size);
+bool StftProcessor::plan_chunk(Plans& plans, std::size_t chunk_samples, unsigned planner_flags) {
+    auto const num_frames = calculate_num_frames(chunk_samples);
+    if (num_frames == 0uz)
+        return false;
+
+    auto& scratch = thread_scratch();
+    if (!reserve_chunk(scratch, num_frames))
+        return false;
+
+    // One 4096-point transform per frame: contiguous input, output bins strided
+    // by the frame count so results land bin-major [bins, frames]
+    auto const transform = fftwf_iodim{
+        .n = static_cast<int>(stft_params::fft_size),
+        .is = 1,
+        .os = static_cast<int>(num_frames)
+    };
+
+    // Batched over every frame of the channel
+    auto const frames = fftwf_iodim{
+        .n = static_cast<int>(num_frames),
+        .is = static_cast<int>(stft_params::fft_size),
+        .os = 1
+    };
+
+    plans.chunk = FftwPlan{fftwf_plan_guru_split_dft_r2c(
+        1, &transform,
+        1, &frames,
+        scratch.chunk_input.get(),
+        scratch.chunk_real.get(),
+        scratch.chunk_imag.get(),
+        planner_flags
+    )};
+
+    if (!plans.chunk.get())
+        return false;
+
+    plans.chunk_samples = chunk_samples;
+    plans.chunk_frames = num_frames;
+    return true;
+}
+
+void StftProcessor::compute_windows(Plans& plans) {
+    auto constexpr window_size = stft_params::window_size;
+    auto constexpr hop = stft_params::hop_size;
+    auto constexpr edge = window_size - hop;
+
+    plans.window = make_hann_window(window_size);
+    auto const& window = plans.window;
+
+    auto const fft_scale = 1.0f / static_cast<float>(stft_params::fft_size);
+    plans.synthesis_window.resize(window_size);
+    for (auto i = 0uz; i < window_size; ++i)
+        plans.synthesis_window[i] = window[i] * fft_scale;
+
+    auto const squared = [&window](std::size_t i) { return window[i] * window[i]; };
+
+    // Position i mod hop inside every frame that overlaps it
+    plans.window_sum_period.assign(hop, 0.0f);
+    for (auto i = 0uz; i < window_size; ++i)
+        plans.window_sum_period[i % hop] += squared(i);
+
+    // Leading samples: only frames starting at or before them contribute
+    plans.window_sum_head.assign(edge, 0.0f);
+    for (auto i = 0uz; i < edge; ++i)
+        for (auto offset = i % hop; offset <= i; offset += hop)
+            plans.window_sum_head[i] += squared(offset);
+
+    // Trailing samples: only frames ending after them contribute
+    plans.window_sum_tail.assign(edge, 0.0f);
+    for (auto j = 0uz; j < edge; ++j)
+        for (auto offset = hop + j; offset < window_size; offset += hop)
+            plans.window_sum_tail[j] += squared(offset);
 }
 
-std::expected<Spectrogram, StftError> StftProcessor::forward(std::span<float const> audio) {
+std::expected<Spectrogram, StftError> StftProcessor::forward(std::span<float const> audio) const {
+    auto spec = Spectrogram{};
+    if (auto const result = forward(audio, spec); !result)
+        return std::unexpected(result.error());
+
+    return spec;
+}
+
+std::expected<void, StftError> StftProcessor::forward(
+    std::span<float const> audio,
+    Spectrogram& spec
+) const {
+    auto const num_frames = calculate_num_frames(audio.size());
+
+    // Size output buffers (no reallocation when reused for same-sized chunks)
+    spec.real.resize(num_frames * stft_params::num_bins);
+    spec.imag.resize(num_frames * stft_params::num_bins);
+    spec.num_frames = num_frames;
+    spec.num_bins = stft_params::num_bins;
+
+    return forward(audio, spec.real, spec.imag);
+}
+
+std::expected<void, StftError> StftProcessor::forward(
+    std::span<float const> audio,
+    std::span<float> real,
+    std::span<float> imag
+) const {
     if (!is_valid_input(audio))
         return std::unexpected(StftError::InvalidInput);
 
-    if (!forward_plan_ or !fftw_input_ or !fftw_output_)
+    if (!plans_->forward.get())
         return std::unexpected(StftError::PlanningFailed);
 
     auto const num_frames = calculate_num_frames(audio.size());
     if (num_frames == 0uz)
         return std::unexpected(StftError::InvalidInput);
 
-    // Allocate output buffers
-    auto spec = Spectrogram{
-        .real = std::vector<float>(num_frames * stft_params::num_bins),
-        .imag = std::vector<float>(num_frames * stft_params::num_bins),
-        .num_frames = num_frames,
-        .num_bins = stft_params::num_bins
-    };
+    if (real.size() != num_frames * stft_params::num_bins or imag.size() != real.size())
+        return std::unexpected(StftError::InvalidInput);
 
-    // Center padding: pad signal by window_size/2 on each side
-    // This matches torch.stft(center=True) behavior
-    auto constexpr pad_size = stft_params::window_size / 2;
+    if (plans_->chunk.get() and audio.size() == plans_->chunk_samples)
+        return forward_chunk(audio, real, imag);
+
+    auto const& scratch = thread_scratch();
+    if (!scratch.frame or !scratch.spectrum)
+        return std::unexpected(StftError::AllocationFailed);
 
     // Process each frame with center padding
-    for (auto frame_idx = 0uz; frame_idx < num_frames; ++frame_idx) {
-        auto const center_pos = frame_idx * stft_params::hop_size;
-        auto const start_pos = center_pos > pad_size ? center_pos - pad_size : 0uz;
-
-        // Apply window and copy to FFTW input buffer
-        for (auto i = 0uz; i < stft_params::window_size; ++i) {
-            // Calculate position in original audio (accounting for padding)
-            auto const padded_pos = start_pos + i;
-            auto const audio_idx = padded_pos >= pad_size ? padded_pos - pad_size : 0uz;
-
-            // Zero-pad before start or after end
-            if (padded_pos < pad_size or audio_idx >= audio.size()) {
-                fftw_input_[i] = 0.0f;
-            } else {
-                fftw_input_[i] = audio[audio_idx] * window_[i];
-            }
-        }
+    for (auto frame_idx = 0uz; frame_idx < num_frames; ++frame_idx)
+        forward_frame(audio, frame_idx, real, imag);
 
-        // Execute FFT using cached plan
-        fftwf_execute(forward_plan_);
+    return {};
+}
 
-        // Copy complex results to spectrogram
+std::expected<void, StftError> StftProcessor::forward_delayed(
+    std::span<float const> delayed,
+    std::size_t delay_frames,
+    std::span<float const> base_real,
+    std::span<float const> base_imag,
+    std::span<float> real,
+    std::span<float> imag
+) const {
+    if (!is_valid_input(delayed))
+        return std::unexpected(StftError::InvalidInput);
+
+    if (!plans_->forward.get())
+        return std::unexpected(StftError::PlanningFailed);
+
+    auto const num_frames = calculate_num_frames(delayed.size());
+    auto const plane_size = num_frames * stft_params::num_bins;
+    if (real.size() != plane_size or imag.size() != plane_size
+        or base_real.size() != plane_size or base_imag.size() != plane_size)
+        return std::unexpected(StftError::InvalidInput);
+
+    auto const& scratch = thread_scratch();
+    if (!scratch.frame or !scratch.spectrum)
+        return std::unexpected(StftError::AllocationFailed);
+
+    // Frame f covers samples [f * hop - window/2, f * hop + window/2). Before the cut
+    // end it sees the same samples as base frame f - delay (the zeros in front match
+    // the base's own centre padding), so only frames over the delay or the end differ
+    auto const first_copied = std::min(delay_frames, num_frames);
+    auto const last_copied = std::max(first_copied,
+                                      (delayed.size() - stft_params::window_size / 2uz) / stft_params::hop_size + 1uz);
+
+    if (last_copied > first_copied)
         for (auto bin = 0uz; bin < stft_params::num_bins; ++bin) {
-            auto const spec_idx = frame_idx * stft_params::num_bins + bin;
-            spec.real[spec_idx] = fftw_output_[bin][0]; // Real part
-            spec.imag[spec_idx] = fftw_output_[bin][1]; // Imaginary part
+            auto const row = bin * num_frames;
+            std::copy_n(base_real.begin() + static_cast<std::ptrdiff_t>(row), last_copied - first_copied,
+                        real.begin() + static_cast<std::ptrdiff_t>(row + first_copied));
+            std::copy_n(base_imag.begin() + static_cast<std::ptrdiff_t>(row), last_copied - first_copied,
+                        imag.begin() + static_cast<std::ptrdiff_t>(row + first_copied));
         }
+
+    for (auto frame_idx = 0uz; frame_idx < first_copied; ++frame_idx)
+        forward_frame(delayed, frame_idx, real, imag);
+    for (auto frame_idx = last_copied; frame_idx < num_frames; ++frame_idx)
+        forward_frame(delayed, frame_idx, real, imag);
+
+    return {};
+}
+
+void StftProcessor::forward_frame(
+    std::span<float const> audio,
+    std::size_t frame_idx,
+    std::span<float> real,
+    std::span<float> imag
+) const {
+    auto const& scratch = thread_scratch();
+    auto const input = std::span{scratch.frame.get(), stft_params::fft_size};
+    auto* const output = scratch.spectrum.get();
+    auto const num_frames = real.size() / stft_params::num_bins;
+
+    window_frame(audio, frame_idx, plans_->window, input);
+
+    // Execute the shared plan on this thread's buffers
+    fftwf_execute_dft_r2c(plans_->forward.get(), input.data(), output);
+
+    // Scatter complex results into [bins, frames] planes (model tensor layout)
+    for (auto bin = 0uz; bin < stft_params::num_bins; ++bin) {
+        auto const spec_idx = bin * num_frames + frame_idx;
+        real[spec_idx] = output[bin][0]; // Real part
+        imag[spec_idx] = output[bin][1]; // Imaginary part
     }
+}
 
-    std::println("STFT forward: {} samples -> {} frames x {} bins",
-                 audio.size(), num_frames, stft_params::num_bins);
+std::expected<void, StftError> StftProcessor::forward_chunk(
+    std::span<float const> audio,
+    std::span<float> real,
+    std::span<float> imag
+) const {
+    auto const num_frames = plans_->chunk_frames;
 
-    return spec;
+    auto& scratch = thread_scratch();
+    if (!reserve_chunk(scratch, num_frames))
+        return std::unexpected(StftError::AllocationFailed);
+
+    // Window every frame, then transform them all in one call
+    auto const frames = std::span{scratch.chunk_input.get(), num_frames * stft_params::fft_size};
+    for (auto frame_idx = 0uz; frame_idx < num_frames; ++frame_idx)
+        window_frame(audio, frame_idx, plans_->window,
+                     frames.subspan(frame_idx * stft_params::fft_size, stft_params::fft_size));
+
+    fftwf_execute_split_dft_r2c(plans_->chunk.get(), scratch.chunk_input.get(),
+                                scratch.chunk_real.get(), scratch.chunk_imag.get());
+
+    // Rows 0..num_bins-1 of the split planes are already the tensor layout;
+    // copying them out as one block drops the Nyquist row the model doesn't take
+    std::copy_n(scratch.chunk_real.get(), real.size(), real.begin());
+    std::copy_n(scratch.chunk_imag.get(), imag.size(), imag.begin());
+
+    return {};
 }
 
-std::expected<std::vector<float>, StftError> StftProcessor::inverse(Spectrogram const& spec) {
+std::expected<void, StftError> StftProcessor::forward_stereo(
+    std::span<float const> left,
+    std::span<float const> right,
+    std::span<float> planes
+) const {
+    auto const num_frames = calculate_num_frames(left.size());
+    auto const plane_size = stft_params::num_bins * num_frames;
+
+    if (right.size() != left.size() or planes.size() != 4uz * plane_size)
+        return std::unexpected(StftError::InvalidInput);
+
+    if (auto const result = forward(left, planes.subspan(0uz, plane_size), planes.subspan(plane_size, plane_size)); !result)
+        return result;
+
+    return forward(right, planes.subspan(2uz * plane_size, plane_size), planes.subspan(3uz * plane_size, plane_size));
+}
+
+std::size_t StftProcessor::num_frames(std::size_t signal_length) {
+    return calculate_num_frames(signal_length);
+}
+
+std::expected<std::vector<float>, StftError> StftProcessor::inverse(Spectrogram const& spec) const {
     if (spec.num_frames == 0uz || spec.num_bins != stft_params::num_bins)
         return std::unexpected(StftError::InvalidInput);
 
-    // Calculate output length
-    auto const output_length = (spec.num_frames - 1uz) * stft_params::hop_size
-                              + stft_params::window_size;
-    auto output = std::vector<float>(output_length, 0.0f);
-    auto window_sum = std::vector<float>(output_length, 0.0f);
+    if (spec.real.size() != spec.num_frames * spec.num_bins or spec.imag.size() != spec.real.size())
+        return std::unexpected(StftError::InvalidInput);
 
-    // Allocate FFTW buffers
-    auto* input = fftwf_alloc_complex(stft_params::num_bins);
-    auto* output_buf = fftwf_alloc_real(stft_params::fft_size);
+    if (!plans_->inverse.get())
+        return std::unexpected(StftError::PlanningFailed);
 
-    if (!input || !output_buf) {
-        if (input) fftwf_free(input);
-        if (output_buf) fftwf_free(output_buf);
+    auto& scratch = thread_scratch();
+    if (!scratch.frame or !scratch.spectrum)
         return std::unexpected(StftError::AllocationFailed);
-    }
 
-    // Create FFTW plan for complex-to-real transform
-    auto* plan = fftwf_plan_dft_c2r_1d(
-        static_cast<int>(stft_params::fft_size),
-        input,
-        output_buf,
-        FFTW_ESTIMATE
-    );
-
-    if (!plan) {
-        fftwf_free(input);
-        fftwf_free(output_buf);
-        return std::unexpected(StftError::PlanningFailed);
-    }
+    auto constexpr window_size = stft_params::window_size;
+    auto constexpr hop = stft_params::hop_size;
+    auto constexpr edge = window_size - hop;
+
+    // Calculate output length
+    auto const output_length = (spec.num_frames - 1uz) * hop + window_size;
+    auto output = std::vector<float>(output_length, 0.0f);
 
-    auto fftw_plan = FftwPlan{plan};
+    auto* const input = scratch.spectrum.get();
+    auto const frame = std::span<float const>{scratch.frame.get(), stft_params::fft_size};
 
     // Process each frame
     for (auto frame_idx = 0uz; frame_idx < spec.num_frames; ++frame_idx) {
         // Copy complex spectrogram to FFTW input buffer
         for (auto bin = 0uz; bin < stft_params::num_bins; ++bin) {
-            auto const spec_idx = frame_idx * stft_params::num_bins + bin;
+            auto const spec_idx = bin * spec.num_frames + frame_idx;
             input[bin][0] = spec.real[spec_idx];
             input[bin][1] = spec.imag[spec_idx];
         }
 
-        // Execute inverse FFT
-        fftw_plan.execute();
+        // The model drops the Nyquist bin, so reconstruct with it zeroed
+        // (c2r overwrites its input, so this is reset every frame)
+        input[stft_params::num_bins][0] = 0.0f;
+        input[stft_params::num_bins][1] = 0.0f;
 
-        // Overlap-add with windowing
-        auto const start_pos = frame_idx * stft_params::hop_size;
-        auto const fft_scale = 1.0f / static_cast<float>(stft_params::fft_size);
+        // Execute the shared inverse plan on this thread's buffers
+        fftwf_execute_dft_c2r(plans_->inverse.get(), input, scratch.frame.get());
 
-        for (auto i = 0uz; i < stft_params::window_size; ++i) {
-            auto const out_idx = start_pos + i;
-            if (out_idx < output_length) {
-                output[out_idx] += output_buf[i] * window_[i] * fft_scale;
-                window_sum[out_idx] += window_[i] * window_[i];
-            }
-        }
+        // Overlap-add with the scaled synthesis window
+        auto const out = std::span{output}.subspan(frame_idx * hop, window_size);
+        simd::multiply_add(out, frame, plans_->synthesis_window);
     }
 
-    // Normalise by window sum to avoid amplitude modulation
-    for (auto i = 0uz; i < output_length; ++i)
-        if (window_sum[i] > 1e-8f)
-            output[i] /= window_sum[i];
-
-    fftwf_free(input);
-    fftwf_free(output_buf);
+    // Normalise by window sum to avoid amplitude modulation, using the precomputed
+    // edge and periodic sums once the head and tail regions don't overlap
+    auto const normalise = [&](std::size_t i, float window_sum) {
+        if (window_sum > 1e-8f)
+            output[i] /= window_sum;
+    };
 
-    std::println("STFT inverse: {} frames x {} bins -> {} samples",
-                 spec.num_frames, spec.num_bins, output.size());
+    if (output_length >= 2uz * edge) {
+        for (auto i = 0uz; i < edge; ++i)
+            normalise(i, plans_->window_sum_head[i]);
+        for (auto i = edge; i < output_length - edge; ++i)
+            normalise(i, plans_->window_sum_period[i % hop]);
+        for (auto j = 0uz; j < edge; ++j)
+            normalise(output_length - edge + j, plans_->window_sum_tail[j]);
+    } else {
+        // Signals of one or two frames: sum the few contributions directly
+        auto const& window = plans_->window;
+        for (auto i = 0uz; i < output_length; ++i) {
+            auto window_sum = 0.0f;
+            for (auto frame_idx = 0uz; frame_idx < spec.num_frames; ++frame_idx) {
+                auto const start = frame_idx * hop;
+                if (i >= start and i - start < window_size)
+                    window_sum += window[i - start] * window[i - start];
+            }
+            normalise(i, window_sum);
+        }
+    }
 
     return output;
 }
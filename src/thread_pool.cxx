@@ -0,0 +1,76 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace stems {
+
+ThreadPool::ThreadPool(std::size_t num_threads) {
+    workers_.reserve(num_threads);
+    for (auto i = 0uz; i < num_threads; ++i)
+        workers_.emplace_back([this](std::stop_token stop) { run_worker(stop); });
+}
+
+void ThreadPool::run_worker(std::stop_token stop) {
+    while (true) {
+        auto task = std::function<void()>{};
+        {
+            auto lock = std::unique_lock{mutex_};
+            if (!wake_.wait(lock, stop, [this] { return !tasks_.empty(); }))
+                return;
+
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallel_for(std::size_t count, std::function<void(std::size_t)> const& body) {
+    if (count == 0uz)
+        return;
+
+    auto const helpers = std::min(count - 1uz, workers_.size());
+    if (helpers == 0uz) {
+        for (auto i = 0uz; i < count; ++i)
+            body(i);
+        return;
+    }
+
+    // Shared with the helper tasks, which may only start after the loop is done
+    // The body is only touched after claiming an index, and the caller waits for
+    // every index to finish, so it outlives every call
+    struct Loop {
+        std::function<void(std::size_t)> const* body;
+        std::size_t count;
+        std::atomic<std::size_t> next{0uz};
+        std::atomic<std::size_t> done{0uz};
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    auto const loop = std::make_shared<Loop>(&body, count);
+    auto const run = [](Loop& state) {
+        for (auto i = state.next++; i < state.count; i = state.next++) {
+            (*state.body)(i);
+            if (++state.done == state.count) {
+                auto const lock = std::lock_guard{state.mutex};
+                state.finished.notify_all();
+            }
+        }
+    };
+
+    {
+        auto const lock = std::lock_guard{mutex_};
+        for (auto i = 0uz; i < helpers; ++i)
+            tasks_.emplace_back([loop, run] { run(*loop); });
+    }
+    wake_.notify_all();
+
+    run(*loop);
+
+    auto lock = std::unique_lock{loop->mutex};
+    loop->finished.wait(lock, [&] { return loop->done == loop->count; });
+}
+
+} // namespace stems
@@ -0,0 +1,107 @@
+#include "wav_file.h"
+#include <algorithm>
+#include <array>
+#include <utility>
+
+namespace stems {
+
+namespace {
+
+// Canonical 44-byte header and silent data of a stereo file, for the compile-time tests
+template <std::uint32_t Format, std::uint32_t Bits, std::size_t Frames>
+constexpr auto test_file() {
+    auto header = std::array<std::byte, 44uz + Frames * 2uz * Bits / 8uz>{};
+    auto const put = [&](std::size_t offset, std::uint32_t value, std::size_t width) {
+        for (auto i = 0uz; i < width; ++i)
+            header[offset + i] = static_cast<std::byte>((value >> (8uz * i)) & 0xffu);
+    };
+    auto const put_tag = [&](std::size_t offset, std::string_view tag) {
+        for (auto i = 0uz; i < tag.size(); ++i)
+            header[offset + i] = static_cast<std::byte>(tag[i]);
+    };
+
+    auto constexpr block_align = 2u * Bits / 8u;
+    put_tag(0uz, "RIFF");
+    put(4uz, static_cast<std::uint32_t>(header.size() - 8uz), 4uz);
+    put_tag(8uz, "WAVE");
+    put_tag(12uz, "fmt ");
+    put(16uz, 16u, 4uz);
+    put(20uz, Format, 2uz);
+    put(22uz, 2u, 2uz);
+    put(24uz, 44100u, 4uz);
+    put(28uz, 44100u * block_align, 4uz);
+    put(32uz, block_align, 2uz);
+    put(34uz, Bits, 2uz);
+    put_tag(36uz, "data");
+    put(40uz, static_cast<std::uint32_t>(Frames * block_align), 4uz);
+    return header;
+}
+
+// Compile-time tests
+static_assert(parse_wav_header(test_file<1u, 24u, 3uz>())->encoding == WavEncoding::Pcm24);
+static_assert(parse_wav_header(test_file<1u, 24u, 3uz>())->data_offset == 44uz);
+static_assert(parse_wav_header(test_file<1u, 24u, 3uz>())->frames == 3uz);
+static_assert(parse_wav_header(test_file<3u, 32u, 2uz>())->encoding == WavEncoding::Float32);
+static_assert(parse_wav_header(test_file<1u, 16u, 2uz>())->sample_rate == 44100);
+static_assert(!parse_wav_header(test_file<3u, 64u, 2uz>()).has_value());
+static_assert(!parse_wav_header(test_file<1u, 8u, 2uz>()).has_value());
+
+// De-interleave stereo frames of one encoding (the switch is hoisted out of the loop)
+template <WavEncoding Encoding>
+void decode_stereo(std::byte const* frames, std::span<float> left, std::span<float> right) {
+    constexpr auto sample_bytes = bytes_per_sample(Encoding);
+    constexpr auto frame_bytes = sample_bytes * 2uz;
+
+    for (auto i = 0uz; i < left.size(); ++i) {
+        auto const* const frame = frames + i * frame_bytes;
+        left[i] = decode_sample(Encoding, frame);
+        right[i] = decode_sample(Encoding, frame + sample_bytes);
+    }
+}
+
+} // anonymous namespace
+
+WavFile::WavFile(MappedFile file, WavLayout layout) : file_(std::move(file)), layout_(layout) {}
+
+std::optional<WavFile> WavFile::open(std::filesystem::path const& path) {
+    auto file = MappedFile::open(path);
+    if (!file)
+        return std::nullopt;
+
+    auto const layout = parse_wav_header(file->bytes());
+    if (!layout)
+        return std::nullopt;
+
+    // Separation walks the track front to back
+    file->advise_sequential();
+    return WavFile{std::move(*file), *layout};
+}
+
+std::size_t WavFile::read(std::size_t frame, std::span<float> left, std::span<float> right) const {
+    if (layout_.channels != 2 or frame >= layout_.frames)
+        return 0uz;
+
+    auto const count = std::min({left.size(), right.size(), layout_.frames - frame});
+    auto const* const source = samples().data() + frame * layout_.frame_bytes();
+    left = left.first(count);
+    right = right.first(count);
+
+    switch (layout_.encoding) {
+        case WavEncoding::Pcm16:
+            decode_stereo<WavEncoding::Pcm16>(source, left, right);
+            break;
+        case WavEncoding::Pcm24:
+            decode_stereo<WavEncoding::Pcm24>(source, left, right);
+            break;
+        case WavEncoding::Pcm32:
+            decode_stereo<WavEncoding::Pcm32>(source, left, right);
+            break;
+        case WavEncoding::Float32:
+            decode_stereo<WavEncoding::Float32>(source, left, right);
+            break;
+    }
+
+    return count;
+}
+
+} // namespace stems